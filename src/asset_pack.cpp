@@ -0,0 +1,232 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef LD39_LZ4
+#include <lz4.h>
+#endif
+
+#include "asset_pack.h"
+
+
+AssetPack::AssetPack()
+	: _header(nullptr)
+	, _entries(nullptr)
+{
+}
+
+
+bool AssetPack::open(const Path& path, Logger& log) {
+	close();
+
+	if(!_file.open(path))
+		return false;
+
+	_header  = reinterpret_cast<const AssetPackHeader*>(_file.data());
+	_entries = reinterpret_cast<const AssetPackEntry*>(_file.data() + _header->index);
+	if(!validate(log, path)) {
+		close();
+		return false;
+	}
+
+	log.info("Use asset pack ", path, " (", _header->nEntries, " assets)");
+	return true;
+}
+
+
+void AssetPack::close() {
+	_file.close();
+	_header  = nullptr;
+	_entries = nullptr;
+}
+
+
+const AssetPackEntry* AssetPack::find(const Path& path) const {
+	if(!_header)
+		return nullptr;
+
+	const char* name = path.utf8CStr();
+	const AssetPackEntry* end = _entries + _header->nEntries;
+	const AssetPackEntry* entry = std::lower_bound(_entries, end, name,
+	                                               [this](const AssetPackEntry& e, const char* name) {
+		return std::strcmp(this->path(e), name) < 0;
+	});
+	if(entry == end || std::strcmp(this->path(*entry), name) != 0)
+		return nullptr;
+	return entry;
+}
+
+
+bool AssetPack::read(const Path& path, AssetBytes& bytes, Logger& log) const {
+	const AssetPackEntry* entry = find(path);
+	if(!entry)
+		return false;
+
+	const uint8* stored = _file.data() + entry->offset;
+	bytes.buffer.clear();
+	if(entry->compression == PACK_STORED) {
+		bytes.data = stored;
+		bytes.size = entry->size;
+		return true;
+	}
+
+#ifdef LD39_LZ4
+	if(entry->compression == PACK_LZ4) {
+		bytes.buffer.resize(entry->size);
+		int size = LZ4_decompress_safe(reinterpret_cast<const char*>(stored),
+		                               reinterpret_cast<char*>(bytes.buffer.data()),
+		                               entry->storedSize, entry->size);
+		if(size == int(entry->size)) {
+			bytes.data = bytes.buffer.data();
+			bytes.size = bytes.buffer.size();
+			return true;
+		}
+		bytes.buffer.clear();
+	}
+#endif
+
+	log.error(path, ": Failed to read from the asset pack");
+	return false;
+}
+
+
+// Offsets must stay in the file and paths must be sorted, so that a
+// truncated or outdated pack can not crash the game.
+bool AssetPack::validate(Logger& log, const Path& path) const {
+	if(_file.size() < sizeof(AssetPackHeader) || _header->magic != ASSET_PACK_MAGIC) {
+		log.error(path, ": Not an asset pack");
+		return false;
+	}
+	if(_header->version != ASSET_PACK_VERSION) {
+		log.warning(path, ": Asset pack version ", _header->version,
+		            ", expected ", unsigned(ASSET_PACK_VERSION));
+		return false;
+	}
+
+	const AssetPackHeader& h = *_header;
+	uint64 size = _file.size();
+	bool ok = h.size == size
+	       && h.index % 4 == 0 && h.index + uint64(h.nEntries) * sizeof(AssetPackEntry) <= size
+	       && h.paths + uint64(h.pathsSize) <= size
+	       && (h.nEntries == 0
+	           || (h.pathsSize != 0 && _file.data()[h.paths + h.pathsSize - 1] == '\0'));
+
+	for(unsigned ei = 0; ok && ei < h.nEntries; ++ei) {
+		const AssetPackEntry& e = _entries[ei];
+		ok = e.path < h.pathsSize
+		  && e.offset % ASSET_PACK_ALIGNMENT == 0
+		  && e.offset + uint64(e.storedSize) <= size
+		  && (e.compression != PACK_STORED || e.storedSize == e.size)
+		  && (ei == 0 || std::strcmp(this->path(_entries[ei - 1]), this->path(e)) < 0);
+	}
+
+	if(!ok)
+		log.error(path, ": Corrupted asset pack");
+	return ok;
+}
+
+
+// Assets are only kept compressed if it saves space.
+void AssetPackWriter::addAsset(const std::string& path, const std::vector<uint8>& data,
+                               bool compress) {
+	Asset asset{ path, PACK_STORED, uint32(data.size()), data };
+
+#ifdef LD39_LZ4
+	if(compress && !data.empty()) {
+		std::vector<uint8> compressed(LZ4_compressBound(data.size()));
+		int size = LZ4_compress_default(reinterpret_cast<const char*>(data.data()),
+		                                reinterpret_cast<char*>(compressed.data()),
+		                                data.size(), compressed.size());
+		if(size > 0 && size_t(size) < data.size()) {
+			compressed.resize(size);
+			asset.compression = PACK_LZ4;
+			asset.data.swap(compressed);
+		}
+	}
+#else
+	(void)compress;
+#endif
+
+	_assets.push_back(std::move(asset));
+}
+
+
+void AssetPackWriter::write(std::vector<uint8>& buffer) const {
+	std::vector<const Asset*> assets;
+	for(const Asset& asset: _assets)
+		assets.push_back(&asset);
+	std::sort(assets.begin(), assets.end(), [](const Asset* a0, const Asset* a1) {
+		return a0->path < a1->path;
+	});
+
+	auto align = [](size_t offset, size_t alignment) {
+		return (offset + alignment - 1) / alignment * alignment;
+	};
+
+	AssetPackHeader header;
+	std::memset(&header, 0, sizeof(header));
+	header.magic    = ASSET_PACK_MAGIC;
+	header.version  = ASSET_PACK_VERSION;
+	header.nEntries = assets.size();
+	header.index    = sizeof(AssetPackHeader);
+	header.paths    = header.index + assets.size() * sizeof(AssetPackEntry);
+
+	std::vector<AssetPackEntry> entries(assets.size());
+	std::string paths;
+	for(unsigned ai = 0; ai < assets.size(); ++ai) {
+		entries[ai].path = paths.size();
+		paths += assets[ai]->path;
+		paths += '\0';
+	}
+	header.pathsSize = paths.size();
+
+	size_t offset = header.paths + paths.size();
+	for(unsigned ai = 0; ai < assets.size(); ++ai) {
+		offset = align(offset, ASSET_PACK_ALIGNMENT);
+		entries[ai].compression = assets[ai]->compression;
+		entries[ai].offset      = offset;
+		entries[ai].storedSize  = assets[ai]->data.size();
+		entries[ai].size        = assets[ai]->size;
+		entries[ai].reserved    = 0;
+		offset += assets[ai]->data.size();
+	}
+	header.size = offset;
+
+	buffer.assign(offset, 0);
+	std::memcpy(buffer.data(), &header, sizeof(header));
+	if(!entries.empty())
+		std::memcpy(buffer.data() + header.index, entries.data(),
+		            entries.size() * sizeof(AssetPackEntry));
+	std::memcpy(buffer.data() + header.paths, paths.data(), paths.size());
+	for(unsigned ai = 0; ai < assets.size(); ++ai) {
+		if(!assets[ai]->data.empty())
+			std::memcpy(buffer.data() + entries[ai].offset, assets[ai]->data.data(),
+			            assets[ai]->data.size());
+	}
+}
+
+
+AssetStreamBuf::AssetStreamBuf(const AssetBytes& bytes) {
+	char* begin = const_cast<char*>(reinterpret_cast<const char*>(bytes.data));
+	setg(begin, begin, begin + bytes.size);
+}
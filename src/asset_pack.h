@@ -0,0 +1,149 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef LD39_ASSET_PACK_H_
+#define LD39_ASSET_PACK_H_
+
+
+#include <streambuf>
+#include <vector>
+
+#include <lair/core/lair.h>
+#include <lair/core/log.h>
+#include <lair/core/path.h>
+
+#include "mapped_file.h"
+
+
+using namespace lair;
+
+
+// Asset pack: assets stored in a single file, produced by pack_assets (see
+// the asset_pack target) and mapped in memory. Integers are little-endian.
+//
+// Layout: header, index (one AssetPackEntry per asset, sorted by path),
+// path table (NUL-terminated, referenced by byte offset), then the assets,
+// each aligned on ASSET_PACK_ALIGNMENT bytes so that stored (uncompressed)
+// assets can be used in place, like cooked levels.
+enum {
+	ASSET_PACK_MAGIC     = 0x4b50444c, // "LDPK"
+	ASSET_PACK_VERSION   = 1,
+	ASSET_PACK_ALIGNMENT = 16,
+};
+
+enum AssetPackCompression {
+	PACK_STORED,
+	PACK_LZ4,
+};
+
+struct AssetPackHeader {
+	uint32 magic;
+	uint32 version;
+	uint32 size;            // Whole file, in bytes.
+	uint32 nEntries;
+	uint32 index;           // Section offsets, in bytes.
+	uint32 paths;
+	uint32 pathsSize;
+	uint32 reserved;
+};
+
+struct AssetPackEntry {
+	uint32 path;            // Path table offset.
+	uint32 compression;     // AssetPackCompression.
+	uint32 offset;
+	uint32 storedSize;      // In the pack.
+	uint32 size;            // Once decompressed.
+	uint32 reserved;
+};
+
+
+// The content of an asset: in place (in a mapping) if buffer is empty,
+// else in buffer.
+struct AssetBytes {
+	const uint8*       data = nullptr;
+	size_t             size = 0;
+	std::vector<uint8> buffer;
+};
+
+
+// Serves the assets of a pack by path. Compressed assets are only
+// supported if the game is built with LZ4.
+class AssetPack {
+public:
+	AssetPack();
+	AssetPack(const AssetPack&)  = delete;
+	AssetPack(      AssetPack&&) = delete;
+	~AssetPack() = default;
+
+	AssetPack& operator=(const AssetPack&)  = delete;
+	AssetPack& operator=(      AssetPack&&) = delete;
+
+	bool open(const Path& path, Logger& log);
+	void close();
+
+	inline bool     isOpen()   const { return _header; }
+	inline unsigned nEntries() const { return _header? _header->nEntries: 0; }
+
+	const AssetPackEntry* find(const Path& path) const;
+
+	// Returns false if path is not in the pack (or can not be read).
+	bool read(const Path& path, AssetBytes& bytes, Logger& log) const;
+
+protected:
+	inline const char* path(const AssetPackEntry& entry) const {
+		return reinterpret_cast<const char*>(_file.data() + _header->paths) + entry.path;
+	}
+
+	bool validate(Logger& log, const Path& path) const;
+
+protected:
+	MappedFile             _file;
+	const AssetPackHeader* _header;
+	const AssetPackEntry*  _entries;
+};
+
+
+// Builds an asset pack.
+class AssetPackWriter {
+public:
+	void addAsset(const std::string& path, const std::vector<uint8>& data, bool compress);
+	void write(std::vector<uint8>& buffer) const;
+
+protected:
+	struct Asset {
+		std::string        path;
+		uint32             compression;
+		uint32             size;
+		std::vector<uint8> data;
+	};
+
+	std::vector<Asset> _assets;
+};
+
+
+// An istream over an asset, without copy.
+class AssetStreamBuf : public std::streambuf {
+public:
+	AssetStreamBuf(const AssetBytes& bytes);
+};
+
+
+#endif
@@ -0,0 +1,163 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "game.h"
+#include "level.h"
+#include "load_graph.h"
+
+#include "batch_simulator.h"
+
+
+BatchSimulator::BatchSimulator(Game* game, unsigned nWorlds, unsigned nThreads)
+    : _game(game),
+      _inputs(nullptr),
+      _nTicks(0),
+      _jobId(0),
+      _nBusy(0),
+      _stop(false),
+      _nextWorld(0)
+{
+	for(unsigned wi = 0; wi < nWorlds; ++wi)
+		_worlds.emplace_back(new World(game, dbgLogger));
+	_observations.resize(nWorlds);
+
+	if(nThreads == 0)
+		nThreads = std::max(std::thread::hardware_concurrency(), 1u);
+	nThreads = std::max(std::min(nThreads, nWorlds), 1u);
+
+	// The thread calling step() does its share of the work.
+	for(unsigned ti = 1; ti < nThreads; ++ti)
+		_threads.emplace_back(&BatchSimulator::workerMain, this);
+}
+
+
+BatchSimulator::~BatchSimulator() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+	_jobCond.notify_all();
+
+	for(std::thread& thread: _threads)
+		thread.join();
+}
+
+
+void BatchSimulator::initialize() {
+	StartupProfile::Scope scope(_game->profile(), "BatchSimulator::initialize");
+
+	// Assets are shared, the graph only loads them once.
+	LoadGraph graph(_game->loader(), _game->assets(), dbgLogger);
+	for(WorldUP& world: _worlds)
+		world->initialize(graph);
+	graph.wait();
+	scope.addBytes(graph.record(_game->profile(), _game->dataPath()));
+	_game->loader()->waitAll();
+}
+
+
+void BatchSimulator::start(const Path& level, const String& spawn) {
+	for(unsigned wi = 0; wi < _worlds.size(); ++wi)
+		restart(wi, level, spawn);
+}
+
+
+void BatchSimulator::restart(unsigned index, const Path& level, const String& spawn) {
+	World* world = _worlds.at(index).get();
+	world->setNextLevel(level, spawn);
+	world->start();
+	observe(index);
+}
+
+
+const ObservationVector& BatchSimulator::step(const InputVector& inputs, unsigned nTicks) {
+	lairAssert(inputs.size() == _worlds.size());
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_inputs    = &inputs;
+		_nTicks    = nTicks;
+		_nextWorld = 0;
+		_nBusy     = _threads.size();
+		_jobId    += 1;
+	}
+	_jobCond.notify_all();
+
+	runJob();
+
+	std::unique_lock<std::mutex> lock(_mutex);
+	_doneCond.wait(lock, [this] { return _nBusy == 0; });
+	_inputs = nullptr;
+
+	return _observations;
+}
+
+
+void BatchSimulator::observe(unsigned index) {
+	World*       world = _worlds[index].get();
+	Observation& obs   = _observations[index];
+
+	CharacterComponent* pChar = world->_characters.get(world->_player);
+
+	obs.tick       = world->_tickCount;
+	obs.state      = world->_state;
+	obs.level      = world->_level? world->_level->index(): 0;
+	obs.position   = world->_player.position2();
+	obs.velocity   = pChar? pChar->velocity: Vector2(Vector2::Zero());
+	obs.touchDir   = pChar? pChar->touchDir: 0;
+	obs.deathCount = world->_deathCount;
+	obs.gameOver   = world->_gameOver;
+}
+
+
+// Worlds are handed out one at a time, so a slow world (e.g. loading a
+// level) does not hold back the others.
+void BatchSimulator::runJob() {
+	unsigned nWorlds = _worlds.size();
+	for(unsigned wi = _nextWorld++; wi < nWorlds; wi = _nextWorld++) {
+		World*   world  = _worlds[wi].get();
+		unsigned inputs = (*_inputs)[wi];
+		for(unsigned ti = 0; ti < _nTicks && !world->_gameOver; ++ti)
+			world->updateTick(inputs);
+		observe(wi);
+	}
+}
+
+
+void BatchSimulator::workerMain() {
+	uint64 lastJob = 0;
+	while(true) {
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_jobCond.wait(lock, [this, lastJob] { return _stop || _jobId != lastJob; });
+			if(_stop)
+				return;
+			lastJob = _jobId;
+		}
+
+		runJob();
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		_nBusy -= 1;
+		if(_nBusy == 0)
+			_doneCond.notify_one();
+	}
+}
@@ -0,0 +1,112 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef LD39_BATCH_SIMULATOR_H_
+#define LD39_BATCH_SIMULATOR_H_
+
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <lair/core/lair.h>
+#include <lair/core/log.h>
+#include <lair/core/path.h>
+
+#include "world.h"
+
+
+using namespace lair;
+
+
+class Game;
+
+
+// What a bot (or a verification job) gets back from a world after a step.
+struct Observation {
+	uint64   tick;
+	State    state;
+	unsigned level;
+	Vector2  position;
+	Vector2  velocity;
+	unsigned touchDir;
+	unsigned deathCount;
+	bool     gameOver;
+};
+
+typedef std::vector<unsigned>    InputVector;
+typedef std::vector<Observation> ObservationVector;
+typedef std::unique_ptr<World>   WorldUP;
+
+
+// Runs independent worlds in parallel, one step at a time:
+// step(inputs[]) ticks every world with its own inputs and returns one
+// observation per world. Worlds never share mutable state (except while
+// loading levels, see World::_loadMutex), so it scales with the cores.
+class BatchSimulator {
+public:
+	BatchSimulator(Game* game, unsigned nWorlds, unsigned nThreads = 0);
+	BatchSimulator(const BatchSimulator&)  = delete;
+	BatchSimulator(      BatchSimulator&&) = delete;
+	~BatchSimulator();
+
+	BatchSimulator& operator=(const BatchSimulator&)  = delete;
+	BatchSimulator& operator=(      BatchSimulator&&) = delete;
+
+	void initialize();
+	void start(const Path& level, const String& spawn = "spawn");
+	void restart(unsigned index, const Path& level, const String& spawn = "spawn");
+
+	const ObservationVector& step(const InputVector& inputs, unsigned nTicks = 1);
+	const ObservationVector& observations() const { return _observations; }
+
+	unsigned nWorlds() const { return _worlds.size(); }
+	unsigned nThreads() const { return _threads.size() + 1; }
+	World*   world(unsigned index) { return _worlds.at(index).get(); }
+
+protected:
+	void observe(unsigned index);
+	void runJob();
+	void workerMain();
+
+protected:
+	Game*                    _game;
+	std::vector<WorldUP>     _worlds;
+	ObservationVector        _observations;
+
+	const InputVector*       _inputs;
+	unsigned                 _nTicks;
+
+	std::vector<std::thread> _threads;
+	std::mutex               _mutex;
+	std::condition_variable  _jobCond;
+	std::condition_variable  _doneCond;
+	uint64                   _jobId;
+	unsigned                 _nBusy;
+	bool                     _stop;
+	std::atomic<unsigned>    _nextWorld;
+};
+
+
+#endif
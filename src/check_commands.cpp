@@ -0,0 +1,85 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+// Checks how CommandProgram splits sources into branches. Run by ctest.
+
+
+#include <cstdlib>
+#include <vector>
+
+#include <lair/core/lair.h>
+#include <lair/core/log.h>
+
+#include "command_program.h"
+
+
+using namespace lair;
+
+
+static int nop(World*, EntityRef, int, const CommandArg*) {
+	return COMMAND_CONTINUE;
+}
+
+
+typedef std::vector<CommandProgram::Branch> BranchVector;
+
+
+static bool check(const CommandMap& commands, const String& source, const BranchVector& expected) {
+	CommandProgram program;
+	program.compile(source, commands, dbgLogger);
+
+	bool ok = program.nBranches() == expected.size();
+	for(unsigned bi = 0; ok && bi < expected.size(); ++bi) {
+		ok = program.branch(bi).begin == expected[bi].begin
+		  && program.branch(bi).end   == expected[bi].end;
+	}
+
+	if(!ok) {
+		dbgLogger.error("\"", source, "\": ", program.nBranches(), " branches, expected ",
+		                expected.size());
+		for(unsigned bi = 0; bi < program.nBranches(); ++bi)
+			dbgLogger.error("  [", program.branch(bi).begin, ", ", program.branch(bi).end, ")");
+	}
+	return ok;
+}
+
+
+int main(int /*argc*/, char** /*argv*/) {
+	CommandMap commands;
+	commands["kill"] = CommandInfo{ nop, 0 };
+	commands["a"]    = CommandInfo{ nop, 0 };
+	commands["b"]    = CommandInfo{ nop, 0 };
+
+	bool ok = true;
+	ok &= check(commands, "kill",          { { 0, 1 } });
+	ok &= check(commands, "kill;",         { { 0, 1 } });
+	ok &= check(commands, "kill\n",        { { 0, 1 } });
+	ok &= check(commands, "a;b;",          { { 0, 2 } });
+	ok &= check(commands, "a & b;",        { { 0, 1 }, { 1, 2 } });
+	ok &= check(commands, "a & b\n",       { { 0, 1 }, { 1, 2 } });
+	ok &= check(commands, "a; b & kill\n", { { 0, 2 }, { 2, 3 } });
+	ok &= check(commands, "a &",           { { 0, 1 } });
+	ok &= check(commands, ";\n",           { });
+
+	if(ok)
+		dbgLogger.info("check_commands: ok");
+	return ok? EXIT_SUCCESS: EXIT_FAILURE;
+}
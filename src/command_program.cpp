@@ -0,0 +1,114 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <cctype>
+#include <cstdlib>
+
+#include "command_program.h"
+
+
+bool CommandProgram::compile(const String& source, const CommandMap& commands, Logger& log) {
+	_source = source;
+	_instructions.clear();
+	_args.clear();
+	_branches.clear();
+
+	auto endOfStatement = [](char c) { return c == ';' || c == '\n' || c == '&'; };
+
+	bool success = true;
+	unsigned size = source.size();
+	unsigned ci   = 0;
+	unsigned branchBegin = 0;
+	while(ci < size) {
+		unsigned firstArg = _args.size();
+
+		// One statement: tokens up to the next ';', '&' or new line.
+		while(ci < size && !endOfStatement(source[ci])) {
+			if(std::isspace(source[ci])) {
+				++ci;
+				continue;
+			}
+
+			unsigned begin = ci;
+			while(ci < size && !std::isspace(source[ci]) && !endOfStatement(source[ci]))
+				++ci;
+
+			CommandArg arg;
+			arg.string = source.substr(begin, ci - begin);
+			arg.path   = arg.string;
+
+			char* end;
+			arg.number   = std::strtof(arg.string.c_str(), &end);
+			arg.isNumber = !arg.string.empty() && *end == '\0';
+			if(!arg.isNumber)
+				arg.number = 0;
+
+			_args.push_back(std::move(arg));
+		}
+
+		unsigned argc = _args.size() - firstArg;
+		if(argc != 0) {
+			auto cmd = commands.find(_args[firstArg].string);
+			if(cmd == commands.end()) {
+				log.warning("Unknown command \"", _args[firstArg].string, "\" in \"", source, "\"");
+				_args.resize(firstArg);
+				success = false;
+			}
+			else {
+				_instructions.push_back(Instruction{ cmd->second.command, cmd->second.entityArgs,
+				                                     firstArg, argc });
+			}
+		}
+
+		if(ci < size && source[ci] == '&') {
+			if(_instructions.size() != branchBegin)
+				_branches.push_back(Branch{ branchBegin, unsigned(_instructions.size()) });
+			branchBegin = _instructions.size();
+		}
+		++ci;
+	}
+
+	// The last branch, whatever ends the source (possibly ';' or a new line).
+	if(_instructions.size() != branchBegin)
+		_branches.push_back(Branch{ branchBegin, unsigned(_instructions.size()) });
+
+	return success;
+}
+
+
+unsigned CommandProgram::bindEntities(const EntityResolver& resolve, Logger& log) {
+	unsigned nErrors = 0;
+	for(const Instruction& inst: _instructions) {
+		for(unsigned ai = 1; ai < inst.argc; ++ai) {
+			if(!(inst.entityArgs & (1u << ai)))
+				continue;
+
+			CommandArg& arg = _args[inst.firstArg + ai];
+			arg.entity = resolve(arg.string);
+			if(!arg.entity.isValid()) {
+				log.error(_args[inst.firstArg].string, ": entity \"", arg.string,
+				          "\" not found in \"", _source, "\"");
+				nErrors += 1;
+			}
+		}
+	}
+	return nErrors;
+}
@@ -0,0 +1,137 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef LD39_COMMAND_PROGRAM_H_
+#define LD39_COMMAND_PROGRAM_H_
+
+
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <lair/core/lair.h>
+#include <lair/core/log.h>
+#include <lair/core/path.h>
+
+#include <lair/ec/entity.h>
+
+
+using namespace lair;
+
+
+class World;
+
+
+// A command argument, parsed once when its program is compiled.
+struct CommandArg {
+	String    string;
+	Path      path;      // string as a path, for commands taking a file.
+	float     number;    // string as a number, 0 if it is not one.
+	bool      isNumber;
+	EntityRef entity;    // named entity, once the program is bound.
+};
+
+typedef int (*Command)(World* world, EntityRef self, int argc, const CommandArg* argv);
+
+struct CommandInfo {
+	Command  command;
+	unsigned entityArgs;  // Bit i is set if argv[i] names an entity.
+};
+typedef std::unordered_map<std::string, CommandInfo> CommandMap;
+
+typedef std::function<EntityRef(const String&)> EntityResolver;
+
+
+// What a command returns. Negative values are errors, reported by the
+// command itself; the script goes on with the next command.
+enum CommandResult {
+	COMMAND_CONTINUE = 0,
+	// The command suspended the script (see ScriptRunner).
+	COMMAND_YIELD    = 1,
+};
+
+
+// Commands separated by ';' or new lines, with their arguments split on
+// spaces. '&' separates branches, that run in parallel as separate scripts:
+// "wait 60; kill & echo bye". Command names are resolved at compile time,
+// so running a program does not parse, search nor allocate anything.
+class CommandProgram {
+public:
+	struct Instruction {
+		Command  command;
+		unsigned entityArgs;
+		unsigned firstArg;  // argv[0] is the command name.
+		unsigned argc;
+	};
+
+	// Instructions [begin, end) of a branch.
+	struct Branch {
+		unsigned begin;
+		unsigned end;
+	};
+
+public:
+	CommandProgram() = default;
+	CommandProgram(const CommandProgram&)  = delete;
+	CommandProgram(      CommandProgram&&) = default;
+	~CommandProgram() = default;
+
+	CommandProgram& operator=(const CommandProgram&)  = delete;
+	CommandProgram& operator=(      CommandProgram&&) = default;
+
+	// Unknown commands are reported and left out. Returns false if there
+	// were any.
+	bool compile(const String& source, const CommandMap& commands, Logger& log);
+
+	// Looks up the entities named by the arguments of the commands, so
+	// that they do not search for them when they run. Returns the number
+	// of names that could not be resolved.
+	unsigned bindEntities(const EntityResolver& resolve, Logger& log);
+
+	inline bool     empty() const { return _instructions.empty(); }
+	inline unsigned size()  const { return _instructions.size(); }
+	inline const String& source() const { return _source; }
+
+	inline const Instruction& instruction(unsigned index) const { return _instructions[index]; }
+	inline const CommandArg*  args(unsigned index) const {
+		return _args.data() + _instructions[index].firstArg;
+	}
+
+	inline unsigned      nBranches() const { return _branches.size(); }
+	inline const Branch& branch(unsigned index) const { return _branches[index]; }
+
+	inline int exec(World* world, unsigned index, EntityRef self) const {
+		const Instruction& inst = _instructions[index];
+		return inst.command(world, self, inst.argc, _args.data() + inst.firstArg);
+	}
+
+protected:
+	String                   _source;
+	std::vector<Instruction> _instructions;
+	std::vector<CommandArg>  _args;
+	std::vector<Branch>      _branches;
+};
+
+typedef std::shared_ptr<CommandProgram> CommandProgramSP;
+
+
+#endif
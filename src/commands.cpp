@@ -24,146 +24,172 @@
 #include <lair/sys_sdl2/audio_module.h>
 
 #include "game.h"
-#include "main_state.h"
-#include "splash_state.h"
+#include "world.h"
 #include "level.h"
 
 #include "components.h"
 
 
-int echoCommand(MainState* state, EntityRef self, int argc, const char** argv) {
+int echoCommand(World* world, EntityRef self, int argc, const CommandArg* argv) {
 	std::ostringstream out;
-	out << argv[0];
+	out << argv[0].string;
 	for(int i = 1; i < argc; ++i)
-		out << " " << argv[i];
+		out << " " << argv[i].string;
 	dbgLogger.info(out.str());
-	state->execNext();
 
 	return 0;
 }
 
 
-int setSpawnCommand(MainState* state, EntityRef self, int argc, const char** argv) {
+int setSpawnCommand(World* world, EntityRef self, int argc, const CommandArg* argv) {
 	if(argc != 2) {
-		dbgLogger.warning(argv[0], ": wrong number of argument.");
+		dbgLogger.warning(argv[0].string, ": wrong number of argument.");
 		return -2;
 	}
 
-	if(state->getEntity(argv[1]).isValid())
-		state->_spawnName = argv[1];
+	if(argv[1].entity.isValid()) {
+		world->_spawnName = argv[1].string;
+		world->_spawn     = argv[1].entity;
+	}
 	else
-		dbgLogger.warning("Cannot set spawn \"", argv[1], "\": entity not found.");
+		dbgLogger.warning("Cannot set spawn \"", argv[1].string, "\": entity not found.");
 
 	return 0;
 }
 
 
-int killCommand(MainState* state, EntityRef self, int argc, const char** argv) {
+int killCommand(World* world, EntityRef self, int argc, const CommandArg* argv) {
 	if(argc != 1) {
-		dbgLogger.warning(argv[0], ": wrong number of argument.");
+		dbgLogger.warning(argv[0].string, ": wrong number of argument.");
 		return -2;
 	}
 
-	state->killPlayer();
+	world->killPlayer();
 
 	return 0;
 }
 
 
-int nextLevelCommand(MainState* state, EntityRef self, int argc, const char** argv) {
+int nextLevelCommand(World* world, EntityRef self, int argc, const CommandArg* argv) {
 	if(argc != 2 && argc != 3) {
 		dbgLogger.warning("nextLevelCommand: wrong number of argument.");
 		return -2;
 	}
 
 	if(argc == 2)
-		state->changeLevel(argv[1]);
+		world->changeLevel(argv[1].path);
 	else
-		state->changeLevel(argv[1], argv[2]);
+		world->changeLevel(argv[1].path, argv[2].string);
 
 	return 0;
 }
 
 
-//int playSoundCommand(MainState* state, EntityRef self, int argc, const char** argv) {
+//int playSoundCommand(World* world, EntityRef self, int argc, const CommandArg* argv) {
 //	if(argc != 2) {
 //		dbgLogger.warning("playSoundCommand: wrong number of argument.");
 //		return -2;
 //	}
 
-//	state->playSound(argv[1]);
-//	state->execNext();
+//	world->playSound(argv[1]);
 
 //	return 0;
 //}
 
 
-int disableCommand(MainState* state, EntityRef self, int argc, const char** argv) {
+int disableCommand(World* world, EntityRef self, int argc, const CommandArg* argv) {
 	if(argc != 2) {
-		dbgLogger.warning(argv[0], ": wrong number of argument.");
+		dbgLogger.warning(argv[0].string, ": wrong number of argument.");
 		return -2;
 	}
 
-	EntityRef target = state->getEntity(argv[1]);
+	EntityRef target = argv[1].entity;
 	if(!target.isValid()) {
-		dbgLogger.warning(argv[0], ": target not found: ", argv[1]);
+		dbgLogger.warning(argv[0].string, ": target not found: ", argv[1].string);
 		return -2;
 	}
 
 	target.setEnabled(false);
-	state->execNext();
 
 	return 0;
 }
 
 
-int noJumpCommand(MainState* state, EntityRef self, int argc, const char** argv) {
+int noJumpCommand(World* world, EntityRef self, int argc, const CommandArg* argv) {
 	if(argc != 1) {
-		dbgLogger.warning(argv[0], ": wrong number of argument.");
+		dbgLogger.warning(argv[0].string, ": wrong number of argument.");
 		return -2;
 	}
 
-	SpriteComponent* fadeSprite = state->_sprites.get(state->_fadeOverlay);
-	fadeSprite->setTexture("battery4.png");
-	fadeSprite->setColor(Vector4(1, 1, 1, 0));
-	state->setState(STATE_FADE_OUT, STATE_PAUSE);
-	state->playSound("departure.wav");
+	world->setOverlay("battery4.png", Vector4(1, 1, 1, 0));
+	world->setState(STATE_FADE_OUT, STATE_PAUSE);
+	world->playSound("departure.wav");
 
-	state->_playerPhysics->jump = false;
+	world->_playerPhysics->jump = false;
 
 	return 0;
 }
 
 
-int slowCommand(MainState* state, EntityRef self, int argc, const char** argv) {
+int slowCommand(World* world, EntityRef self, int argc, const CommandArg* argv) {
 	if(argc != 2) {
-		dbgLogger.warning(argv[0], ": wrong number of argument.");
+		dbgLogger.warning(argv[0].string, ": wrong number of argument.");
 		return -2;
 	}
 
-	state->_playerPhysics->maxSpeed = state->_playerPhysics->maxSpeed * atof(argv[1]);
+	world->_playerPhysics->maxSpeed = world->_playerPhysics->maxSpeed * argv[1].number;
 
 	return 0;
 }
 
 
 
-int creditsCommand(MainState* state, EntityRef self, int argc, const char** argv) {
+int creditsCommand(World* world, EntityRef self, int argc, const CommandArg* argv) {
 	if(argc != 1) {
-		dbgLogger.warning(argv[0], ": wrong number of argument.");
+		dbgLogger.warning(argv[0].string, ": wrong number of argument.");
 		return -2;
 	}
 
-	state->game()->splashState()->setNextState(nullptr);
-	state->game()->splashState()->addSplash("story_end.png");
-	state->game()->splashState()->addSplash("credits.png");
+	world->playMusic("ending.mp3");
+	world->endGame();
 
-	state->playMusic("ending.mp3");
+	return 0;
+}
 
-//	state->game()->splashState()->setup(nullptr, "credits.png");
-	state->game()->setNextState(state->game()->splashState());
-	state->quit();
-//	state->execNext();
 
-	return 0;
+int waitCommand(World* world, EntityRef self, int argc, const CommandArg* argv) {
+	if(argc != 2 || !argv[1].isNumber) {
+		dbgLogger.warning(argv[0].string, ": expected a number of ticks.");
+		return -2;
+	}
+
+	if(argv[1].number < 1)
+		return COMMAND_CONTINUE;
+
+	world->_scripts.sleep(unsigned(argv[1].number));
+	return COMMAND_YIELD;
+}
+
+
+int waitStateCommand(World* world, EntityRef self, int argc, const CommandArg* argv) {
+	if(argc != 2) {
+		dbgLogger.warning(argv[0].string, ": wrong number of argument.");
+		return -2;
+	}
+
+	static const char* names[] = { "play", "death", "fade_in", "fade_out", "pause" };
+	const String& name = argv[1].string;
+	unsigned state = 0;
+	while(state < sizeof(names) / sizeof(*names) && name != names[state])
+		++state;
+	if(state == sizeof(names) / sizeof(*names)) {
+		dbgLogger.warning(argv[0].string, ": unknown state \"", name, "\".");
+		return -2;
+	}
+
+	if(world->_state == State(state))
+		return COMMAND_CONTINUE;
+
+	world->_scripts.waitState(state);
+	return COMMAND_YIELD;
 }
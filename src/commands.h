@@ -30,20 +30,24 @@
 
 #include <lair/ec/entity.h>
 
+#include "command_program.h"
+
 
 using namespace lair;
 
 
-class MainState;
+class World;
 
 
-int echoCommand(MainState* state, EntityRef self, int argc, const char** argv);
-int setSpawnCommand(MainState* state, EntityRef self, int argc, const char** argv);
-int killCommand(MainState* state, EntityRef self, int argc, const char** argv);
-int nextLevelCommand(MainState* state, EntityRef self, int argc, const char** argv);
-int disableCommand(MainState* state, EntityRef self, int argc, const char** argv);
-int noJumpCommand(MainState* state, EntityRef self, int argc, const char** argv);
-int slowCommand(MainState* state, EntityRef self, int argc, const char** argv);
-int creditsCommand(MainState* state, EntityRef self, int argc, const char** argv);
+int echoCommand(World* world, EntityRef self, int argc, const CommandArg* argv);
+int setSpawnCommand(World* world, EntityRef self, int argc, const CommandArg* argv);
+int killCommand(World* world, EntityRef self, int argc, const CommandArg* argv);
+int nextLevelCommand(World* world, EntityRef self, int argc, const CommandArg* argv);
+int disableCommand(World* world, EntityRef self, int argc, const CommandArg* argv);
+int noJumpCommand(World* world, EntityRef self, int argc, const CommandArg* argv);
+int slowCommand(World* world, EntityRef self, int argc, const CommandArg* argv);
+int creditsCommand(World* world, EntityRef self, int argc, const CommandArg* argv);
+int waitCommand(World* world, EntityRef self, int argc, const CommandArg* argv);
+int waitStateCommand(World* world, EntityRef self, int argc, const CommandArg* argv);
 
 #endif
@@ -24,6 +24,7 @@
 
 
 #include <map>
+#include <vector>
 
 #include <lair/core/lair.h>
 #include <lair/core/path.h>
@@ -33,11 +34,13 @@
 #include <lair/ec/dense_component_manager.h>
 #include <lair/ec/collision_component.h>
 
+#include "command_program.h"
+
 
 using namespace lair;
 
 class Level;
-class MainState;
+class World;
 
 enum DirFlags {
 	DIR_NONE  = 0x00,
@@ -65,11 +68,14 @@ public:
 	static const PropertyList& properties();
 
 public:
-	bool        prevInside;
-	bool        inside;
 	std::string onEnter;
 	std::string onExit;
 	std::string onUse;
+
+	// Compiled by Level::createTrigger().
+	CommandProgramSP enterProgram;
+	CommandProgramSP exitProgram;
+	CommandProgramSP useProgram;
 };
 
 class TriggerComponentManager : public DenseComponentManager<TriggerComponent> {
@@ -139,6 +145,8 @@ public:
 	bool animationDone() const;
 
 	void reset();
+	// Everything but the entity, e.g. to move a character to a new clone.
+	void copyState(const CharacterComponent& other);
 
 	static const PropertyList& properties();
 
@@ -170,19 +178,67 @@ public:
 	const CharAnimation* animation;
 	float    animTime;
 
+	// Sorted indices, in the level TriggerGrid, of the triggers the
+	// character is in.
+	std::vector<unsigned> triggers;
+
 	std::vector<HitEvent> _hits;
 };
 
+// Working set of CharacterComponentManager::updatePhysics(): one row per
+// simulated character, one contiguous array per field, so that the
+// integration runs on packets of characters (4 with SSE, 8 with AVX).
+// The components stay the storage: rows are gathered from them each tick
+// and the results scattered back.
+struct CharacterRows {
+	void resize(unsigned size);
+
+	std::vector<unsigned> component;
+	std::vector<float>    posX;
+	std::vector<float>    posY;
+	std::vector<float>    velX;
+	std::vector<float>    velY;
+	std::vector<float>    prevVelX;
+	std::vector<float>    prevVelY;
+	std::vector<float>    targetSpeed;
+	std::vector<float>    accel;
+	std::vector<float>    gravity;
+	std::vector<float>    maxFall;
+	std::vector<float>    integrate;
+};
+
+// Time spent in each pass of updatePhysics(), in ns, summed over the ticks.
+struct CharacterPassTimes {
+	int64 controls;   // Controls and gather into the rows.
+	int64 stream;     // Collision data around the characters.
+	int64 integrate;
+	int64 scatter;    // Sweep and write back to the entities.
+};
+
 class CharacterComponentManager : public DenseComponentManager<CharacterComponent> {
 public:
-	CharacterComponentManager(MainState* mainState);
+	CharacterComponentManager(World* world);
 	virtual ~CharacterComponentManager() = default;
 
 	void updatePhysics();
 	void processCollisions();
 
+	// Makes updatePhysics() add the time of its passes to times, nullptr to
+	// stop.
+	inline void setPassTimes(CharacterPassTimes* times) { _passTimes = times; }
+
+protected:
+	void updateControls(CharacterComponent& c, unsigned row);
+	void integrate(unsigned nRows);
+	Vector2 sweep(CharacterComponent& c, const Vector2& from, const Vector2& to);
+	void updateEntity(CharacterComponent& c, const Vector2& pos);
+
 public:
-	MainState* _mainState;
+	World*     _world;
+	CharacterRows _rows;
+	// Around the characters, where the level streams collision data.
+	std::vector<Box2> _streamAreas;
+	CharacterPassTimes* _passTimes;
 
 	CharAnimation _idleAnim;
 	CharAnimation _walkAnim;
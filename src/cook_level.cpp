@@ -0,0 +1,72 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+// Cooks a level exported by Tiled (json) into the binary format loaded by
+// the game, see cooked_level.h. Used by the cook_levels target.
+//
+// Usage: cook_level <level.json> <level.ldlv>
+
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+#include "cooked_level.h"
+
+
+int main(int argc, char** argv) {
+	if(argc != 3) {
+		std::cerr << "Usage: " << argv[0] << " <level.json> <level.ldlv>\n";
+		return EXIT_FAILURE;
+	}
+
+	std::ifstream in(argv[1]);
+	Json::Value map;
+	Json::Reader reader;
+	if(!in.good() || !reader.parse(in, map)) {
+		dbgLogger.error(argv[1], ": Failed to read level: ",
+		                reader.getFormattedErrorMessages());
+		return EXIT_FAILURE;
+	}
+
+	// The game cooks the json again if it changes after this.
+	CookedLevelSource source;
+	if(!readLevelSource(argv[1], source)) {
+		dbgLogger.error(argv[1], ": Failed to stat level");
+		return EXIT_FAILURE;
+	}
+
+	std::vector<uint8> buffer;
+	if(!cookTiledMap(map, buffer, dbgLogger, source)) {
+		dbgLogger.error(argv[1], ": Failed to cook level");
+		return EXIT_FAILURE;
+	}
+
+	std::ofstream out(argv[2], std::ios::binary);
+	out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+	if(!out.good()) {
+		dbgLogger.error(argv[2], ": Failed to write cooked level");
+		return EXIT_FAILURE;
+	}
+
+	dbgLogger.info(argv[2], ": ", buffer.size(), " bytes");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,489 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <cstring>
+
+#include <sys/stat.h>
+
+#include "cooked_level.h"
+
+
+CookedProperties::CookedProperties(const CookedProperty* begin, const CookedProperty* end,
+                                   const char* strings)
+	: _begin(begin)
+	, _end(end)
+	, _strings(strings)
+{
+}
+
+
+const char* CookedProperties::getString(const char* name, const char* def) const {
+	const CookedProperty* prop = find(name);
+	if(!prop || prop->type != COOKED_STRING)
+		return def;
+	return _strings + prop->string;
+}
+
+
+float CookedProperties::getFloat(const char* name, float def) const {
+	const CookedProperty* prop = find(name);
+	if(!prop || prop->type == COOKED_STRING)
+		return def;
+	return prop->number;
+}
+
+
+int CookedProperties::getInt(const char* name, int def) const {
+	const CookedProperty* prop = find(name);
+	if(!prop || prop->type == COOKED_STRING)
+		return def;
+	return int(prop->number);
+}
+
+
+bool CookedProperties::getBool(const char* name, bool def) const {
+	const CookedProperty* prop = find(name);
+	if(!prop || prop->type == COOKED_STRING)
+		return def;
+	return prop->number != 0;
+}
+
+
+// Objects have a handful of properties, a linear search is the fastest.
+const CookedProperty* CookedProperties::find(const char* name) const {
+	for(const CookedProperty* prop = _begin; prop != _end; ++prop) {
+		if(std::strcmp(_strings + prop->name, name) == 0)
+			return prop;
+	}
+	return nullptr;
+}
+
+
+CookedLevel::CookedLevel()
+	: _data(nullptr)
+	, _size(0)
+	, _header(nullptr)
+{
+}
+
+
+CookedLevel::CookedLevel(CookedLevel&& other)
+	: CookedLevel()
+{
+	*this = std::move(other);
+}
+
+
+CookedLevel::~CookedLevel() {
+	close();
+}
+
+
+CookedLevel& CookedLevel::operator=(CookedLevel&& other) {
+	if(this != &other) {
+		close();
+		std::swap(_file,    other._file);
+		std::swap(_buffer,  other._buffer);
+		std::swap(_data,    other._data);
+		std::swap(_size,    other._size);
+		std::swap(_header,  other._header);
+	}
+	return *this;
+}
+
+
+bool CookedLevel::open(const Path& path, Logger& log) {
+	close();
+
+	MappedFile file;
+	if(!file.open(path))
+		return false;
+	if(!setData(file.data(), file.size(), log, path))
+		return false;
+	_file = std::move(file);
+	return true;
+}
+
+
+bool CookedLevel::open(const uint8* data, size_t size, Logger& log, const Path& path) {
+	close();
+	return setData(data, size, log, path);
+}
+
+
+bool CookedLevel::open(std::vector<uint8>&& buffer, Logger& log, const Path& path) {
+	close();
+
+	_buffer = std::move(buffer);
+	if(!setData(_buffer.data(), _buffer.size(), log, path)) {
+		_buffer.clear();
+		return false;
+	}
+	return true;
+}
+
+
+bool CookedLevel::cook(const TileMap& tileMap, Logger& log) {
+	close();
+
+	CookedLevelWriter writer;
+	unsigned width  = tileMap.width(0);
+	unsigned height = tileMap.height(0);
+	writer.setSize(width, height);
+
+	std::vector<unsigned> tiles;
+	for(unsigned li = 0; li < tileMap.nLayers(); ++li) {
+		if(tileMap.width(li) != width || tileMap.height(li) != height) {
+			log.error("Cannot cook tile map: layers have different sizes");
+			return false;
+		}
+
+		tiles.clear();
+		for(unsigned y = 0; y < height; ++y) {
+			for(unsigned x = 0; x < width; ++x)
+				tiles.push_back(tileMap.tile(x, y, li));
+		}
+		if(!writer.addLayer(tiles, log))
+			return false;
+	}
+
+	writer.setMapProperties(tileMap.properties());
+	for(unsigned oli = 0; oli < tileMap.nObjectLayer(); ++oli) {
+		for(const Json::Value& obj: tileMap.objectLayer(oli)["objects"])
+			writer.addObject(obj);
+	}
+
+	std::vector<uint8> buffer;
+	writer.write(buffer);
+	return open(std::move(buffer), log, "<memory>");
+}
+
+
+bool CookedLevel::cook(const Json::Value& map, Logger& log) {
+	close();
+
+	std::vector<uint8> buffer;
+	if(!cookTiledMap(map, buffer, log))
+		return false;
+	return open(std::move(buffer), log, "<memory>");
+}
+
+
+bool CookedLevel::isUpToDate(const Path& sourcePath) const {
+	CookedLevelSource source;
+	if(!_header->sourceSize || !readLevelSource(sourcePath, source))
+		return true;
+	return source.size == _header->sourceSize && source.time == _header->sourceTime;
+}
+
+
+void CookedLevel::close() {
+	_file.close();
+	_buffer.clear();
+	_data    = nullptr;
+	_size    = 0;
+	_header  = nullptr;
+}
+
+
+CookedProperties CookedLevel::properties() const {
+	const CookedProperty* props =
+	        reinterpret_cast<const CookedProperty*>(_data + _header->properties);
+	return CookedProperties(props, props + _header->nMapProperties, string(0));
+}
+
+
+CookedProperties CookedLevel::properties(const CookedObject& object) const {
+	const CookedProperty* props =
+	        reinterpret_cast<const CookedProperty*>(_data + _header->properties)
+	        + object.firstProperty;
+	return CookedProperties(props, props + object.nProperties, string(0));
+}
+
+
+bool CookedLevel::setData(const uint8* data, size_t size, Logger& log, const Path& path) {
+	_data   = data;
+	_size   = size;
+	_header = reinterpret_cast<const CookedLevelHeader*>(_data);
+	if(!validate(log, path)) {
+		_data   = nullptr;
+		_size   = 0;
+		_header = nullptr;
+		return false;
+	}
+	return true;
+}
+
+
+// Only checks that every offset stays in the file, so that a truncated or
+// outdated file can not crash the game. The content is trusted.
+bool CookedLevel::validate(Logger& log, const Path& path) const {
+	if(_size < sizeof(CookedLevelHeader) || _header->magic != COOKED_LEVEL_MAGIC) {
+		log.error(path, ": Not a cooked level");
+		return false;
+	}
+	if(_header->version != COOKED_LEVEL_VERSION) {
+		log.warning(path, ": Cooked level version ", _header->version,
+		            ", expected ", unsigned(COOKED_LEVEL_VERSION));
+		return false;
+	}
+
+	auto sectionOk = [this](uint64 offset, uint64 count, uint64 size) {
+		return offset % 4 == 0 && offset + count * size <= _size;
+	};
+	const CookedLevelHeader& h = *_header;
+	bool ok = h.size == _size
+	       && sectionOk(h.layers, uint64(h.nLayers) * h.width * h.height, sizeof(uint16))
+	       && sectionOk(h.objects, h.nObjects, sizeof(CookedObject))
+	       && sectionOk(h.properties, h.nProperties, sizeof(CookedProperty))
+	       && sectionOk(h.strings, h.stringsSize, 1)
+	       && h.nMapProperties <= h.nProperties
+	       && h.stringsSize != 0 && string(h.stringsSize - 1)[0] == '\0';
+
+	for(unsigned oi = 0; ok && oi < h.nObjects; ++oi) {
+		const CookedObject& obj = object(oi);
+		ok = obj.type < h.stringsSize && obj.name < h.stringsSize
+		  && uint64(obj.firstProperty) + obj.nProperties <= h.nProperties;
+	}
+
+	const CookedProperty* props = reinterpret_cast<const CookedProperty*>(_data + h.properties);
+	for(unsigned pi = 0; ok && pi < h.nProperties; ++pi)
+		ok = props[pi].name < h.stringsSize && props[pi].string < h.stringsSize;
+
+	if(!ok)
+		log.error(path, ": Corrupted cooked level");
+	return ok;
+}
+
+
+CookedLevelWriter::CookedLevelWriter()
+	: _width(0)
+	, _height(0)
+	, _nLayers(0)
+	, _source{ 0, 0 }
+{
+	// Offset 0 is the empty string.
+	addString("");
+}
+
+
+void CookedLevelWriter::setSize(unsigned width, unsigned height) {
+	_width  = width;
+	_height = height;
+}
+
+
+void CookedLevelWriter::setSource(const CookedLevelSource& source) {
+	_source = source;
+}
+
+
+bool CookedLevelWriter::addLayer(const std::vector<unsigned>& tiles, Logger& log) {
+	if(tiles.size() != size_t(_width) * _height) {
+		log.error("Cannot cook layer ", _nLayers, ": expected ", _width * _height,
+		          " tiles, got ", tiles.size());
+		return false;
+	}
+
+	for(unsigned tile: tiles) {
+		if(tile > 0xffff) {
+			log.error("Cannot cook layer ", _nLayers, ": tile index ", tile,
+			          " does not fit in 16 bits (flipped tile ?)");
+			return false;
+		}
+		_tiles.push_back(tile);
+	}
+	_nLayers += 1;
+	return true;
+}
+
+
+void CookedLevelWriter::setMapProperties(const Json::Value& properties) {
+	_mapProperties.clear();
+	addProperties(_mapProperties, properties);
+}
+
+
+void CookedLevelWriter::addObject(const Json::Value& object) {
+	CookedObject obj;
+	obj.type          = addString(object.get("type", "").asString());
+	obj.name          = addString(object.get("name", "").asString());
+	obj.x             = object.get("x",      0).asFloat();
+	obj.y             = object.get("y",      0).asFloat();
+	obj.width         = object.get("width",  0).asFloat();
+	obj.height        = object.get("height", 0).asFloat();
+	obj.gid           = object.get("gid",    0).asUInt();
+	obj.firstProperty = _properties.size();
+	addProperties(_properties, object.get("properties", Json::Value()));
+	obj.nProperties   = _properties.size() - obj.firstProperty;
+	_objects.push_back(obj);
+}
+
+
+void CookedLevelWriter::write(std::vector<uint8>& buffer) const {
+	auto align = [](size_t offset) { return (offset + 3) & ~size_t(3); };
+
+	CookedLevelHeader header;
+	header.magic          = COOKED_LEVEL_MAGIC;
+	header.version        = COOKED_LEVEL_VERSION;
+	header.width          = _width;
+	header.height         = _height;
+	header.nLayers        = _nLayers;
+	header.layers         = align(sizeof(CookedLevelHeader));
+	header.nObjects       = _objects.size();
+	header.objects        = align(header.layers + _tiles.size() * sizeof(uint16));
+	header.nMapProperties = _mapProperties.size();
+	header.nProperties    = _mapProperties.size() + _properties.size();
+	header.properties     = align(header.objects + _objects.size() * sizeof(CookedObject));
+	header.stringsSize    = _strings.size();
+	header.sourceSize     = _source.size;
+	header.sourceTime     = _source.time;
+	header.strings        = align(header.properties + header.nProperties * sizeof(CookedProperty));
+	header.size           = align(header.strings + _strings.size());
+
+	buffer.assign(header.size, 0);
+	uint8* data = buffer.data();
+
+	// Object properties follow the map properties.
+	std::vector<CookedObject> objects = _objects;
+	for(CookedObject& obj: objects)
+		obj.firstProperty += header.nMapProperties;
+
+	std::memcpy(data, &header, sizeof(header));
+	std::memcpy(data + header.layers, _tiles.data(), _tiles.size() * sizeof(uint16));
+	std::memcpy(data + header.objects, objects.data(), objects.size() * sizeof(CookedObject));
+	std::memcpy(data + header.properties, _mapProperties.data(),
+	            _mapProperties.size() * sizeof(CookedProperty));
+	std::memcpy(data + header.properties + _mapProperties.size() * sizeof(CookedProperty),
+	            _properties.data(), _properties.size() * sizeof(CookedProperty));
+	std::memcpy(data + header.strings, _strings.data(), _strings.size());
+}
+
+
+uint32 CookedLevelWriter::addString(const std::string& str) {
+	auto it = _stringMap.find(str);
+	if(it != _stringMap.end())
+		return it->second;
+
+	uint32 offset = _strings.size();
+	_strings.insert(_strings.end(), str.begin(), str.end());
+	_strings.push_back('\0');
+	_stringMap.emplace(str, offset);
+	return offset;
+}
+
+
+// Accepts both the old ({ name: value }) and the new ([{ name, type, value }])
+// property formats of Tiled.
+void CookedLevelWriter::addProperties(std::vector<CookedProperty>& props,
+                                      const Json::Value& properties) {
+	if(properties.isArray()) {
+		for(const Json::Value& prop: properties)
+			addProperty(props, prop.get("name", "").asString(), prop["value"]);
+	}
+	else if(properties.isObject()) {
+		for(auto it = properties.begin(); it != properties.end(); ++it)
+			addProperty(props, it.name(), *it);
+	}
+}
+
+
+void CookedLevelWriter::addProperty(std::vector<CookedProperty>& props,
+                                    const std::string& name, const Json::Value& value) {
+	CookedProperty prop;
+	prop.name   = addString(name);
+	prop.string = 0;
+	prop.number = 0;
+	switch(value.type()) {
+	case Json::booleanValue:
+		prop.type   = COOKED_BOOL;
+		prop.number = value.asBool();
+		break;
+	case Json::intValue:
+	case Json::uintValue:
+		prop.type   = COOKED_INT;
+		prop.number = value.asFloat();
+		break;
+	case Json::realValue:
+		prop.type   = COOKED_FLOAT;
+		prop.number = value.asFloat();
+		break;
+	default:
+		prop.type   = COOKED_STRING;
+		prop.string = addString(value.asString());
+		break;
+	}
+	props.push_back(prop);
+}
+
+
+bool cookTiledMap(const Json::Value& map, std::vector<uint8>& buffer, Logger& log,
+                  const CookedLevelSource& source) {
+	CookedLevelWriter writer;
+	writer.setSize(map.get("width", 0).asUInt(), map.get("height", 0).asUInt());
+	writer.setSource(source);
+	writer.setMapProperties(map.get("properties", Json::Value()));
+
+	std::vector<unsigned> tiles;
+	for(const Json::Value& layer: map["layers"]) {
+		std::string type = layer.get("type", "").asString();
+		if(type == "tilelayer") {
+			if(layer.isMember("encoding")) {
+				log.error("Cannot cook layer \"", layer.get("name", "").asString(),
+				          "\": only the plain json layer format is supported");
+				return false;
+			}
+
+			tiles.clear();
+			for(const Json::Value& tile: layer["data"])
+				tiles.push_back(tile.asUInt());
+			if(!writer.addLayer(tiles, log))
+				return false;
+		}
+		else if(type == "objectgroup") {
+			for(const Json::Value& obj: layer["objects"])
+				writer.addObject(obj);
+		}
+	}
+
+	writer.write(buffer);
+	return true;
+}
+
+
+bool readLevelSource(const Path& path, CookedLevelSource& source) {
+	struct stat info;
+	if(stat(path.utf8CStr(), &info) != 0)
+		return false;
+	source.size = info.st_size;
+	source.time = info.st_mtime;
+	return true;
+}
+
+
+Path cookedLevelPath(const Path& levelPath) {
+	std::string path = levelPath.utf8String();
+	size_t dot   = path.rfind('.');
+	size_t slash = path.rfind('/');
+	if(dot != std::string::npos && (slash == std::string::npos || dot > slash))
+		path.erase(dot);
+	return Path(path + ".ldlv");
+}
@@ -0,0 +1,251 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef LD39_COOKED_LEVEL_H_
+#define LD39_COOKED_LEVEL_H_
+
+
+#include <unordered_map>
+#include <vector>
+
+#include <lair/core/lair.h>
+#include <lair/core/log.h>
+#include <lair/core/path.h>
+#include <lair/core/json.h>
+
+#include <lair/utils/tile_map.h>
+
+#include "mapped_file.h"
+
+using namespace lair;
+
+
+// Binary level format, produced by cook_level (see the cook_levels target)
+// from the json maps exported by Tiled. Integers are little-endian and every
+// section is 4-byte aligned, so a mapped file is used in place: nothing is
+// parsed at load time.
+//
+// Layout: header, tile layers (nLayers * width * height uint16, row-major,
+// y = 0 is the top row), objects, properties (map properties first, then
+// the properties of each object), string table (NUL-terminated strings,
+// referenced by byte offset).
+enum {
+	COOKED_LEVEL_MAGIC   = 0x564c444c, // "LDLV"
+	COOKED_LEVEL_VERSION = 2,
+};
+
+enum CookedPropertyType {
+	COOKED_STRING,
+	COOKED_BOOL,
+	COOKED_INT,
+	COOKED_FLOAT,
+};
+
+struct CookedLevelHeader {
+	uint32 magic;
+	uint32 version;
+	uint32 size;            // Whole file, in bytes.
+	uint32 width;
+	uint32 height;
+	uint32 nLayers;
+	uint32 layers;          // Section offsets, in bytes.
+	uint32 nObjects;
+	uint32 objects;
+	uint32 nMapProperties;
+	uint32 nProperties;
+	uint32 properties;
+	uint32 stringsSize;
+	uint32 strings;
+	uint64 sourceSize;      // Of the json the level was cooked from, 0 if
+	int64  sourceTime;      // cooked in memory. Modification time, in s.
+};
+
+// Identifies the version of the json a level is cooked from.
+struct CookedLevelSource {
+	uint64 size;
+	int64  time;
+};
+
+struct CookedObject {
+	uint32 type;            // String offset.
+	uint32 name;            // String offset.
+	float  x;               // Tiled coordinates (y down), in pixels.
+	float  y;
+	float  width;
+	float  height;
+	uint32 gid;             // 0 if the object is not a tile.
+	uint32 firstProperty;
+	uint32 nProperties;
+};
+
+struct CookedProperty {
+	uint32 name;            // String offset.
+	uint32 type;            // CookedPropertyType.
+	uint32 string;          // String offset, COOKED_STRING only.
+	float  number;          // Value of the other types.
+};
+
+
+// Typed lookup in a property list, with the same defaults semantic as
+// Json::Value::get(). A property of the wrong type counts as missing.
+class CookedProperties {
+public:
+	CookedProperties(const CookedProperty* begin, const CookedProperty* end,
+	                 const char* strings);
+
+	const char* getString(const char* name, const char* def) const;
+	float       getFloat (const char* name, float def) const;
+	int         getInt   (const char* name, int def) const;
+	bool        getBool  (const char* name, bool def) const;
+
+protected:
+	const CookedProperty* find(const char* name) const;
+
+protected:
+	const CookedProperty* _begin;
+	const CookedProperty* _end;
+	const char*           _strings;
+};
+
+
+// A cooked level, either mapped from a file or cooked in memory from a
+// TileMap when there is no (valid) cooked file, or from the json of a
+// level edited while the game runs.
+class CookedLevel {
+public:
+	CookedLevel();
+	CookedLevel(const CookedLevel&)  = delete;
+	CookedLevel(      CookedLevel&& other);
+	~CookedLevel();
+
+	CookedLevel& operator=(const CookedLevel&)  = delete;
+	CookedLevel& operator=(      CookedLevel&& other);
+
+	bool open(const Path& path, Logger& log);
+	// Uses data in place (e.g. an AssetPack entry), it must outlive the
+	// level.
+	bool open(const uint8* data, size_t size, Logger& log, const Path& path);
+	bool open(std::vector<uint8>&& buffer, Logger& log, const Path& path);
+	bool cook(const TileMap& tileMap, Logger& log);
+	bool cook(const Json::Value& map, Logger& log);
+	void close();
+
+	inline bool isValid() const { return _header; }
+
+	// False if the json at sourcePath changed since the level was cooked.
+	// True if it does not exist (only the cooked level is shipped) or if
+	// the level was cooked in memory.
+	bool isUpToDate(const Path& sourcePath) const;
+
+	inline unsigned width()   const { return _header->width; }
+	inline unsigned height()  const { return _header->height; }
+	inline unsigned nLayers() const { return _header->nLayers; }
+
+	inline const uint16* layer(unsigned layer) const {
+		return reinterpret_cast<const uint16*>(_data + _header->layers)
+		        + size_t(layer) * _header->width * _header->height;
+	}
+
+	inline unsigned tile(unsigned x, unsigned y, unsigned l) const {
+		return layer(l)[size_t(y) * _header->width + x];
+	}
+
+	inline unsigned nObjects() const { return _header->nObjects; }
+	inline const CookedObject& object(unsigned index) const {
+		return reinterpret_cast<const CookedObject*>(_data + _header->objects)[index];
+	}
+
+	// Map properties first, then the properties of each object.
+	inline const CookedProperty& property(unsigned index) const {
+		return reinterpret_cast<const CookedProperty*>(_data + _header->properties)[index];
+	}
+
+	inline const char* string(uint32 offset) const {
+		return reinterpret_cast<const char*>(_data + _header->strings) + offset;
+	}
+
+	CookedProperties properties() const;
+	CookedProperties properties(const CookedObject& object) const;
+
+	size_t byteSize() const { return _size; }
+
+protected:
+	bool setData(const uint8* data, size_t size, Logger& log, const Path& path);
+	bool validate(Logger& log, const Path& path) const;
+
+protected:
+	MappedFile          _file;
+	std::vector<uint8>  _buffer;
+
+	const uint8*        _data;
+	size_t              _size;
+	const CookedLevelHeader* _header;
+};
+
+
+// Builds a cooked level. setSize() must be called first, layers are added
+// in order.
+class CookedLevelWriter {
+public:
+	CookedLevelWriter();
+
+	void setSize(unsigned width, unsigned height);
+	void setSource(const CookedLevelSource& source);
+	bool addLayer(const std::vector<unsigned>& tiles, Logger& log);
+	void setMapProperties(const Json::Value& properties);
+	void addObject(const Json::Value& object);
+
+	void write(std::vector<uint8>& buffer) const;
+
+protected:
+	uint32 addString(const std::string& str);
+	void addProperties(std::vector<CookedProperty>& props, const Json::Value& properties);
+	void addProperty(std::vector<CookedProperty>& props, const std::string& name,
+	                 const Json::Value& value);
+
+protected:
+	unsigned                    _width;
+	unsigned                    _height;
+	unsigned                    _nLayers;
+	CookedLevelSource           _source;
+	std::vector<uint16>         _tiles;
+	std::vector<CookedObject>   _objects;
+	std::vector<CookedProperty> _mapProperties;
+	std::vector<CookedProperty> _properties;
+	std::vector<char>           _strings;
+	std::unordered_map<std::string, uint32> _stringMap;
+};
+
+
+// Cooks a Tiled json map (as exported, not a lair TileMap), read from the
+// file source describes, if any.
+bool cookTiledMap(const Json::Value& map, std::vector<uint8>& buffer, Logger& log,
+                  const CookedLevelSource& source = CookedLevelSource{ 0, 0 });
+
+// False if the file does not exist.
+bool readLevelSource(const Path& path, CookedLevelSource& source);
+
+// Where the cooked version of a level is expected: same path, .ldlv
+// extension.
+Path cookedLevelPath(const Path& levelPath);
+
+
+#endif
@@ -0,0 +1,107 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+#include <algorithm>
+
+#include "file_watcher.h"
+
+
+FileWatcher::FileWatcher()
+	: _fd(-1)
+	, _watch(-1)
+{
+}
+
+
+FileWatcher::~FileWatcher() {
+	close();
+}
+
+
+bool FileWatcher::watch(const Path& dir, Logger& log) {
+	close();
+
+#ifdef __linux__
+	_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(_fd < 0) {
+		log.error("Failed to watch \"", dir, "\": inotify_init1 failed");
+		return false;
+	}
+
+	// Editors either write the file in place or write a copy and rename it.
+	_watch = inotify_add_watch(_fd, dir.native().c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+	if(_watch < 0) {
+		log.error("Failed to watch \"", dir, "\": inotify_add_watch failed");
+		close();
+		return false;
+	}
+
+	_buffer.resize(64 * 1024);
+	log.info("Watching \"", dir, "\" for changes");
+	return true;
+#else
+	log.warning("Failed to watch \"", dir, "\": not supported on this platform");
+	return false;
+#endif
+}
+
+
+void FileWatcher::close() {
+#ifdef __linux__
+	if(_fd >= 0)
+		::close(_fd);
+#endif
+	_fd    = -1;
+	_watch = -1;
+}
+
+
+void FileWatcher::poll(std::vector<Path>& changed) {
+#ifdef __linux__
+	if(_fd < 0)
+		return;
+
+	while(true) {
+		ssize_t size = read(_fd, _buffer.data(), _buffer.size());
+		if(size <= 0)
+			break;
+
+		for(ssize_t offset = 0; offset < size; ) {
+			const inotify_event* event =
+			        reinterpret_cast<const inotify_event*>(_buffer.data() + offset);
+			offset += sizeof(inotify_event) + event->len;
+
+			if(event->wd != _watch || !event->len || (event->mask & IN_ISDIR))
+				continue;
+
+			Path path(event->name);
+			if(std::find(changed.begin(), changed.end(), path) == changed.end())
+				changed.push_back(path);
+		}
+	}
+#endif
+}
@@ -0,0 +1,64 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef LD39_FILE_WATCHER_H_
+#define LD39_FILE_WATCHER_H_
+
+
+#include <vector>
+
+#include <lair/core/lair.h>
+#include <lair/core/log.h>
+#include <lair/core/path.h>
+
+
+using namespace lair;
+
+
+// Tells which files of a directory have been written since the last poll.
+// Uses inotify, so it only works on Linux; elsewhere watch() fails.
+class FileWatcher {
+public:
+	FileWatcher();
+	FileWatcher(const FileWatcher&)  = delete;
+	FileWatcher(      FileWatcher&&) = delete;
+	~FileWatcher();
+
+	FileWatcher& operator=(const FileWatcher&)  = delete;
+	FileWatcher& operator=(      FileWatcher&&) = delete;
+
+	bool watch(const Path& dir, Logger& log);
+	void close();
+
+	inline bool isWatching() const { return _fd >= 0; }
+
+	// Does not block. Appends the names (relative to the directory) of the
+	// files changed since the last call, without duplicates.
+	void poll(std::vector<Path>& changed);
+
+protected:
+	int  _fd;
+	int  _watch;
+	std::vector<char> _buffer;
+};
+
+
+#endif
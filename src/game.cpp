@@ -19,10 +19,25 @@
  */
 
 
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <limits>
+#include <string>
+#include <thread>
+
+#include <SDL_stdinc.h>
+
 #include "lair/core/property.h"
 
+#include "level.h"
 #include "main_state.h"
+#include "packed_loaders.h"
 #include "splash_state.h"
+#include "batch_simulator.h"
+#include "texture_residency.h"
+#include "tile_index_renderer.h"
+#include "tile_layer_chunks.h"
 
 #include "game.h"
 
@@ -51,14 +66,76 @@ Game::Game(int argc, char** argv)
       _mainState(),
       _splashState(),
       _levelPath("lvl1.json"),
-      _spawnName("spawn") {
+      _spawnName("spawn"),
+      _headless(false),
+      _headlessTicks(60 * 60),
+      _batchSize(0),
+      _batchThreads(0),
+      _benchCharacters(0),
+      _benchTileFrames(0),
+      _checkRestart(false),
+      _textureBudget(128),
+      _hotReload(false),
+      _gpuTiles(false),
+      _simThread(false) {
 	serializer().registerType<Shape2D>();
 	serializer().registerType<Shape2DVector>();
 
-	if(argc > 1)
-		_levelPath = argv[1];
-	if(argc > 2)
-		_spawnName = argv[2];
+	// Usage: ld39 [--headless [--batch N [--threads N] | --bench-characters N | --check-restart]] [--ticks N]
+	//            [--level PATH] [--spawn NAME] [--record FILE | --replay FILE]
+	//            [--texture-budget MIB] [--hot-reload] [--startup-profile NAME]
+	//            [--gpu-tiles | --bench-tiles FRAMES] [--sim-thread] [PATH [NAME]]
+	int  positional = 0;
+	bool hasTicks   = false;
+	for(int ai = 1; ai < argc; ++ai) {
+		String arg = argv[ai];
+		if(arg == "--headless")
+			_headless = true;
+		else if(arg == "--ticks" && ai + 1 < argc) {
+			_headlessTicks = std::strtoul(argv[++ai], nullptr, 10);
+			hasTicks = true;
+		}
+		else if(arg == "--level" && ai + 1 < argc)
+			_levelPath = argv[++ai];
+		else if(arg == "--spawn" && ai + 1 < argc)
+			_spawnName = argv[++ai];
+		else if(arg == "--batch" && ai + 1 < argc)
+			_batchSize = std::strtoul(argv[++ai], nullptr, 10);
+		else if(arg == "--threads" && ai + 1 < argc)
+			_batchThreads = std::strtoul(argv[++ai], nullptr, 10);
+		else if(arg == "--bench-characters" && ai + 1 < argc)
+			_benchCharacters = std::strtoul(argv[++ai], nullptr, 10);
+		else if(arg == "--check-restart")
+			_checkRestart = true;
+		else if(arg == "--record" && ai + 1 < argc)
+			_recordPath = argv[++ai];
+		else if(arg == "--replay" && ai + 1 < argc)
+			_replayPath = argv[++ai];
+		else if(arg == "--texture-budget" && ai + 1 < argc)
+			_textureBudget = std::strtoul(argv[++ai], nullptr, 10);
+		else if(arg == "--hot-reload")
+			_hotReload = true;
+		else if(arg == "--startup-profile" && ai + 1 < argc)
+			_profilePath = argv[++ai];
+		else if(arg == "--gpu-tiles")
+			_gpuTiles = true;
+		else if(arg == "--sim-thread")
+			_simThread = true;
+		else if(arg == "--bench-tiles" && ai + 1 < argc)
+			_benchTileFrames = std::strtoul(argv[++ai], nullptr, 10);
+		else if(positional == 0) {
+			_levelPath = arg;
+			positional += 1;
+		}
+		else if(positional == 1) {
+			_spawnName = arg;
+			positional += 1;
+		}
+	}
+
+	// A replay runs until its last recorded tick unless told otherwise.
+	if(!_replayPath.empty() && !hasTicks)
+		_headlessTicks = std::numeric_limits<unsigned>::max();
 }
 
 
@@ -67,39 +144,424 @@ Game::~Game() {
 
 
 void Game::initialize() {
-	GameBase::initialize(_config);
+	StartupProfile::Scope scope(_profile, "Game::initialize");
+
+	if(_headless) {
+		StartupProfile::Scope scope(_profile, "Game::initializeHeadless");
+		initializeHeadless();
+	}
+	else {
+		StartupProfile::Scope scope(_profile, "GameBase::initialize");
+		GameBase::initialize(_config);
+	}
 
 #ifdef LAIR_DATA_DIR
 	_dataPath = LAIR_DATA_DIR;
 	_loader->setBasePath(_dataPath);
 #endif
 
-	window()->setUtf8Title("Lair - template");
+	// A shipped game has them next to the loose files.
+#ifdef LD39_GENERATED_DIR
+	_generatedPath = LD39_GENERATED_DIR;
+#else
+	_generatedPath = _dataPath;
+#endif
 
-	_splashState.reset(new SplashState(this));
-	_mainState.reset(new MainState(this));
+	// Hot reload watches the loose files, so the pack and the atlases are
+	// left aside.
+	if(!_hotReload) {
+		StartupProfile::Scope scope(_profile, "AssetPack::open");
+		if(_assetPack.open(_generatedPath / "assets.ldpk", dbgLogger))
+			scope.addBytes(StartupProfile::fileSize(_generatedPath / "assets.ldpk"));
+	}
+	setLoaderAssetPack(&_assetPack);
+	setLoaderProfile(&_profile, _dataPath);
+	if(!_hotReload) {
+		_atlas.load(_generatedPath, "sprites_atlas.json", dbgLogger);
+	}
+
+	_textures.reset(new TextureResidency(assets(), loader(), dbgLogger,
+	                                     size_t(_textureBudget) << 20));
+
+	if(!_headless) {
+		window()->setUtf8Title("Lair - template");
+
+		_splashState.reset(new SplashState(this));
+		_splashState->initialize();
+//		_splashState->setup(_mainState.get(), "lair.png", 3);
+		_splashState->addSplash("title.png");
+		_splashState->addSplash("story_begin.png");
+	}
 
-	_splashState->initialize();
-//	_splashState->setup(_mainState.get(), "lair.png", 3);
-	_splashState->setNextState(_mainState.get());
-	_splashState->addSplash("title.png");
-	_splashState->addSplash("story_begin.png");
+	_mainState.reset(new MainState(this));
+	if(_splashState)
+		_splashState->setNextState(_mainState.get());
 
 	_mainState->initialize();
 	_mainState->setNextLevel(_levelPath, _spawnName);
 
+	if(_gpuTiles && !_headless)
+		_mainState->useGpuTiles();
+
+	if(_simThread && !_headless)
+		_mainState->useSimThread();
+
+	if(!_replayPath.empty())
+		_mainState->playReplay(_replayPath);
+	else if(!_recordPath.empty())
+		_mainState->recordReplay(_recordPath);
+
+	if(_hotReload)
+		_mainState->watchAssets();
 }
 
 
 void Game::shutdown() {
+	// The game may quit before any state starts.
+	_profile.finish();
+	if(!_profilePath.empty()) {
+		_profile.logSummary(dbgLogger);
+		_profile.writeReport(_profilePath.utf8String() + ".json", dbgLogger);
+		_profile.writeChromeTrace(_profilePath.utf8String() + ".trace.json", dbgLogger);
+	}
+
 	_mainState->shutdown();
-	_splashState->shutdown();
+	if(_splashState)
+		_splashState->shutdown();
 
 	// Required to ensure everything is freed
 	_splashState.reset();
 	_mainState.reset();
 
-	GameBase::shutdown();
+	// GameBase::shutdown() would also close the window, the renderer and
+	// the audio, which headless runs do not create.
+	if(_headless)
+		_sys->shutdown();
+	else
+		GameBase::shutdown();
+}
+
+
+// The modules of GameBase::initialize() that do not need a window, a GL
+// context nor an audio device: batch machines may have neither display
+// nor sound card. States and worlds get a null renderer and do not draw;
+// sounds are not loaded. GameBase has no way to skip the others, so this
+// creates the same modules; the data path is set by initialize().
+void Game::initializeHeadless() {
+	// SDL is still initialized by the system module.
+	SDL_setenv("SDL_VIDEODRIVER", "offscreen", 0);
+	SDL_setenv("SDL_AUDIODRIVER", "dummy",     0);
+
+	_sys.reset(new SysModule(&_mlogger, LogLevel::Log));
+	_sys->initialize();
+	_sys->onQuit = std::bind(&GameBase::quit, this);
+	_dataPath = _sys->basePath() / "assets";
+
+	// Headless runs load nothing but assets: decode on every core.
+	unsigned nThreads = std::max(std::thread::hardware_concurrency(), 1u);
+	_assets.reset(new AssetManager);
+	_loader.reset(new LoaderManager(_assets.get(), nThreads, dbgLogger));
+	_loader->setBasePath(_dataPath);
+}
+
+
+bool Game::runHeadless() {
+	if(_benchCharacters)
+		return runCharacterBenchmark();
+	if(_checkRestart)
+		return runRestartCheck();
+	if(_batchSize)
+		return runBatch();
+
+	// playReplay() already complained.
+	if(!_replayPath.empty() && !_mainState->_replaying)
+		return false;
+
+	return _mainState->runHeadless(_headlessTicks);
+}
+
+
+// Runs _batchSize copies of the start level (or of the replay) side by side.
+bool Game::runBatch() {
+	BatchSimulator batch(this, _batchSize, _batchThreads);
+	batch.initialize();
+
+	Replay replay;
+	bool   replaying = !_replayPath.empty();
+	if(replaying && !replay.load(_replayPath, dbgLogger))
+		return false;
+
+	if(replaying)
+		batch.start(replay.level(), replay.spawn());
+	else
+		batch.start(_levelPath, _spawnName);
+	_profile.finish();
+
+	dbgLogger.log("Starting batch: ", batch.nWorlds(), " worlds on ",
+	              batch.nThreads(), " threads...");
+
+	InputVector inputs(batch.nWorlds(), INPUT_NONE);
+	int64 startTime = int64(sys()->getTimeNs());
+	unsigned tick = 0;
+	while(tick < _headlessTicks && !(replaying && replay.atEnd())) {
+		if(replaying)
+			std::fill(inputs.begin(), inputs.end(), replay.play());
+		batch.step(inputs);
+		++tick;
+	}
+	int64 duration = std::max(int64(sys()->getTimeNs()) - startTime, int64(1));
+
+	dbgLogger.info("Batch: ", batch.nWorlds(), " x ", tick, " ticks in ",
+	               duration / 1000000, " ms (", float(batch.nWorlds()) * tick * 1.e9f / duration,
+	               " world ticks/s)");
+
+	bool success = true;
+	if(replaying && replay.hasEndPosition()) {
+		for(unsigned wi = 0; wi < batch.nWorlds(); ++wi) {
+			const Observation& obs = batch.observations()[wi];
+			if(obs.position != replay.endPosition()) {
+				dbgLogger.error("World ", wi, " diverged: player ends at ", obs.position.transpose(),
+				                ", expected ", replay.endPosition().transpose(), ".");
+				success = false;
+			}
+		}
+	}
+
+	return success;
+}
+
+
+static bool sameObservation(const Observation& obs0, const Observation& obs1) {
+	return obs0.tick       == obs1.tick
+	    && obs0.state      == obs1.state
+	    && obs0.level      == obs1.level
+	    && obs0.position   == obs1.position
+	    && obs0.velocity   == obs1.velocity
+	    && obs0.touchDir   == obs1.touchDir
+	    && obs0.deathCount == obs1.deathCount
+	    && obs0.gameOver   == obs1.gameOver;
+}
+
+
+// Restarts a world after the player died and commands changed its physics,
+// then checks that it runs exactly like a world that did neither. Run by
+// ctest.
+bool Game::runRestartCheck() {
+	BatchSimulator batch(this, 2, 1);
+	batch.initialize();
+	batch.start(_levelPath, _spawnName);
+	_profile.finish();
+
+	World* used = batch.world(0);
+	used->exec("slow 0.5");
+	used->exec("no_jump");
+	used->exec("kill");
+	InputVector inputs(batch.nWorlds(), INPUT_RIGHT);
+	batch.step(inputs, 60);
+
+	batch.restart(0, _levelPath, _spawnName);
+	batch.restart(1, _levelPath, _spawnName);
+
+	const CharPhysicsParams& p0 = *used->_playerPhysics;
+	const CharPhysicsParams& p1 = *batch.world(1)->_playerPhysics;
+	if(p0.jump != p1.jump || p0.maxSpeed != p1.maxSpeed) {
+		dbgLogger.error("Restart check: the physics of the previous run carried over");
+		return false;
+	}
+
+	const unsigned pattern[] = {
+	    INPUT_RIGHT, INPUT_RIGHT | INPUT_JUMP, INPUT_LEFT | INPUT_DASH, INPUT_NONE,
+	};
+	for(unsigned tick = 0; tick < 600; ++tick) {
+		std::fill(inputs.begin(), inputs.end(), pattern[tick / 30 % 4]);
+		const ObservationVector& obs = batch.step(inputs);
+		if(!sameObservation(obs[0], obs[1])) {
+			dbgLogger.error("Restart check: the restarted world diverged at tick ", obs[1].tick,
+			                ": player at ", obs[0].position.transpose(), ", ", obs[0].deathCount,
+			                " deaths, expected ", obs[1].position.transpose(), ", ",
+			                obs[1].deathCount, " deaths");
+			return false;
+		}
+	}
+
+	dbgLogger.info("Restart check: the restarted world runs like a fresh one");
+	return true;
+}
+
+
+// Fills the start level with _benchCharacters copies of the player, driven by
+// pseudo-random inputs, and times the character update alone.
+bool Game::runCharacterBenchmark() {
+	World world(this, dbgLogger);
+	LoadGraph graph(loader(), assets(), dbgLogger);
+	world.initialize(graph);
+	graph.wait();
+	loader()->waitAll();
+
+	world.setNextLevel(_levelPath, _spawnName);
+	world.start();
+	_profile.finish();
+
+	Vector2 origin = world._player.position2();
+	std::vector<EntityRef> bots;
+	bots.reserve(_benchCharacters);
+	for(unsigned bi = 0; bi < _benchCharacters; ++bi) {
+		EntityRef bot = world._entities.cloneEntity(world._playerModel, world._scene, "bot");
+		bot.moveTo(Vector2(origin + Vector2(bi % 256, 0)));
+		CharacterComponent* bChar = world._characters.addComponent(bot);
+		bChar->physics = world._playerPhysics;
+		bots.push_back(bot);
+	}
+
+	unsigned nTicks = _headlessTicks;
+	dbgLogger.log("Benchmarking ", bots.size(), " characters for ", nTicks, " ticks...");
+
+	CharacterPassTimes passTimes = { 0, 0, 0, 0 };
+	world._characters.setPassTimes(&passTimes);
+
+	uint32 seed = 1;
+	int64 physicsTime   = 0;
+	int64 collisionTime = 0;
+	for(unsigned tick = 0; tick < nTicks; ++tick) {
+		for(EntityRef bot: bots) {
+			seed = seed * 1664525u + 1013904223u;
+			CharacterComponent* bChar = world._characters.get(bot);
+			bChar->pressMove((seed >> 24) & (DIR_LEFT | DIR_RIGHT));
+			bChar->pressJump((seed >> 16) & 0x01);
+			bChar->pressDash((seed >> 8 & 0xff) == 0);
+		}
+
+		int64 t0 = int64(sys()->getTimeNs());
+		world._characters.updatePhysics();
+		int64 t1 = int64(sys()->getTimeNs());
+		world._entities.updateWorldTransforms();
+		int64 t2 = int64(sys()->getTimeNs());
+		world._characters.processCollisions();
+		int64 t3 = int64(sys()->getTimeNs());
+
+		physicsTime   += t1 - t0;
+		collisionTime += t3 - t2;
+	}
+
+	world._characters.setPassTimes(nullptr);
+
+	float nUpdates = float(bots.size() + 1) * nTicks;
+	auto logPass = [nUpdates](const char* name, int64 time) {
+		dbgLogger.info(name, time / 1000000, " ms (",
+		               nUpdates * 1.e6f / std::max(time, int64(1)), " characters/ms)");
+	};
+	logPass("Physics:    ", physicsTime);
+	logPass("  controls:  ", passTimes.controls);
+	logPass("  stream:    ", passTimes.stream);
+	logPass("  integrate: ", passTimes.integrate);
+	logPass("  scatter:   ", passTimes.scatter);
+	logPass("Collisions: ", collisionTime);
+
+	return true;
+}
+
+
+// Draws the tile layer of the start level, then the same layer repeated
+// over 4000x1000 tiles, with TileLayerChunks and TileIndexRenderer while
+// the view scrolls across the map. Needs a window: the time spent waiting
+// for the GPU (glFinish) is reported with the CPU time.
+bool Game::runTileBenchmark() {
+	RenderPass     pass(renderer());
+	SpriteRenderer spriteRenderer(renderer());
+
+	World world(this, dbgLogger, nullptr, &pass, &spriteRenderer);
+	LoadGraph graph(loader(), assets(), dbgLogger);
+	world.initialize(graph);
+	graph.wait();
+	loader()->waitAll();
+
+	world.setNextLevel(_levelPath, _spawnName);
+	world.start();
+	_profile.finish();
+
+	Level* level = world._level.get();
+	const CookedLevel& data = level->data();
+	if(!level->baseLayer().isValid()) {
+		dbgLogger.error("Tile benchmark: \"", _levelPath, "\" has no tile layer");
+		return false;
+	}
+	const uint16* levelTiles = data.layer(data.nLayers() - 1);
+	Vector3 offset = level->baseLayer().worldTransform().translation();
+
+	TileLayerChunks   chunks(&pass, &spriteRenderer);
+	TileIndexRenderer gpu(renderer(), dbgLogger);
+	chunks.setLayer(&world._sprites, level->baseLayer(), levelTiles, data.width(), data.height());
+	loader()->waitAll();
+	renderer()->uploadPendingTextures();
+	if(!chunks.isReady() || !gpu.initialize()) {
+		dbgLogger.error("Tile benchmark: failed to set up the renderers");
+		return false;
+	}
+	gpu.setTileSet(level->tileSet());
+
+	std::vector<uint16> bigTiles(4000 * 1000);
+	for(unsigned y = 0; y < 1000; ++y) {
+		for(unsigned x = 0; x < 4000; ++x)
+			bigTiles[y * 4000 + x] = levelTiles[(y % data.height()) * data.width() + x % data.width()];
+	}
+
+	struct Map { const uint16* tiles; unsigned width; unsigned height; };
+	Map maps[] = {
+	    { levelTiles,      data.width(), data.height() },
+	    { bigTiles.data(), 4000,         1000          },
+	};
+
+	Context* glc = renderer()->context();
+	unsigned nFrames = std::max(_benchTileFrames, 1u);
+	Vector2 h(960, 540);
+	for(const Map& map: maps) {
+		chunks.setLayer(&world._sprites, level->baseLayer(), map.tiles, map.width, map.height);
+		if(!gpu.setTiles(map.tiles, map.width, map.height, offset))
+			dbgLogger.warning("Tile benchmark: ", map.width, "x", map.height, " too large for the GPU path");
+
+		Vector2 first = offset.head<2>() + h;
+		Vector2 last  = offset.head<2>() + Vector2(map.width * TILE_SIZE, map.height * TILE_SIZE) - h;
+		for(bool useGpu: { false, true }) {
+			if(useGpu && !gpu.isReady())
+				continue;
+
+			int64 cpuTime   = 0;
+			int64 totalTime = 0;
+			uint64 nTiles   = 0;
+			for(unsigned frame = 0; frame < nFrames; ++frame) {
+				Vector2 c = first + (last - first) * (float(frame) / nFrames);
+				OrthographicCamera camera;
+				camera.setViewBox(Box3(Vector3(c(0) - h(0), c(1) - h(1), 0),
+				                       Vector3(c(0) + h(0), c(1) + h(1), 1)));
+
+				int64 t0 = int64(sys()->getTimeNs());
+				glc->clear(gl::COLOR_BUFFER_BIT | gl::DEPTH_BUFFER_BIT);
+				if(useGpu)
+					gpu.render(camera);
+				else {
+					pass.clear();
+					spriteRenderer.clear();
+					chunks.render(camera);
+					pass.render();
+					nTiles += chunks.nDrawnTiles();
+				}
+				int64 t1 = int64(sys()->getTimeNs());
+				glc->finish();
+				int64 t2 = int64(sys()->getTimeNs());
+
+				cpuTime   += t1 - t0;
+				totalTime += t2 - t0;
+			}
+
+			dbgLogger.info("Tiles ", map.width, "x", map.height, ", ", useGpu? "gpu:    ": "chunks: ",
+			               cpuTime / 1000 / nFrames, " us CPU, ", totalTime / 1000 / nFrames,
+			               " us total per frame",
+			               useGpu? String(): ", " + std::to_string(nTiles / nFrames) + " tiles drawn");
+		}
+	}
+
+	gpu.shutdown();
+	return true;
 }
 
 
@@ -108,6 +570,16 @@ GameConfig& Game::config() {
 }
 
 
+bool Game::isHeadless() const {
+	return _headless;
+}
+
+
+bool Game::isTileBenchmark() const {
+	return _benchTileFrames;
+}
+
+
 SplashState* Game::splashState() {
 	return _splashState.get();
 }
@@ -116,3 +588,28 @@ SplashState* Game::splashState() {
 MainState* Game::mainState() {
 	return _mainState.get();
 }
+
+
+TextureResidency* Game::textures() {
+	return _textures.get();
+}
+
+
+const Path& Game::generatedPath() const {
+	return _generatedPath;
+}
+
+
+const AssetPack& Game::assetPack() const {
+	return _assetPack;
+}
+
+
+const TextureAtlas& Game::atlas() const {
+	return _atlas;
+}
+
+
+StartupProfile& Game::profile() {
+	return _profile;
+}
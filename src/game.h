@@ -25,12 +25,17 @@
 
 #include <lair/utils/game_base.h>
 
+#include "asset_pack.h"
+#include "startup_profile.h"
+#include "texture_atlas.h"
+
 
 using namespace lair;
 
 
 class MainState;
 class SplashState;
+class TextureResidency;
 
 
 class GameConfig : public GameConfigBase {
@@ -59,19 +64,64 @@ public:
 	void initialize();
 	void shutdown();
 
+	bool runHeadless();
+	bool runBatch();
+	bool runCharacterBenchmark();
+	bool runTileBenchmark();
+	bool runRestartCheck();
+
 	GameConfig& config();
+	bool isHeadless() const;
+	bool isTileBenchmark() const;
 
 	SplashState* splashState();
 	MainState*   mainState();
+	TextureResidency* textures();
+	const Path&       generatedPath() const;
+	const AssetPack&  assetPack() const;
+	const TextureAtlas& atlas() const;
+	StartupProfile&   profile();
+
+protected:
+	void initializeHeadless();
 
 protected:
 	GameConfig _config;
 
+	StartupProfile _profile;
+
 	std::unique_ptr<MainState> _mainState;
 	std::unique_ptr<SplashState> _splashState;
+	std::unique_ptr<TextureResidency> _textures;
+	AssetPack _assetPack;
+	TextureAtlas _atlas;
+
+	// Where the assets built from the loose ones are, see src/CMakeLists.txt.
+	Path   _generatedPath;
 
 	Path   _levelPath;
 	String _spawnName;
+
+	bool     _headless;
+	unsigned _headlessTicks;
+
+	unsigned _batchSize;
+	unsigned _batchThreads;
+
+	unsigned _benchCharacters;
+	unsigned _benchTileFrames;
+	bool     _checkRestart;
+
+	unsigned _textureBudget;  // MiB
+
+	bool     _hotReload;
+	bool     _gpuTiles;
+	bool     _simThread;
+
+	Path     _recordPath;
+	Path     _replayPath;
+
+	Path     _profilePath;
 };
 
 
@@ -21,7 +21,12 @@
 
 
 
-#include "main_state.h"
+#include <algorithm>
+#include <cstring>
+
+#include "commands.h"
+#include "game.h"
+#include "world.h"
 
 #include "level.h"
 
@@ -65,221 +70,422 @@ Box2 flipY(const Box2& box, float height) {
 
 
 
-Level::Level(MainState* mainState, const Path& path)
-	: _mainState(mainState)
+Level::Level(World* world, const Path& path, unsigned index)
+	: _world(world)
 	, _path(path)
+	, _index(index)
+	, _nBuiltObjects(0)
+	, _built(false)
+	, _revision(0)
 {
 }
 
 
-void Level::preload() {
-	_mainState->loader()->load<TileMapLoader>(_path);
+void Level::preload(LoadGraph& graph) {
+	StartupProfile::Scope scope(_world->game()->profile(), "Level::preload " + _path.utf8String());
+
+	// The cooked level is mapped by each world, the OS shares the pages.
+	// Stored in the asset pack, it is used in place.
+	Path cookedPath = cookedLevelPath(_path);
+	AssetBytes bytes;
+	bool packed = _world->game()->assetPack().read(cookedPath, bytes, _world->log());
+	if(packed) {
+		if(bytes.buffer.empty())
+			_data.open(bytes.data, bytes.size, _world->log(), cookedPath);
+		else
+			_data.open(std::move(bytes.buffer), _world->log(), cookedPath);
+	}
+	else
+		_data.open(_world->game()->generatedPath() / cookedPath, _world->log());
+
+	// The json was edited since (cook_levels did not run): cook it again.
+	if(_data.isValid() && !_data.isUpToDate(_world->game()->dataPath() / _path)) {
+		_world->log().warning("Cooked level ", cookedPath, " is outdated, cook ", _path,
+		                      " at load time");
+		_data.close();
+	}
+
+	if(_data.isValid()) {
+		_world->log().info("Use cooked level ", cookedPath, packed? " from the asset pack": "");
+		scope.addBytes(_data.byteSize());
+	}
+
+	// The cooked level is all the worlds need, rendered or not: tiles are
+	// drawn from it by chunks (see TileLayerChunks).
+	if(_data.isValid())
+		return;
+
+	// Without it, the level is cooked in memory from the tile map, see
+	// data(). Levels are shared by all the worlds, the graph only loads
+	// them once. Images are loaded on demand, see TextureResidency.
+	graph.load<TileMapLoader, TileMapAspect>(_path);
+}
+
+
+// The images displayed while the level is played.
+void Level::images(PathVector& images) {
+	CookedProperties props = data().properties();
+	images.push_back(props.getString("background", "background1.png"));
+	images.push_back(props.getString("tileset", "tileset.png"));
+
+	const char* endScreen = props.getString("end_screen", "");
+	if(endScreen[0])
+		images.push_back(endScreen);
 }
 
 
-void Level::initialize() {
-	_mainState->log().info("Initialize level ", _path);
+// Levels can be built over several ticks: the first call sets up the tile
+// data (nothing is baked, see streamAround()), then each call creates up to
+// maxObjects objects (all of them if 0) and the last one binds the
+// commands. The tree stays disabled until start().
+bool Level::build(unsigned maxObjects) {
+	if(_built)
+		return true;
+
+	const CookedLevel& data = this->data();
+
+	if(!_levelRoot.isValid()) {
+		_world->log().info("Build level ", _path);
+
+		// Collisions use the first layer, streamed by chunks.
+		_solidity.build(data, 0);
+
+		_objectEntities.clear();
+		_initialEnabled.clear();
+		_nBuiltObjects = 0;
+		_levelRoot = _world->_entities.createEntity(_world->_scene, _path.utf8CStr());
+		_levelRoot.setEnabled(false);
+
+		if(!_world->game()->isHeadless() && data.nLayers())
+			_baseLayer = createLayer(data.nLayers() - 1, "layer_base");
+		_objects = _world->_entities.createEntity(_levelRoot, "objects");
+
+		if(maxObjects)
+			return false;
+	}
+
+	unsigned end = data.nObjects();
+	if(maxObjects)
+		end = std::min(end, _nBuiltObjects + maxObjects);
+	for(; _nBuiltObjects < end; ++_nBuiltObjects) {
+		EntityRef entity = createObject(data.object(_nBuiltObjects));
+		_objectEntities.push_back(entity);
+		_initialEnabled.push_back(entity.isValid() && entity.isEnabled());
+	}
+	if(_nBuiltObjects < data.nObjects())
+		return false;
+
+	indexObjects();
+
+//	updateDepth();
+
+	_built = true;
+	return true;
+}
 
-	AssetSP asset = _mainState->assets()->getAsset(_path);
-	lairAssert(asset);
 
-	_tileMapAspect = asset->aspect<TileMapAspect>();
-	lairAssert(_tileMapAspect && _tileMapAspect->isValid());
+// Commands only enable or disable level entities, so that is all a level
+// that has been played needs to be reused.
+void Level::reset() {
+	for(unsigned oi = 0; oi < _objectEntities.size(); ++oi) {
+		if(_objectEntities[oi].isValid())
+			_objectEntities[oi].setEnabled(_initialEnabled[oi]);
+	}
+}
 
-	_tileMap = &_tileMapAspect->_get();
 
-	_entityMap.clear();
+void Level::destroy() {
 	if(_levelRoot.isValid())
 		_levelRoot.destroy();
-	_levelRoot = _mainState->_entities.createEntity(_mainState->_scene, _path.utf8CStr());
-	_levelRoot.setEnabled(false);
+	_levelRoot = EntityRef();
+	_baseLayer = EntityRef();
+	_objects   = EntityRef();
+	_solidity.clear();
+	_entityIndex.clear();
+	_triggerGrid.clear();
+	_objectEntities.clear();
+	_initialEnabled.clear();
+	_built = false;
+}
 
-	_mainState->_collisions.setBounds(
-	            AlignedBox2(Vector2(0, 0),
-	                        Vector2(_tileMap->width(0)  * TILE_SIZE,
-	                                _tileMap->height(0) * TILE_SIZE)));
 
-	_baseLayer = createLayer(_tileMap->nLayers() - 1, "layer_base");
-	_objects = _mainState->_entities.createEntity(_levelRoot, "objects");
+// Two objects are the same if everything the level reads from them is.
+static bool sameObject(const CookedLevel& data0, const CookedObject& obj0,
+                       const CookedLevel& data1, const CookedObject& obj1) {
+	if(obj0.x != obj1.x || obj0.y != obj1.y
+	|| obj0.width != obj1.width || obj0.height != obj1.height
+	|| obj0.gid != obj1.gid || obj0.nProperties != obj1.nProperties
+	|| std::strcmp(data0.string(obj0.type), data1.string(obj1.type))
+	|| std::strcmp(data0.string(obj0.name), data1.string(obj1.name)))
+		return false;
 
-	for(unsigned oli = 0; oli < _tileMap->nObjectLayer(); ++oli) {
-		for(const Json::Value& obj: _tileMap->objectLayer(oli)["objects"]) {
-			std::string type = obj.get("type", "<no_type>").asString();
-			std::string name = obj.get("name", "<no_name>").asString();
+	for(unsigned pi = 0; pi < obj0.nProperties; ++pi) {
+		const CookedProperty& prop0 = data0.property(obj0.firstProperty + pi);
+		const CookedProperty& prop1 = data1.property(obj1.firstProperty + pi);
+		if(prop0.type != prop1.type || prop0.number != prop1.number
+		|| std::strcmp(data0.string(prop0.name), data1.string(prop1.name))
+		|| (prop0.type == COOKED_STRING
+		    && std::strcmp(data0.string(prop0.string), data1.string(prop1.string))))
+			return false;
+	}
+	return true;
+}
 
-			EntityRef entity;
-			if(type == "spawn") {
-				entity = _mainState->_entities.createEntity(_levelRoot, name.c_str());
-				Box2 box = objectBox(obj);
 
-				entity.placeAt(Vector2(objectBox(obj).center()));
-//				entity.extra() = obj["properties"];
-			}
-			else if(type == "trigger") {
-				entity = createTrigger(obj, name);
+// Replaces the level data by a new version of it (edited while the game
+// runs) and only updates what changed: the solidity chunks of the modified
+// rows and the objects whose definition changed. The other objects keep
+// their entity and their state. Returns false if the level has been
+// destroyed instead and must be built again, e.g. because its size changed.
+bool Level::patch(CookedLevel&& data) {
+	_revision += 1;
+
+	const CookedLevel& old = this->data();
+	if(!_built || data.width() != old.width() || data.height() != old.height()
+	|| data.nLayers() != old.nLayers()) {
+		destroy();
+		_data = std::move(data);
+		return false;
+	}
+
+	unsigned width  = data.width();
+	unsigned height = data.height();
+	std::vector<unsigned> rows;
+	for(unsigned y = 0; y < height; ++y) {
+		for(unsigned li = 0; li < data.nLayers(); ++li) {
+			if(std::memcmp(data.layer(li) + y * width, old.layer(li) + y * width,
+			               width * sizeof(uint16))) {
+				rows.push_back(y);
+				break;
 			}
-//			else if(type == "entity") {
-//				entity = createEntity(obj, name);
-//			}
-//			else if(type == "item") {
-//				entity = createItem(obj, name);
-//			}
-//			else if(type == "door") {
-//				entity = createDoor(obj, name);
-//			}
-
-			if(!entity.isValid())
-				_mainState->log().warning(_path, ": Failed to load entity \"", name, "\" of type \"", type, "\"");
-			else
-				_entityMap.emplace(name, entity);
 		}
 	}
 
-//	updateDepth();
+	// Objects are matched by type and name, in order.
+	typedef std::pair<std::string, std::string> ObjectKey;
+	std::map<ObjectKey, std::vector<unsigned>> oldObjects;
+	for(unsigned oi = old.nObjects(); oi-- > 0; ) {
+		const CookedObject& obj = old.object(oi);
+		oldObjects[ObjectKey(old.string(obj.type), old.string(obj.name))].push_back(oi);
+	}
+
+	std::vector<EntityRef> entities(data.nObjects());
+	std::vector<bool>      initialEnabled(data.nObjects(), false);
+	std::vector<bool>      matched(data.nObjects(), false);
+	std::vector<bool>      kept(old.nObjects(), false);
+	for(unsigned oi = 0; oi < data.nObjects(); ++oi) {
+		const CookedObject& obj = data.object(oi);
+		auto it = oldObjects.find(ObjectKey(data.string(obj.type), data.string(obj.name)));
+		if(it == oldObjects.end() || it->second.empty())
+			continue;
+		unsigned oldIndex = it->second.back();
+		it->second.pop_back();
+		if(sameObject(old, old.object(oldIndex), data, obj)) {
+			entities[oi]       = _objectEntities[oldIndex];
+			initialEnabled[oi] = _initialEnabled[oldIndex];
+			matched[oi]        = true;
+			kept[oldIndex]     = true;
+		}
+	}
+
+	unsigned nRemoved = 0;
+	for(unsigned oi = 0; oi < old.nObjects(); ++oi) {
+		if(!kept[oi] && _objectEntities[oi].isValid()) {
+			_objectEntities[oi].destroy();
+			nRemoved += 1;
+		}
+	}
+
+	// The background thread may be reading the old data.
+	_solidity.detach();
+	_data = std::move(data);
+	_solidity.patch(_data, rows);
+
+	unsigned nCreated = 0;
+	for(unsigned oi = 0; oi < _data.nObjects(); ++oi) {
+		if(matched[oi])
+			continue;
+		entities[oi] = createObject(_data.object(oi));
+		initialEnabled[oi] = entities[oi].isValid() && entities[oi].isEnabled();
+		nCreated += 1;
+	}
+	_objectEntities.swap(entities);
+	_initialEnabled.swap(initialEnabled);
+	_nBuiltObjects = _data.nObjects();
+
+	indexObjects();
+
+	_world->log().info("Patch level ", _path, ": ", rows.size(), " row(s), ",
+	                   nRemoved, " object(s) removed, ", nCreated, " created");
+	return true;
+}
+
+
+// Estimate, the entities (objects plus root, layer and object group) are
+// accounted for with ENTITY_BYTE_SIZE. The cooked data is not counted: it
+// is kept even when the level is destroyed.
+size_t Level::byteSize() const {
+	if(!_levelRoot.isValid())
+		return 0;
+	return _solidity.byteSize() + _triggerGrid.byteSize()
+	     + (_entityIndex.size() + 3) * ENTITY_BYTE_SIZE;
 }
 
 
-void Level::start(const std::string& spawn) {
-	_mainState->log().info("Start level ", _path);
+void Level::start(EntityRef spawn) {
+	_world->log().info("Start level ", _path);
 	_levelRoot.setEnabled(true);
 
+	const CookedLevel& data = this->data();
+	_world->_collisions.setBounds(
+	            AlignedBox2(Vector2(0, 0),
+	                        Vector2(data.width()  * TILE_SIZE,
+	                                data.height() * TILE_SIZE)));
+
 	spawnPlayer(spawn);
 
-	_mainState->_entities.updateWorldTransforms();
-	_mainState->_collisions.findCollisions();
-	_mainState->updateTriggers(true);
+	_world->_entities.updateWorldTransforms();
 
-//	_mainState->orientPlayer(_mainState->_playerDir);
+	// Characters stream the level as they move, the player is not simulated
+	// yet.
+	CollisionComponent* coll = _world->_collisions.get(_world->_player);
+	if(coll && !coll->shapes().empty())
+		streamAround({ coll->shapes()[0].transformed(_world->_player.worldTransform()).boundingBox() });
 
-//	_mainState->setOverlay(1);
-//	_mainState->exec(spawnEntity.extra().get("on_enter", "fade_in").asString());
+	_world->updateTriggers(true);
+
+//	_world->orientPlayer(_world->_playerDir);
+
+//	_world->setOverlay(1);
+//	_world->exec(spawnEntity.extra().get("on_enter", "fade_in").asString());
 }
 
 
 void Level::stop() {
-	_mainState->log().info("Stop level ", _path);
+	_world->log().info("Stop level ", _path);
 	_levelRoot.setEnabled(false);
 }
 
 
-void Level::spawnPlayer(const std::string& spawn) {
-	EntityRef spawnEntity = entity(spawn);
-	if(spawnEntity.isValid())
-		_mainState->_player.placeAt(Vector2(spawnEntity.position2() - Vector2(0, 24)));
+void Level::spawnPlayer(EntityRef spawn) {
+	if(spawn.isValid())
+		_world->_player.placeAt(Vector2(spawn.position2() - Vector2(0, 24)));
+}
+
+
+void Level::streamAround(const std::vector<Box2>& areas) {
+	_solidity.stream(areas);
+	_triggerGrid.stream(areas, STREAM_NEED_MARGIN * TILE_SIZE, STREAM_KEEP_MARGIN * TILE_SIZE);
 }
 
-Box2 Level::objectBox(const Json::Value& obj) const {
-	try {
-//		Json::Value props = obj["properties"];
 
-		Vector2 min(obj["x"].asFloat(),
-		            obj["y"].asFloat());
-		Vector2 max(min(0) + obj["width"] .asFloat(),
-		            min(1) + obj["height"].asFloat());
+// Loaded on demand, see TextureResidency.
+ImageAspectSP Level::tileSet() {
+	Path path = data().properties().getString("tileset", "tileset.png");
+	AssetSP asset = _world->assets()->getAsset(path);
+	return asset? _world->assets()->getAspect<ImageAspect>(asset): ImageAspectSP();
+}
+
 
-		float height = _tileMap->height(0) * TILE_SIZE;
-		return flipY(Box2(min, max), height);
-	}
-	catch(Json::Exception& e) {
-		_mainState->log().error(_path, ": Json error while loading: ", e.what());
-		return Box2(Vector2(0, 0), Vector2(0, 0));
-	}
+Box2 Level::objectBox(const CookedObject& obj) const {
+	Vector2 min(obj.x, obj.y);
+	Vector2 max(min(0) + obj.width,
+	            min(1) + obj.height);
+
+	float height = _data.height() * TILE_SIZE;
+	return flipY(Box2(min, max), height);
 }
 
 
+// The tiles are drawn from the cooked level by TileLayerChunks, the layer
+// only holds the tileset (set by World::applyLevelProperties()). Its sprite
+// component is disabled so that the sprites do not draw it.
 EntityRef Level::createLayer(unsigned index, const char* name) {
-	EntityRef layer = _mainState->_entities.createEntity(_levelRoot, name);
+	EntityRef layer = _world->_entities.createEntity(_levelRoot, name);
 
-	TileLayerComponent* lc = _mainState->_tileLayers.addComponent(layer);
-	lc->setTileMap(_tileMapAspect);
-	lc->setLayerIndex(index);
-	lc->setTextureFlags(Texture::BILINEAR_NO_MIPMAP | Texture::REPEAT);
+	SpriteComponent* sc = _world->_sprites.addComponent(layer);
+	sc->setTextureFlags(Texture::BILINEAR_NO_MIPMAP | Texture::CLAMP);
+	sc->setBlendingMode(BLEND_ALPHA);
+	sc->setEnabled(false);
 	layer.placeAt(Vector3(0, 0, .01f * float(index)));
 
-//	CollisionComponent* cc = _mainState->_collisions.addComponent(layer);
-//	cc->setHitMask(HIT_SOLID);
-
-//	Scalar height = _tileMap->height(index);
-//	for(unsigned y = 0; y < _tileMap->height(index) - 1; ++y) {
-//		for(unsigned x = 0; x < _tileMap->width(index) - 1; ++x) {
-//			bool solid  = isSolid(_tileMap->tile(x,     y,     index));
-//			bool solidX = isSolid(_tileMap->tile(x + 1, y,     index));
-//			bool solidY = isSolid(_tileMap->tile(x    , y + 1, index));
-
-//			Vector2 p10 = Vector2(x + 1, height - y    ) * TILE_SIZE;
-//			Vector2 p11 = Vector2(x + 1, height - y - 1) * TILE_SIZE;
-//			Vector2 p01 = Vector2(x    , height - y - 1) * TILE_SIZE;
-
-//			if(solid && !solidX) {
-//				cc->addShape(Shape::newOrientedLine(p10, p11));
-//			}
-//			else if(!solid && solidX) {
-//				cc->addShape(Shape::newOrientedLine(p11, p10));
-//			}
-
-//			if(solid && !solidY) {
-//				cc->addShape(Shape::newOrientedLine(p11, p01));
-//			}
-//			else if(!solid && solidY) {
-//				cc->addShape(Shape::newOrientedLine(p01, p11));
-//			}
-//		}
-//	}
-//	dbgLogger.warning("Layer ", index, ": ", cc->shapes().size(), " shapes.");
-
 	return layer;
 }
 
 
-EntityRef Level::createTrigger(const Json::Value &obj, const std::string& name) {
-	Json::Value props = obj.get("properties", Json::Value());
+// Returns an invalid entity if the object type is unknown.
+EntityRef Level::createObject(const CookedObject& obj) {
+	std::string type = _data.string(obj.type);
+	std::string name = _data.string(obj.name);
+
+	EntityRef entity;
+	if(type == "spawn") {
+		entity = _world->_entities.createEntity(_levelRoot, name.c_str());
+		entity.placeAt(Vector2(objectBox(obj).center()));
+	}
+	else if(type == "trigger") {
+		entity = createTrigger(obj, name);
+	}
+
+	if(!entity.isValid())
+		_world->log().warning(_path, ": Failed to load entity \"", name, "\" of type \"", type, "\"");
+	return entity;
+}
+
+
+EntityRef Level::createTrigger(const CookedObject& obj, const std::string& name) {
+	CookedProperties props = _data.properties(obj);
 
 	Box2 box = objectBox(obj);
-	float margin = props.get("margin", 0).asFloat();
+	float margin = props.getFloat("margin", 0);
 	Vector2 half = box.sizes() / 2 + Vector2(margin, margin);
 	AlignedBox2 hitBox(-half, half);
 
-	EntityRef entity = _mainState->createTrigger(_objects, name.c_str(), hitBox);
+	EntityRef entity = _world->createTrigger(_objects, name.c_str(), hitBox);
 	entity.placeAt((Vector3() << box.center(), 0.08).finished());
-	entity.setEnabled(props.get("enabled", true).asBool());
-
-	TriggerComponent* tc = _mainState->_triggers.get(entity);
-	tc->onEnter = props.get("on_enter", "").asString();
-	tc->onExit  = props.get("on_exit",  "").asString();
-	tc->onUse   = props.get("on_use",   "").asString();
-	if(props.get("solid", false).asBool()) {
-		CollisionComponent* cc = _mainState->_collisions.get(entity);
+	entity.setEnabled(props.getBool("enabled", true));
+
+	TriggerComponent* tc = _world->_triggers.get(entity);
+	tc->onEnter = props.getString("on_enter", "");
+	tc->onExit  = props.getString("on_exit",  "");
+	tc->onUse   = props.getString("on_use",   "");
+	// Bound by bindCommands(), once all the entities exist.
+	tc->enterProgram = _world->compile(tc->onEnter, false);
+	tc->exitProgram  = _world->compile(tc->onExit,  false);
+	tc->useProgram   = _world->compile(tc->onUse,   false);
+	if(props.getBool("solid", false)) {
+		CollisionComponent* cc = _world->_collisions.get(entity);
 		cc->setHitMask(cc->hitMask() | HIT_SOLID);
 	}
 
-	int gid = obj.get("gid", 0).asInt();
-	std::string sprite;
+	int gid = obj.gid;
+	const char* sprite = "";
 	int tileH = 1;
 	int tileV = 1;
 	int tileIndex = 0;
 	if(gid) {
-		sprite = _tileMap->tileSet()->asset()->logicPath().utf8String();
+		sprite = _data.properties().getString("tileset", "tileset.png");
 		tileH = TILE_SET_WIDTH;
 		tileV = TILE_SET_HEIGHT;
 		tileIndex = gid - 1;
 	}
-	sprite = props.get("sprite", sprite).asString();
-	if(!sprite.empty()) {
-		SpriteComponent* sc = _mainState->_sprites.addComponent(entity);
-		sc->setTexture(sprite);
+	sprite = props.getString("sprite", sprite);
+	if(sprite[0]) {
+		SpriteComponent* sc = _world->_sprites.addComponent(entity);
+		_world->game()->atlas().setTexture(sc, sprite);
 
-		tileIndex = props.get("tile_index", tileIndex).asInt();
+		tileIndex = props.getInt("tile_index", tileIndex);
 		sc->setTileIndex(tileIndex);
 		
-		tileH = props.get("tile_h", tileH).asInt();
-		tileV = props.get("tile_v", tileV).asInt();
-		Vector2 anchor(props.get("anchor_x", 0.5).asFloat(),
-		               props.get("anchor_y", 0.5).asFloat());
+		tileH = props.getInt("tile_h", tileH);
+		tileV = props.getInt("tile_v", tileV);
+		Vector2 anchor(props.getFloat("anchor_x", 0.5),
+		               props.getFloat("anchor_y", 0.5));
 		sc->setTileGridSize(Vector2i(tileH, tileV));
 		sc->setAnchor(anchor);
 		sc->setBlendingMode(BLEND_ALPHA);
 
-		float scalex = props.get("scale_x", 1).asFloat();
+		float scalex = props.getFloat("scale_x", 1);
 		entity.transform().matrix()(0, 0) = scalex;
 	}
 
@@ -292,10 +498,10 @@ EntityRef Level::createTrigger(const Json::Value &obj, const std::string& name)
 //	Box2 box  = objectBox(obj);
 //	int  item = props.get("item", 0).asInt();
 
-//	EntityRef entity = _mainState->_entities.cloneEntity(_mainState->_itemModel, _levelRoot, name.c_str());
+//	EntityRef entity = _world->_entities.cloneEntity(_world->_itemModel, _levelRoot, name.c_str());
 //	entity.place((Vector3() << box.center(), .09).finished());
 
-//	SpriteComponent* sc = _mainState->_sprites.get(entity);
+//	SpriteComponent* sc = _world->_sprites.get(entity);
 //	sc->setTileIndex(item);
 
 //	return entity;
@@ -308,11 +514,11 @@ EntityRef Level::createTrigger(const Json::Value &obj, const std::string& name)
 //	bool horizontal = props.get("horizontal", true).asBool();
 //	bool open = props.get("open", false).asBool();
 
-//	EntityRef model = horizontal? _mainState->_doorHModel: _mainState->_doorVModel;
-//	EntityRef entity = _mainState->_entities.cloneEntity(model, _levelRoot, name.c_str());
+//	EntityRef model = horizontal? _world->_doorHModel: _world->_doorVModel;
+//	EntityRef entity = _world->_entities.cloneEntity(model, _levelRoot, name.c_str());
 
 //	entity.place((Vector3() << box.center(), .2).finished());
-//	setDoorOpen(_mainState, entity, open);
+//	setDoorOpen(_world, entity, open);
 
 //	return entity;
 //}
@@ -331,13 +537,13 @@ EntityRef Level::createTrigger(const Json::Value &obj, const std::string& name)
 //	if(modelName.empty())
 //		return EntityRef();
 
-//	EntityRef model = _mainState->getEntity(modelName, _mainState->_models); //_mainState->_entities.createEntity(_levelRoot, name.c_str());
+//	EntityRef model = _world->getEntity(modelName, _world->_models); //_world->_entities.createEntity(_levelRoot, name.c_str());
 //	if(!model.isValid())
 //		return EntityRef();
 
-//	EntityRef entity = _mainState->_entities.cloneEntity(model, _objects, name.c_str());
+//	EntityRef entity = _world->_entities.cloneEntity(model, _objects, name.c_str());
 
-//	SpriteComponent* sc = _mainState->_sprites.get(entity);
+//	SpriteComponent* sc = _world->_sprites.get(entity);
 //	if(sc) {
 //		std::string sprite = props.get("sprite", sc->texturePath().utf8String()).asString();
 //		int tile  = props.get("tile_index", sc->tileIndex()).asInt();
@@ -356,7 +562,7 @@ EntityRef Level::createTrigger(const Json::Value &obj, const std::string& name)
 //	Vector2 position = box.min() + box.sizes().cwiseProduct(anchor);
 //	entity.place((Vector3() << position, depth).finished());
 
-//	CollisionComponent* cc = _mainState->_collisions.get(entity);
+//	CollisionComponent* cc = _world->_collisions.get(entity);
 //	if(cc) {
 //		float margin = props.get("margin", 0).asFloat();
 //		Box2 hitBox(box.min() - position + Vector2(margin, margin),
@@ -386,19 +592,104 @@ EntityRef Level::createTrigger(const Json::Value &obj, const std::string& name)
 EntityRef Level::entity(const std::string& name) {
 	EntityRange range = entities(name);
 	if(range.begin() == range.end()) {
-		_mainState->log().warning("Level::entity(\"", name, "\"): Entity not found.");
+		_world->log().warning("Level::entity(\"", name, "\"): Entity not found.");
 		return EntityRef();
 	}
-	auto it = range.begin();
-	++it;
-	if(it != range.end())
-		_mainState->log().warning("Level::entity(\"", name, "\"): More than one entity found.");
-	return *range.begin();
+	if(range.end() - range.begin() > 1)
+		_world->log().warning("Level::entity(\"", name, "\"): More than one entity found.");
+	return range.begin()->second;
+}
+
+
+// Without a cooked file, the level is cooked in memory from the tile map
+// asset.
+const CookedLevel& Level::data() {
+	if(!_data.isValid()) {
+		AssetSP asset = _world->assets()->getAsset(_path);
+		lairAssert(asset && asset->aspect<TileMapAspect>());
+		_data.cook(asset->aspect<TileMapAspect>()->get(), _world->log());
+		lairAssert(_data.isValid());
+	}
+	return _data;
+}
+
+
+Level::EntityRange Level::entities(const std::string& name) const {
+	auto range = std::equal_range(_entityIndex.begin(), _entityIndex.end(),
+	                              NamedEntity(name, EntityRef()),
+	                              [](const NamedEntity& e0, const NamedEntity& e1) {
+		return e0.first < e1.first;
+	});
+	return EntityRange{ range.first, range.second };
 }
 
 
-Level::EntityRange Level::entities(const std::string& name) {
-	return EntityRange(_entityMap, name);
+// Indexes the objects by name, builds the trigger grid and binds the
+// trigger commands. Called once all the objects exist.
+void Level::indexObjects() {
+	_entityIndex.clear();
+	_triggerGrid.clear();
+	_nextLevels.clear();
+	for(unsigned oi = 0; oi < _objectEntities.size(); ++oi) {
+		EntityRef entity = _objectEntities[oi];
+		if(!entity.isValid())
+			continue;
+
+		const CookedObject& obj = _data.object(oi);
+		_entityIndex.emplace_back(_data.string(obj.name), entity);
+		if(std::strcmp(_data.string(obj.type), "trigger") == 0) {
+			CollisionComponent* cc = _world->_collisions.get(entity);
+			_triggerGrid.addTrigger(entity, cc->shapes()[0].transformed(entity.transform()).boundingBox());
+		}
+	}
+
+	std::stable_sort(_entityIndex.begin(), _entityIndex.end(),
+	                 [](const NamedEntity& e0, const NamedEntity& e1) {
+		return e0.first < e1.first;
+	});
+
+	unsigned nErrors = bindCommands();
+	if(nErrors)
+		_world->log().error(_path, ": ", nErrors, " unresolved entity name(s) in trigger commands");
+
+	_triggerGrid.build(AlignedBox2(Vector2(0, 0), Vector2(_data.width()  * TILE_SIZE,
+	                                                      _data.height() * TILE_SIZE)),
+	                   TRIGGER_CELL_SIZE * TILE_SIZE);
+}
+
+
+// Resolves the entity names used by trigger commands, level entities
+// first, and lists the next_level targets. Returns the number of names
+// that could not be resolved.
+unsigned Level::bindCommands() {
+	// Names of other levels are errors, even if they are built.
+	auto resolve = [this](const String& name) {
+		EntityRange range = entities(name);
+		if(range.begin() != range.end())
+			return range.begin()->second;
+		return _world->globalEntity(name);
+	};
+
+	unsigned nErrors = 0;
+	for(unsigned ti = 0; ti < _triggerGrid.nTriggers(); ++ti) {
+		TriggerComponent* tc = _world->_triggers.get(_triggerGrid.trigger(ti));
+		for(const CommandProgramSP& program: { tc->enterProgram, tc->exitProgram, tc->useProgram }) {
+			if(!program)
+				continue;
+			nErrors += program->bindEntities(resolve, _world->log());
+
+			// next_level targets are known here, the world preloads them.
+			for(unsigned ii = 0; ii < program->size(); ++ii) {
+				if(program->instruction(ii).command != nextLevelCommand
+				|| program->instruction(ii).argc < 2)
+					continue;
+				const Path& next = program->args(ii)[1].path;
+				if(next != _path && std::find(_nextLevels.begin(), _nextLevels.end(), next) == _nextLevels.end())
+					_nextLevels.push_back(next);
+			}
+		}
+	}
+	return nErrors;
 }
 
 
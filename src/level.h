@@ -25,16 +25,24 @@
 
 #include <memory>
 #include <map>
+#include <vector>
 
 #include <lair/core/lair.h>
 #include <lair/core/path.h>
 
+#include <lair/asset/image.h>
+
 #include <lair/utils/tile_map.h>
 
 #include <lair/ec/entity.h>
 #include <lair/ec/collision_component.h>
 
 #include "components.h"
+#include "cooked_level.h"
+#include "load_graph.h"
+#include "texture_residency.h"
+#include "solidity_grid.h"
+#include "trigger_grid.h"
 
 
 using namespace lair;
@@ -44,6 +52,12 @@ enum {
 	TILE_SET_WIDTH  = 16,
 	TILE_SET_HEIGHT = 16,
 	TILE_SIZE       = 24,
+
+	// In tiles.
+	TRIGGER_CELL_SIZE = 4,
+
+	// Rough memory cost of an entity with its components, in bytes.
+	ENTITY_BYTE_SIZE = 512,
 };
 
 enum HitFlags {
@@ -54,7 +68,7 @@ enum HitFlags {
 };
 
 
-class MainState;
+class World;
 
 
 bool isSolid(TileMap::TileIndex tile);
@@ -68,11 +82,20 @@ unsigned updateFlags(unsigned flags, const Json::Value& obj, const std::string&
 
 class Level {
 public:
-	typedef std::unordered_multimap<std::string, EntityRef> EntityMap;
-	struct EntityRange;
+	// Entities by name, sorted by name, then in loading order.
+	typedef std::pair<std::string, EntityRef> NamedEntity;
+	typedef std::vector<NamedEntity>          EntityIndex;
+
+	struct EntityRange {
+		inline EntityIndex::const_iterator begin() const { return _begin; }
+		inline EntityIndex::const_iterator end()   const { return _end; }
+
+		EntityIndex::const_iterator _begin;
+		EntityIndex::const_iterator _end;
+	};
 
 public:
-	Level(MainState* mainState, const Path& path);
+	Level(World* world, const Path& path, unsigned index);
 	Level(const Level&)  = delete;
 	Level(      Level&&) = default;
 	virtual ~Level() = default;
@@ -80,112 +103,75 @@ public:
 	Level& operator=(const Level&)  = delete;
 	Level& operator=(      Level&&) = default;
 
-	void preload();
-	void initialize();
+	void preload(LoadGraph& graph);
+	void images(PathVector& images);
+	bool build(unsigned maxObjects = 0);
+	void reset();
+	void destroy();
+	bool patch(CookedLevel&& data);
 
-	void start(const std::string& spawn);
+	void start(EntityRef spawn);
 	void stop();
 
-	void spawnPlayer(const std::string& spawn);
+	void spawnPlayer(EntityRef spawn);
+
+	// Pages the collision and trigger data in around areas (world
+	// coordinates).
+	void streamAround(const std::vector<Box2>& areas);
 
-	Box2 objectBox(const Json::Value& obj) const;
+	Box2 objectBox(const CookedObject& obj) const;
 
 	EntityRef createLayer(unsigned index, const char* name);
-	EntityRef createTrigger(const Json::Value& obj, const std::string& name);
+	EntityRef createObject(const CookedObject& obj);
+	EntityRef createTrigger(const CookedObject& obj, const std::string& name);
+	void indexObjects();
+	unsigned bindCommands();
 //	EntityRef createItem(const Json::Value& obj, const std::string& name);
 //	EntityRef createDoor(const Json::Value& obj, const std::string& name);
 //	EntityRef createEntity(const Json::Value& obj, const std::string& name);
 
 	const Path& path() { return _path; }
-	TileMap*    tileMap() { return _tileMap; }
+	unsigned    index() const { return _index; }
+	bool        isBuilt() const { return _built; }
+	// Incremented each time patch() replaces the level data.
+	unsigned    revision() const { return _revision; }
+	size_t      byteSize() const;
+	// Levels named by the next_level commands of the triggers, once built.
+	const std::vector<Path>& nextLevels() const { return _nextLevels; }
+	const CookedLevel& data();
+	// The image of the tileset property.
+	ImageAspectSP tileSet();
+	const SolidityGrid& solidity() const { return _solidity; }
+	const TriggerGrid&  triggerGrid() const { return _triggerGrid; }
 	EntityRef   root() { return _levelRoot; }
+	EntityRef   baseLayer() { return _baseLayer; }
 	EntityRef   entity(const std::string& name);
-	EntityRange entities(const std::string& name);
+	EntityRange entities(const std::string& name) const;
 
 //	void updateDepth(EntityRef entity) const;
 //	void updateDepth();
 
 protected:
-	MainState* _mainState;
+	World*     _world;
 	Path       _path;
-	TileMapAspectSP _tileMapAspect;
-	TileMap*   _tileMap;
+	unsigned   _index;
+	CookedLevel _data;
+	SolidityGrid _solidity;
+	TriggerGrid  _triggerGrid;
 
 	EntityRef  _levelRoot;
 	EntityRef  _baseLayer;
 	EntityRef  _objects;
-	EntityMap  _entityMap;
-
-public:
-	struct EntityRange {
-		struct EntityIterator;
-
-		inline EntityRange(EntityMap& map, const std::string& key)
-			: _key(key), _begin(this), _end(this) {
-			if(!map.bucket_count()) {
-				_begin._it = EntityMap::local_iterator();
-				_end  ._it = _begin._it;
-			}
-			else {
-				int bucket = map.bucket(_key);
-				_begin._it = map.begin(bucket);
-				_end  ._it = map.end  (bucket);
-				_begin.skip();
-			}
-		}
-
-		inline EntityIterator begin() { return _begin; }
-		inline EntityIterator end()   { return _end; }
-
-		struct EntityIterator {
-			typedef EntityRef  value_type;
-			typedef ptrdiff_t  difference_type;
-			typedef size_t     size_type;
-			typedef EntityRef& reference;
-			typedef EntityRef* pointer;
-			typedef std::forward_iterator_tag iterator_category;
-
-			inline EntityIterator(EntityRange* range)
-				: _range(range) {}
-
-			inline void skip() {
-				while (_it != _range->_end._it && _it->first != _range->_key)
-					++_it;
-			}
-
-			inline bool operator==(const EntityIterator& other) const {
-				return _range == other._range && _it == other._it;
-			}
-			inline bool operator!=(const EntityIterator& other) const {
-				return !(*this == other);
-			}
-
-			inline EntityIterator& operator++() {
-				++_it;
-				skip();
-				return *this;
-			}
-			inline EntityIterator operator++(int) {
-				EntityIterator tmp(*this);
-				++(*this);
-				return tmp;
-			}
-
-			inline const EntityRef& operator*() const {
-				return _it->second;
-			}
-			inline EntityRef& operator*() {
-				return _it->second;
-			}
-
-			EntityRange*              _range;
-			EntityMap::local_iterator _it;
-		};
-
-		std::string    _key;
-		EntityIterator _begin;
-		EntityIterator _end;
-	};
+	EntityIndex _entityIndex;
+	std::vector<Path> _nextLevels;
+	// Entity of each object (invalid if it failed to load) and its enabled
+	// state after build(), restored by reset().
+	std::vector<EntityRef> _objectEntities;
+	std::vector<bool>      _initialEnabled;
+
+	unsigned   _nBuiltObjects;
+	bool       _built;
+	unsigned   _revision;
 };
 
 typedef std::shared_ptr<Level> LevelSP;
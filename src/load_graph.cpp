@@ -0,0 +1,157 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "startup_profile.h"
+
+#include "load_graph.h"
+
+
+// Nothing finishing for this long means either a slow asset or a failed
+// one, that never becomes valid. wait() then blocks on the loader to know.
+static const int64 STALL_TIME = 250000000;
+
+
+LoadGraph::LoadGraph(LoaderManager* loader, AssetManager* assets, Logger& log)
+	: _loader(loader)
+	, _assets(assets)
+	, _log(log)
+	, _nPending(0)
+	, _startTime(0)
+{
+	_startTime = now();
+}
+
+
+void LoadGraph::wait() {
+	int64 lastProgress = now();
+	while(_nPending) {
+		if(poll()) {
+			lastProgress = now();
+		}
+		else if(now() - lastProgress < STALL_TIME) {
+			std::this_thread::sleep_for(std::chrono::microseconds(500));
+		}
+		else {
+			// Once the loader is idle, what is still pending has failed.
+			_loader->waitAll();
+			if(poll())
+				continue;
+
+			for(Node& node: _nodes) {
+				if(node.endTime < 0) {
+					node.endTime = now() - _startTime;
+					node.failed  = true;
+					_log.error("Failed to load \"", node.path, "\"");
+				}
+			}
+			_nPending = 0;
+		}
+	}
+}
+
+
+void LoadGraph::logTimings(unsigned maxAssets) const {
+	int64 end = 0;
+	std::vector<unsigned> order;
+	for(unsigned ni = 0; ni < _nodes.size(); ++ni) {
+		end = std::max(end, _nodes[ni].endTime);
+		order.push_back(ni);
+	}
+	std::sort(order.begin(), order.end(), [this](unsigned n0, unsigned n1) {
+		return _nodes[n0].endTime - _nodes[n0].startTime
+		     > _nodes[n1].endTime - _nodes[n1].startTime;
+	});
+
+	_log.info("Loaded ", _nodes.size(), " assets in ", end / 1000000, " ms");
+	for(unsigned oi = 0; oi < std::min(maxAssets, unsigned(order.size())); ++oi) {
+		const Node& node = _nodes[order[oi]];
+		_log.info("  ", node.path, ": ", (node.endTime - node.startTime) / 1000000,
+		          " ms (from ", node.startTime / 1000000, " ms)", node.failed? ", failed": "");
+	}
+}
+
+
+uint64 LoadGraph::record(StartupProfile& profile, const Path& dataPath) const {
+	// Loaders record their event after the aspect is valid.
+	_loader->waitAll();
+
+	uint64 total = 0;
+	for(const Node& node: _nodes) {
+		StartupProfile::Event event;
+		if(profile.findAsset(node.path.utf8String(), event)) {
+			total += event.bytes;
+			continue;
+		}
+
+		uint64 bytes = node.failed? 0: StartupProfile::fileSize(dataPath / node.path);
+		profile.addEvent(node.path.utf8String(), StartupProfile::ASSET,
+		                 _startTime + node.startTime, _startTime + node.endTime, bytes);
+		total += bytes;
+	}
+	return total;
+}
+
+
+unsigned LoadGraph::addNode(const Path& path, const std::function<bool()>& isLoaded,
+                            const LoadCallback& onLoaded) {
+	Node node;
+	node.path      = path;
+	node.isLoaded  = isLoaded;
+	node.onLoaded  = onLoaded;
+	node.startTime = now() - _startTime;
+	node.endTime   = -1;
+	node.failed    = false;
+	_nodes.push_back(node);
+	_nPending += 1;
+	return _nodes.size() - 1;
+}
+
+
+// Returns true if an asset finished loading.
+bool LoadGraph::poll() {
+	_loader->finalizePending();
+
+	bool progress = false;
+	// Callbacks add nodes, iterate by index.
+	for(unsigned ni = 0; ni < _nodes.size(); ++ni) {
+		if(_nodes[ni].endTime >= 0 || !_nodes[ni].isLoaded())
+			continue;
+
+		_nodes[ni].endTime = now() - _startTime;
+		_nPending -= 1;
+		progress = true;
+
+		LoadCallback onLoaded = _nodes[ni].onLoaded;
+		if(onLoaded)
+			onLoaded(*this);
+	}
+	return progress;
+}
+
+
+int64 LoadGraph::now() const {
+	using namespace std::chrono;
+	return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
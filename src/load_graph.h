@@ -0,0 +1,118 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef LD39_LOAD_GRAPH_H_
+#define LD39_LOAD_GRAPH_H_
+
+
+#include <functional>
+#include <vector>
+
+#include <lair/core/lair.h>
+#include <lair/core/log.h>
+#include <lair/core/path.h>
+
+#include <lair/asset/asset_manager.h>
+
+
+using namespace lair;
+
+
+class LoadGraph;
+class StartupProfile;
+
+typedef std::function<void(LoadGraph&)> LoadCallback;
+
+
+// Loads assets as soon as they are known, instead of in phases separated
+// by LoaderManager::waitAll(): an asset that depends on another one is
+// requested by the callback of the latter, which runs as soon as it is
+// loaded. Decoding runs on the loader threads, callbacks run in wait().
+class LoadGraph {
+public:
+	struct Node {
+		Path         path;
+		std::function<bool()> isLoaded;
+		LoadCallback onLoaded;
+		int64        startTime;  // In ns, since the graph creation.
+		int64        endTime;    // -1 while loading.
+		bool         failed;
+	};
+
+public:
+	LoadGraph(LoaderManager* loader, AssetManager* assets, Logger& log);
+	LoadGraph(const LoadGraph&)  = delete;
+	LoadGraph(      LoadGraph&&) = delete;
+	~LoadGraph() = default;
+
+	LoadGraph& operator=(const LoadGraph&)  = delete;
+	LoadGraph& operator=(      LoadGraph&&) = delete;
+
+	// Loads path with _Loader, unless it is already loaded or loading, and
+	// calls onLoaded once its _Aspect is valid. Returns the node index.
+	template<typename _Loader, typename _Aspect>
+	unsigned load(const Path& path, const LoadCallback& onLoaded = LoadCallback()) {
+		AssetSP asset = _assets->getAsset(path);
+		if(!asset || !asset->template aspect<_Aspect>())
+			_loader->template load<_Loader>(path);
+
+		AssetManager* assets = _assets;
+		return addNode(path, [assets, path]() {
+			AssetSP asset = assets->getAsset(path);
+			std::shared_ptr<_Aspect> aspect = asset? asset->template aspect<_Aspect>(): nullptr;
+			return aspect && aspect->isValid();
+		}, onLoaded);
+	}
+
+	// Returns once every asset, including the ones requested by callbacks,
+	// is loaded or failed to.
+	void wait();
+
+	inline unsigned    nNodes() const { return _nodes.size(); }
+	inline const Node& node(unsigned index) const { return _nodes[index]; }
+
+	// Logs the total time and the slowest assets.
+	void logTimings(unsigned maxAssets = 8) const;
+
+	// Adds to the profile the assets that their loader did not time (see
+	// packed_loaders.h): from their request to when wait() saw them loaded,
+	// sized from the files in dataPath. Returns the total size of the
+	// graph's assets.
+	uint64 record(StartupProfile& profile, const Path& dataPath) const;
+
+protected:
+	unsigned addNode(const Path& path, const std::function<bool()>& isLoaded,
+	                 const LoadCallback& onLoaded);
+	bool poll();
+	int64 now() const;
+
+protected:
+	LoaderManager*    _loader;
+	AssetManager*     _assets;
+	Logger&           _log;
+
+	std::vector<Node> _nodes;
+	unsigned          _nPending;
+	int64             _startTime;
+};
+
+
+#endif
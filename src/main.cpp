@@ -30,10 +30,19 @@ int main(int argc, char** argv) {
 	Game game(argc, argv);
 	game.initialize();
 
-	game.setNextState(game.splashState());
-//	game.setNextState(game.mainState());
-	game.run();
+	bool success = true;
+	if(game.isHeadless()) {
+		success = game.runHeadless();
+	}
+	else if(game.isTileBenchmark()) {
+		success = game.runTileBenchmark();
+	}
+	else {
+		game.setNextState(game.splashState());
+//		game.setNextState(game.mainState());
+		game.run();
+	}
 
 	game.shutdown();
-	return EXIT_SUCCESS;
+	return success? EXIT_SUCCESS: EXIT_FAILURE;
 }
@@ -19,13 +19,16 @@
  */
 
 
+#include <algorithm>
+#include <chrono>
 #include <functional>
 
 #include <lair/core/json.h>
 
 #include "game.h"
 #include "level.h"
-#include "commands.h"
+#include "packed_loaders.h"
+#include "splash_state.h"
 
 #include "main_state.h"
 
@@ -33,9 +36,6 @@
 #define ONE_SEC (1000000000)
 
 
-const float TICK_LENGTH_IN_SEC = 1.f / float(TICKS_PER_SEC);
-const float FADE_DURATION = .5;
-
 void dumpEntityTree(Logger& log, EntityRef e, unsigned indent = 0) {
 	log.info(std::string(indent * 2u, ' '), e.name(), ": ", e.isEnabled(), ", ", e.position3().transpose());
 	EntityRef c = e.firstChild();
@@ -49,26 +49,26 @@ void dumpEntityTree(Logger& log, EntityRef e, unsigned indent = 0) {
 MainState::MainState(Game* game)
 	: GameState(game),
 
-      _mainPass(renderer()),
+      _mainPass(game->isHeadless()? nullptr: new RenderPass(renderer())),
+      _spriteRenderer(game->isHeadless()? nullptr: new SpriteRenderer(renderer())),
+      _inputs(sys(), &log()),
 
-      _entities(log(), _game->serializer()),
-      _spriteRenderer(renderer()),
-      _sprites(assets(), loader(), &_mainPass, &_spriteRenderer),
-      _collisions(),
-      _triggers(),
-      _characters(this),
-      _texts(loader(), &_mainPass, &_spriteRenderer),
-      _tileLayers(loader(), &_mainPass, &_spriteRenderer),
+      _tileChunks(_mainPass.get(), _spriteRenderer.get()),
+      _tileIndices(renderer(), log()),
+      _gpuTiles(false),
 
-      _inputs(sys(), &log()),
+      _world(game, log(), this, _mainPass.get(), _spriteRenderer.get()),
+      _spriteBatcher(&_world._sprites, _mainPass.get(), _spriteRenderer.get()),
 
       _camera(),
 
       _initialized(false),
+      _headless(game->isHeadless()),
       _running(false),
       _loop(sys()),
       _fpsTime(0),
       _fpsCount(0),
+      _nDrawCalls(0),
 
       _quitInput(nullptr),
       _leftInput(nullptr),
@@ -78,24 +78,20 @@ MainState::MainState(Game* game)
       _jumpInput(nullptr),
       _dashInput(nullptr),
 
-      _state(STATE_PLAY),
-      _transitionTime(0)
-{
-	_entities.registerComponentManager(&_sprites);
-	_entities.registerComponentManager(&_collisions);
-	_entities.registerComponentManager(&_triggers);
-	_entities.registerComponentManager(&_characters);
-	_entities.registerComponentManager(&_texts);
-	_entities.registerComponentManager(&_tileLayers);
+      _tickInputs(INPUT_NONE),
+      _prevTickInputs(INPUT_NONE),
+      _recording(false),
+      _replaying(false),
+
+      _displayedLevel(nullptr),
+      _overlayTexture("white.png"),
 
-	_commands.emplace("echo",       echoCommand);
-	_commands.emplace("set_spawn",  setSpawnCommand);
-	_commands.emplace("kill",       killCommand);
-	_commands.emplace("next_level", nextLevelCommand);
-	_commands.emplace("disable",    disableCommand);
-	_commands.emplace("no_jump",    noJumpCommand);
-	_commands.emplace("slow",       slowCommand);
-	_commands.emplace("credits",    creditsCommand);
+      _threaded(false),
+      _frameInputs(INPUT_NONE),
+      _renderedLevel(nullptr),
+      _publishedLevel(nullptr),
+      _publishedRevision(0)
+{
 }
 
 
@@ -104,14 +100,18 @@ MainState::~MainState() {
 
 
 void MainState::initialize() {
+	StartupProfile::Scope scope(game()->profile(), "MainState::initialize");
+
 	_loop.reset();
 	_loop.setTickDuration(    ONE_SEC /  TICKS_PER_SEC);
 	_loop.setFrameDuration(   ONE_SEC /  FRAMES_PER_SEC);
 	_loop.setMaxFrameDuration(_loop.frameDuration() * 3);
 	_loop.setFrameMargin(     _loop.frameDuration() / 2);
 
-	window()->onResize.connect(std::bind(&MainState::resizeEvent, this))
-	        .track(_slotTracker);
+	if(!_headless) {
+		window()->onResize.connect(std::bind(&MainState::resizeEvent, this))
+		        .track(_slotTracker);
+	}
 
 	_quitInput  = _inputs.addInput("quit");
 	_leftInput  = _inputs.addInput("left");
@@ -130,92 +130,56 @@ void MainState::initialize() {
 	_inputs.mapScanCode(_jumpInput,  SDL_SCANCODE_X);
 	_inputs.mapScanCode(_dashInput,  SDL_SCANCODE_Z);
 
-	// TODO: load stuff.
-	loadEntities("entities.ldl", _entities.root());
-
-	_models      = _entities.findByName("__models__");
-	_playerModel = _entities.findByName("player_model", _models);
-	_playerDeathModel = _entities.findByName("player_death_model", _models);
-
-	_background  = _entities.findByName("background");
-	_scene       = _entities.findByName("scene");
-	_gui         = _entities.findByName("gui");
-	_fadeOverlay = _entities.findByName("fade_overlay");
-
-	registerLevel("test_map.json");
-	registerLevel("lvl1.json");
-	registerLevel("lvl2.json");
-	registerLevel("lvl3.json");
-	registerLevel("lvl4.json");
-	setNextLevel("lvl1.json");
-
-	loadSound("arrival.wav");
-	loadSound("dash.wav");
-	loadSound("death.wav");
-	loadSound("departure.wav");
-	loadSound("jump.wav");
-	loadSound("land.wav");
+	// Everything loads concurrently.
+	LoadGraph graph(loader(), assets(), log());
+	_world.initialize(graph);
 
-	loadMusic("ending.mp3");
+	if(!_headless) {
+		loadSound(graph, "arrival.wav");
+		loadSound(graph, "dash.wav");
+		loadSound(graph, "death.wav");
+		loadSound(graph, "departure.wav");
+		loadSound(graph, "jump.wav");
+		loadSound(graph, "land.wav");
 
-	loader()->load<ImageLoader>("battery1.png");
-	loader()->load<ImageLoader>("battery2.png");
-	loader()->load<ImageLoader>("battery3.png");
-	loader()->load<ImageLoader>("battery4.png");
-
-	loader()->waitAll();
-
-	for(auto& pathLevel: _levelMap) {
-		LevelSP level = pathLevel.second;
-		AssetSP levelAsset = assets()->getAsset(level->path());
-		TileMap& tileMap = assets()->getAspect<TileMapAspect>(levelAsset)->_get();
+		loadMusic(graph, "ending.mp3");
+	}
 
-		Path background = tileMap.properties().get("background", "background1.png").asString();
-		loader()->load<ImageLoader>(background);
+	// Other story screens are level end screens, loaded with the level.
+	graph.load<PackedImageLoader, ImageAspect>("battery4.png");
 
-		Path tileset = tileMap.properties().get("tileset", "tileset.png").asString();
-		loader()->load<ImageLoader>(tileset);
+	{
+		StartupProfile::Scope waitScope(game()->profile(), "MainState::initialize: load graph");
+		graph.wait();
+		waitScope.addBytes(graph.record(game()->profile(), game()->dataPath()));
 	}
+	graph.logTimings();
 
-	loader()->waitAll();
+	// Textures requested by the entities are not in the graph.
+	{
+		StartupProfile::Scope waitScope(game()->profile(), "MainState::initialize: entity textures");
+		loader()->waitAll();
+	}
 
 	// Set to true to debug OpenGL calls
-	renderer()->context()->setLogCalls(false);
-
-	// Physics !
-	_playerPhysics.reset(new CharPhysicsParams);
-
-	float tileSize = TILE_SIZE * 2;
-
-	_playerPhysics->accelTime    =  0.1 * TICKS_PER_SEC;
-	_baseMaxSpeed                =  8   * tileSize * TICK_LENGTH_IN_SEC;
-	_playerPhysics->maxSpeed     = _baseMaxSpeed;
-	_playerPhysics->playerAccel  = _playerPhysics->maxSpeed / _playerPhysics->accelTime;
-	_playerPhysics->airControl   =  0.5 * _playerPhysics->playerAccel;
-
-	_playerPhysics->jump         = true;
-	_playerPhysics->numJumps     = 1;
-	_playerPhysics->jumpTicks    = 10;
-//	_playerPhysics->gravity      = 32 * tileSize * TICK_LENGTH_IN_SEC * TICK_LENGTH_IN_SEC;
-//	_playerPhysics->jumpSpeed    = 19 * tileSize * TICK_LENGTH_IN_SEC;
-	_playerPhysics->gravity      = 48 * tileSize * TICK_LENGTH_IN_SEC * TICK_LENGTH_IN_SEC;
-	_playerPhysics->jumpSpeed    = 24.2 * tileSize * TICK_LENGTH_IN_SEC;
-	_playerPhysics->jumpAccel    = _playerPhysics->jumpSpeed / _playerPhysics->jumpTicks;
-	_playerPhysics->maxFallSpeed = _playerPhysics->jumpSpeed;
-
-	_playerPhysics->wallJump         = true;
-	_playerPhysics->wallJumpAccel    = 0.4 * _playerPhysics->jumpAccel;
-	_playerPhysics->maxWallFallSpeed = 0.35 * _playerPhysics->maxFallSpeed;
-
-	_playerPhysics->numDashes = 1;
-	_playerPhysics->dashTicks = 8;
-	_playerPhysics->dashSpeed = 32   * tileSize * TICK_LENGTH_IN_SEC;
+	if(!_headless)
+		renderer()->context()->setLogCalls(false);
 
 	_initialized = true;
 }
 
 
 void MainState::shutdown() {
+	if(_recording) {
+		if(_world._player.isValid())
+			_replay.setEndPosition(_world._player.position2());
+		_replay.save(_replayPath, log());
+		_recording = false;
+	}
+
+	if(!_headless)
+		_tileIndices.shutdown();
+
 	_slotTracker.disconnectAll();
 
 	_initialized = false;
@@ -232,111 +196,125 @@ void MainState::run() {
 	_fpsCount = 0;
 
 	startGame();
+	game()->profile().finish();
+
+	if(_threaded) {
+		publishSnapshot();
+		_renderedLevel = nullptr;
+		_simulation = std::thread(&MainState::runSimulation, this);
+	}
 
 	do {
 		switch(_loop.nextEvent()) {
 		case InterpLoop::Tick:
-			updateTick();
+			if(_threaded)
+				syncInputs();
+			else
+				updateTick();
 			break;
 		case InterpLoop::Frame:
-			updateFrame();
+			if(_threaded)
+				renderSnapshot();
+			else
+				updateFrame();
 			break;
 		}
 	} while (_running);
 	_loop.stop();
+
+	if(_threaded) {
+		_simulation.join();
+		game()->textures()->releaseEvicted();
+	}
 }
 
 
-void MainState::exec(const std::string& cmds, EntityRef self) {
-	CommandList commands;
-	unsigned first = 0;
-	for(unsigned ci = 0; ci <= cmds.size(); ++ci) {
-		if(ci == cmds.size() || cmds[ci] == '\n' || cmds[ci] == ';') {
-			commands.emplace_back(CommandExpr{ String(cmds.begin() + first, cmds.begin() + ci), self });
-			first = ci + 1;
-		}
+bool MainState::runHeadless(unsigned nTicks) {
+	lairAssert(_initialized);
+
+	log().log("Starting main state (headless, ", nTicks, " ticks)...");
+	_running = true;
+
+	startGame();
+	game()->profile().finish();
+
+	// No InterpLoop pacing and no frames: tick as fast as the CPU allows.
+	int64 startTime = int64(sys()->getTimeNs());
+	unsigned tick = 0;
+	while(_running && tick < nTicks && !(_replaying && _replay.atEnd())) {
+		updateTick();
+		++tick;
 	}
-	exec(commands);
-}
+	int64 duration = std::max(int64(sys()->getTimeNs()) - startTime, int64(1));
+
+	log().info("Headless: ", tick, " ticks in ", duration / 1000000, " ms (",
+	           tick * float(ONE_SEC) / duration, " ticks/s)");
+	log().info("Headless: level \"", _world._level->path(), "\", state ", _world._state,
+	           ", player at ", _world._player.position2().transpose());
 
+	bool success = true;
+	if(_replaying)
+		success = finishReplay();
 
-void MainState::exec(const CommandList& commands) {
-	bool execNow = _commandList.empty();
-	_commandList.insert(_commandList.begin(), commands.begin(), commands.end());
-	if(execNow)
-		execNext();
+	_running = false;
+	return success;
 }
 
 
-void MainState::execNext() {
-	while(!_commandList.empty()) {
-		CommandExpr cmd = _commandList.front();
-		_commandList.pop_front();
-		if(execSingle(cmd.command, cmd.self) == 0)
-			return;
-	}
+// Draws the tile layer with TileIndexRenderer instead of TileLayerChunks.
+// Levels too large for it still use the chunks.
+void MainState::useGpuTiles() {
+	_gpuTiles = _tileIndices.initialize();
+	if(!_gpuTiles)
+		log().warning("GPU tile rendering unavailable, using chunks");
 }
 
 
-int MainState::execSingle(const std::string& cmd, EntityRef self) {
-#define MAX_CMD_ARGS 32
-
-	std::string tokens = cmd;
-	unsigned    size   = tokens.size();
-	int ret = 0;
-	for(unsigned ci = 0; ci < size; ) {
-		int   argc = 0;
-		const char* argv[MAX_CMD_ARGS];
-		while(ci < size) {
-			bool endLine = false;
-			while(ci < size && std::isspace(tokens[ci])) {
-				endLine = (tokens[ci] == '\n') || (tokens[ci] == ';');
-				tokens[ci] = '\0';
-				++ci;
-			}
-			if(endLine)
-				break;
-
-			argv[argc] = tokens.data() + ci;
-			++argc;
-
-			while(ci < size && !std::isspace(tokens[ci])) {
-				++ci;
-			}
-		}
+// Runs the ticks on a thread of their own, at a fixed rate: a slow frame
+// (swap, texture upload) does not delay them any more. This thread keeps
+// the GL context and the window events, and draws the snapshots published
+// by the ticks (see RenderSnapshot).
+void MainState::useSimThread() {
+	_threaded = true;
+	game()->textures()->setDeferRelease(true);
+}
 
-		if(argc) {
-			ret = exec(argc, argv, self);
-		}
-	}
 
-	return ret;
+void MainState::recordReplay(const Path& path) {
+	_replayPath = path;
+	_recording  = true;
+	_replaying  = false;
 }
 
 
-int MainState::exec(int argc, const char** argv, EntityRef self) {
-	lairAssert(argc > 0);
+bool MainState::playReplay(const Path& path) {
+	if(!_replay.load(path, log()))
+		return false;
+
+	_replaying = true;
+	_recording = false;
+	setNextLevel(_replay.level(), _replay.spawn());
+	return true;
+}
+
 
-	std::ostringstream out;
-	out << argv[0];
-	for(int i = 1; i < argc; ++i)
-		out << " " << argv[i];
-	dbgLogger.info(out.str());
+bool MainState::finishReplay() {
+	_replaying = false;
 
-	auto cmd = _commands.find(argv[0]);
-	if(cmd == _commands.end()) {
-		dbgLogger.warning("Unknown command \"", argv[0], "\"");
-		return -1;
+	if(!_replay.hasEndPosition()) {
+		log().info("Replay finished.");
+		return true;
 	}
-	return cmd->second(this, self, argc, argv);
-}
 
+	Vector2 pos = _world._player.position2();
+	if(pos != _replay.endPosition()) {
+		log().error("Replay diverged: player ends at ", pos.transpose(),
+		            ", expected ", _replay.endPosition().transpose(), ".");
+		return false;
+	}
 
-void MainState::setState(State state, State nextState) {
-	log().info("Change state: ", state, " -> ", nextState);
-	_state = state;
-	_nextState = nextState;
-	_transitionTime = 0;
+	log().info("Replay finished: player trajectory matches the recording.");
+	return true;
 }
 
 
@@ -350,21 +328,20 @@ Game* MainState::game() {
 }
 
 
-LevelSP MainState::registerLevel(const Path& path) {
-	LevelSP level(new Level(this, path));
-	_levelMap.emplace(path, level);
-	level->preload();
-
-	return level;
+void MainState::setNextLevel(const Path& level, const String& spawn) {
+	_world.setNextLevel(level, spawn);
 }
 
 
-void MainState::loadSound(const Path& sound) {
-	loader()->load<SoundLoader>(sound);
+void MainState::loadSound(LoadGraph& graph, const Path& sound) {
+	graph.load<PackedSoundLoader, SoundAspect>(sound);
 }
 
 
 void MainState::playSound(const Path& sound) {
+	if(_headless)
+		return;
+
 	AssetSP asset = assets()->getAsset(sound);
 	auto aspect = asset->aspect<SoundAspect>();
 	aspect->_get().setVolume(0.3);
@@ -372,338 +349,468 @@ void MainState::playSound(const Path& sound) {
 }
 
 
-void MainState::loadMusic(const Path& sound) {
-	loader()->load<MusicLoader>(sound);
+void MainState::loadMusic(LoadGraph& graph, const Path& sound) {
+	graph.load<PackedMusicLoader, MusicAspect>(sound);
 }
 
 
 void MainState::playMusic(const Path& sound) {
+	if(_headless)
+		return;
+
 	AssetSP asset = assets()->getAsset(sound);
 	audio()->setMusicVolume(0.5);
 	audio()->playMusic(assets()->getAsset(sound));
 }
 
 
-void MainState::loadLevel(const Path& level, const String& spawn) {
-	if(_level)
-		_level->stop();
-
-	while(_scene.firstChild().isValid())
-		_scene.firstChild().destroy();
-
-	_level = _levelMap.at(level);
-	_level->initialize();
-
-	Path background = _level->tileMap()->properties().get("background", "background1.png").asString();
-	_sprites.get(_background)->setTexture(background);
-
-	Path tileset = _level->tileMap()->properties().get("tileset", "tileset.png").asString();
-	AssetSP tilesetAsset = assets()->getAsset(tileset);
-	assert(tilesetAsset);
-	ImageAspectSP tilesetImage = assets()->getAspect<ImageAspect>(tilesetAsset);
-	assert(tilesetImage);
-	_level->tileMap()->_setTileSet(tilesetImage);
+unsigned MainState::pressedInputs() const {
+	unsigned inputs = INPUT_NONE;
+	inputs |= _quitInput ->isPressed()? INPUT_QUIT:  0;
+	inputs |= _leftInput ->isPressed()? INPUT_LEFT:  0;
+	inputs |= _rightInput->isPressed()? INPUT_RIGHT: 0;
+	inputs |= _downInput ->isPressed()? INPUT_DOWN:  0;
+	inputs |= _upInput   ->isPressed()? INPUT_UP:    0;
+	inputs |= _jumpInput ->isPressed()? INPUT_JUMP:  0;
+	inputs |= _dashInput ->isPressed()? INPUT_DASH:  0;
+	return inputs;
+}
 
-	EntityRef layer = _entities.findByName("layer_base");
-	auto tileLayer = _tileLayers.get(layer);
-	tileLayer->setBlendingMode(BLEND_ALPHA);
-	tileLayer->setTextureFlags(Texture::BILINEAR_NO_MIPMAP | Texture::CLAMP);
 
-	const Json::Value& props = _level->tileMap()->properties();
-	_playerPhysics->numJumps  = props.get("double_jump", true).asBool()? 1: 0;
-	_playerPhysics->numDashes = props.get("dash", true).asBool()? 1: 0;
-	_playerPhysics->wallJump  = props.get("wall_jump", true).asBool();
+unsigned MainState::readInputs() {
+	if(_replaying) {
+		if(!_replay.atEnd())
+			return _replay.play();
+		finishReplay();
+	}
 
-	_player = _entities.cloneEntity(_playerModel, _scene, "player");
-	CharacterComponent* pChar = _characters.addComponent(_player);
-	pChar->physics = _playerPhysics;
+	unsigned inputs = INPUT_NONE;
+	if(!_headless)
+		inputs = _threaded? _frameInputs.load(): pressedInputs();
 
-	_playerDeath = _entities.cloneEntity(_playerDeathModel, _scene, "player_death");
-	_playerDeath.setEnabled(false);
+	if(_recording)
+		_replay.record(inputs);
 
-	_spawnName = spawn;
-	_level->start(_spawnName);
+	return inputs;
+}
 
-	setState(_nextState);
 
-//	dumpEntityTree(log(), _entities.root());
+bool MainState::isInputPressed(unsigned input) const {
+	return _tickInputs & input;
 }
 
 
-void MainState::setNextLevel(const Path& level, const String& spawn) {
-	_nextLevel = level;
-	_nextLevelSpawn = spawn;
+bool MainState::isInputJustPressed(unsigned input) const {
+	return _tickInputs & ~_prevTickInputs & input;
 }
 
 
-void MainState::changeLevel(const Path& level, const String& spawn) {
-	Path storyScreen = _level->tileMap()->properties().get("end_screen", "").asString();
-	SpriteComponent* fadeSprite = _sprites.get(_fadeOverlay);
-	if(storyScreen.empty()) {
-		fadeSprite->setTexture("white.png");
-		fadeSprite->setColor(Vector4(0, 0, 0, 0));
-		setState(STATE_FADE_OUT, STATE_PLAY);
-	}
-	else{
-		fadeSprite->setTexture(storyScreen);
-		fadeSprite->setColor(Vector4(1, 1, 1, 0));
-		setState(STATE_FADE_OUT, STATE_PAUSE);
-	}
-
-	setNextLevel(level, spawn);
-	playSound("departure.wav");
-}
+void MainState::startGame() {
+	if(_recording)
+		_replay.reset(_world._nextLevel, _world._nextLevelSpawn);
+	if(_replaying)
+		_replay.rewind();
+	_tickInputs     = INPUT_NONE;
+	_prevTickInputs = INPUT_NONE;
 
+	_world.start();
+	updateLevelDisplay();
 
-EntityRef MainState::getEntity(const String& name, const EntityRef& ancestor) {
-	EntityRef entity = _entities.findByName(name, ancestor);
-	if(!entity.isValid()) {
-		log().error("Entity \"", name, "\" not found.");
-	}
-	return entity;
+	//audio()->playMusic(assets()->getAsset("music.ogg"));
+//	audio()->playSound(assets()->getAsset("sound.ogg"), 2);
 }
 
 
-EntityRef MainState::createTrigger(EntityRef parent, const char* name, const AlignedBox2& box) {
-	EntityRef entity = _entities.createEntity(parent, name);
-
-	CollisionComponent* cc = _collisions.addComponent(entity);
-	cc->addShape(Shape2D(box));
-	cc->setHitMask(HIT_PLAYER | HIT_TRIGGER);
-	cc->setIgnoreMask(HIT_TRIGGER);
+void MainState::endGame() {
+	// No end screens without a window.
+	if(_headless) {
+		quit();
+		return;
+	}
 
-	_triggers.addComponent(entity);
+	game()->splashState()->setNextState(nullptr);
+	game()->splashState()->addSplash("story_end.png");
+	game()->splashState()->addSplash("credits.png");
 
-	return entity;
+//	game()->splashState()->setup(nullptr, "credits.png");
+	game()->setNextState(game()->splashState());
+	quit();
 }
 
 
-void MainState::updateTriggers(bool disableCmds) {
-	_triggers.compactArray();
-
-	for(TriggerComponent& tc: _triggers) {
-		if(tc.isEnabled() && tc.entity().isEnabledRec()) {
-			tc.prevInside = tc.inside;
-			tc.inside = false;
-		}
-	}
+// Display-only settings that follow the level loaded by the world.
+void MainState::updateLevelDisplay() {
+	if(_displayedLevel == _world._level.get())
+		return;
+	_displayedLevel = _world._level.get();
 
-	for(HitEvent hit: _collisions.hitEvents()) {
-		if(hit.entities[1] == _player) {
-			std::swap(hit.entities[0], hit.entities[1]);
-		}
+	Path background = _world._level->data().properties().getString("background", "background1.png");
+	_world._sprites.get(_world._background)->setTexture(background);
 
-		if(hit.entities[0] == _player) {
-			TriggerComponent* tc = _triggers.get(hit.entities[1]);
-			if(tc) {
-				tc->inside = true;
-			}
-		}
+	// Also after a hot reload: the tile map may have changed.
+	// With a simulation thread, the render thread follows the snapshots.
+	const CookedLevel& data = _world._level->data();
+	if(!_headless && !_threaded && data.nLayers()) {
+		_tileChunks.setLayer(&_world._sprites, _world._level->baseLayer(),
+		                     data.layer(data.nLayers() - 1), data.width(), data.height());
 	}
-
-	if(!disableCmds) {
-		for(TriggerComponent& tc: _triggers) {
-			if(tc.isEnabled() && tc.entity().isEnabledRec()) {
-				if(!tc.prevInside && tc.inside && !tc.onEnter.empty())
-					exec(tc.onEnter, tc.entity());
-				if(tc.prevInside && !tc.inside && !tc.onExit.empty())
-					exec(tc.onExit, tc.entity());
-			}
-		}
+	if(_gpuTiles && !_threaded && data.nLayers()) {
+		_tileIndices.setTiles(data.layer(data.nLayers() - 1), data.width(), data.height(),
+		                      _world._level->baseLayer().worldTransform().translation());
+		_tileIndices.setTileSet(_world._level->tileSet());
 	}
-}
 
+//	dumpEntityTree(log(), _world._entities.root());
+}
 
-void MainState::killPlayer() {
-	// TODO: animation + sound
-	setState(STATE_DEATH);
-
-	playSound("death.wav");
 
-	_player.setEnabled(false);
-	_characters.get(_player)->reset();
-	_playerDeath.setEnabled(true);
-	_playerDeath.transform() = _player.transform();
-	_sprites.get(_playerDeath)->setTileIndex(0);
+// Hot reload (--hot-reload): levels and entity models saved while the game
+// runs are patched into the world.
+void MainState::watchAssets() {
+	_watcher.watch(game()->dataPath(), log());
+	// Cooked levels are written to the build directory.
+	if(game()->generatedPath() != game()->dataPath())
+		_generatedWatcher.watch(game()->generatedPath(), log());
 }
 
 
-void MainState::startGame() {
-	setState(STATE_PLAY, STATE_FADE_IN);
+void MainState::reloadAssets() {
+	_changedFiles.clear();
+	_watcher.poll(_changedFiles);
+	_generatedWatcher.poll(_changedFiles);
 
-	loadLevel(_nextLevel, _nextLevelSpawn);
-	_nextLevel = Path();
-	_nextLevelSpawn.clear();
+	for(const Path& file: _changedFiles) {
+		int64 startTime = int64(sys()->getTimeNs());
 
-	//audio()->playMusic(assets()->getAsset("music.ogg"));
-//	audio()->playSound(assets()->getAsset("sound.ogg"), 2);
+		bool reloaded = (file == Path("entities.ldl"))?
+		                    _world.reloadModels():
+		                    _world.reloadLevel(file);
+		if(reloaded) {
+			log().info("Reloaded \"", file, "\" in ",
+			           (int64(sys()->getTimeNs()) - startTime) / 1000, " us");
+			_displayedLevel = nullptr;
+		}
+	}
 }
 
 
 void MainState::updateTick() {
 	loader()->finalizePending();
 
-	if(_state == STATE_PLAY && !_nextLevel.empty()) {
-		loadLevel(_nextLevel, _nextLevelSpawn);
-		_nextLevel = Path();
-		_nextLevelSpawn.clear();
-	}
+	if(_watcher.isWatching())
+		reloadAssets();
 
-	_inputs.sync();
+	// Headless runs have no keyboard: inputs stay released. With a
+	// simulation thread, the render thread samples them (see syncInputs()).
+	if(!_headless && !_threaded)
+		_inputs.sync();
 
-	_entities.setPrevWorldTransforms();
+	_prevTickInputs = _tickInputs;
+	_tickInputs     = readInputs();
 
-	if(_quitInput->justPressed()) {
+	if(isInputJustPressed(INPUT_QUIT)) {
 		quit();
 	}
 
-	if(_state == STATE_PLAY) {
-		// Player input
-		CharacterComponent* pChar = _characters.get(_player);
-		if(_leftInput->isPressed())
-			pChar->pressMove(DIR_LEFT);
-		if(_rightInput->isPressed())
-			pChar->pressMove(DIR_RIGHT);
-		if(_downInput->isPressed())
-			pChar->pressMove(DIR_DOWN);
-		if(_upInput->isPressed())
-			pChar->pressMove(DIR_UP);
-		pChar->pressJump(_jumpInput->isPressed());
-		pChar->pressDash(_dashInput->justPressed());
-
-		// Update components
-		_characters.updatePhysics();
-
-		_entities.updateWorldTransforms();
-		_collisions.findCollisions();
-	//	for(const HitEvent& hit: _collisions.hitEvents()) {
-	//		log().info(_loop.tickCount(), ": hit ", hit.entities[0].name(),
-	//		        ", ", hit.entities[1].name(), ", ", hit.penetration.transpose());
-	//	}
-
-		_characters.processCollisions();
-		updateTriggers();
+	_world.updateTick(_tickInputs);
+	updateLevelDisplay();
+	if(!_headless)
+		updateOverlay();
+
+	if(_world._gameOver) {
+		_world._gameOver = false;
+		endGame();
 	}
-	else if(_state == STATE_DEATH) {
-		_transitionTime += TICK_LENGTH_IN_SEC;
-		int index = _transitionTime * 6;
+}
+
 
-		SpriteComponent* sprite = _sprites.get(_playerDeath);
-		if(index < sprite->tileGridSize().prod()) {
-			sprite->setTileIndex(index);
+// The fade overlay follows the state of the world: it changes with ticks.
+void MainState::updateOverlay() {
+	if(_world._state == STATE_FADE_IN || _world._state == STATE_FADE_OUT || _world._state == STATE_PAUSE) {
+		SpriteComponent* fadeSprite = _world._sprites.get(_world._fadeOverlay);
+		if(_overlayTexture != _world._overlayTexture) {
+			game()->atlas().setTexture(fadeSprite, _world._overlayTexture);
+			_overlayTexture = _world._overlayTexture;
 		}
-		else {
-			setState(STATE_PLAY);
-			_player.setEnabled(true);
-			_playerDeath.setEnabled(false);
-			_level->spawnPlayer(_spawnName);
+
+		Vector2 screenSize(1920, 1080);
+		_world._fadeOverlay.setEnabled(true);
+		Vector2 overlaySize = spriteSize(*fadeSprite);
+		_world._fadeOverlay.transform()(0, 0) = screenSize(0) / overlaySize(0);
+		_world._fadeOverlay.transform()(1, 1) = screenSize(1) / overlaySize(1);
+
+		Vector4 color = _world._overlayColor;
+		if(_world._state == STATE_PAUSE) {
+			color(3) = 1;
 		}
-	}
-	else if(_state == STATE_FADE_IN || _state == STATE_FADE_OUT) {
-		_transitionTime += TICK_LENGTH_IN_SEC;
-		if(_transitionTime > FADE_DURATION) {
-			if(!_nextLevel.empty()) {
-				loadLevel(_nextLevel, _nextLevelSpawn);
-				_nextLevel = Path();
-				_nextLevelSpawn.clear();
-			}
-			else {
-				setState(_nextState);
-			}
+		else {
+			color(3) = _world._transitionTime / FADE_DURATION;
+			if(_world._state == STATE_FADE_IN)
+				color(3) = 1 - color(3);
 		}
+
+		fadeSprite->setColor(color);
 	}
-	else if(_state == STATE_PAUSE) {
-		if(_jumpInput->isPressed()) {
-			setState(STATE_FADE_IN);
-			playSound("arrival.wav");
-		}
+	else {
+		_world._fadeOverlay.setEnabled(false);
 	}
-
-	_entities.updateWorldTransforms();
 }
 
 
 void MainState::updateFrame() {
 	// Update camera
 
-	Vector3 h(960, 540, .5);
-	Vector2 min = h.head<2>();
-	Vector2 max(_level->tileMap()->width(0)  * TILE_SIZE - h(0),
-	            _level->tileMap()->height(0) * TILE_SIZE - h(1));
-	Vector3 c;
-	c << _player.interpPosition2(_loop.frameInterp()), .5;
-	c(0) = clamp(c(0), min(0), max(0));
-	c(1) = clamp(c(1), min(1), max(1));
-	Box3 viewBox(c - h, c + h);
+	const CookedLevel& data = _world._level->data();
+	Box3 viewBox = cameraView(_world._player.interpPosition2(_loop.frameInterp()),
+	                          data.width(), data.height());
 	_camera.setViewBox(viewBox);
 
 	// Update background
 
-	_background.placeAt(Vector2(viewBox.min().head<2>()));
+	_world._background.placeAt(Vector2(viewBox.min().head<2>()));
 
-	SpriteComponent* bgSprite = _sprites.get(_background);
-	Vector2 screenSize(1920, 1080);
+	SpriteComponent* bgSprite = _world._sprites.get(_world._background);
 	Vector2 bgSize(bgSprite->texture()->get().width(),
 	               bgSprite->texture()->get().height());
-	Vector2 b = (c.head<2>() - min) / 2;
-	b(1) = screenSize(1) / 2 - b(1);
-	Box2 bgView(b, b + screenSize);
-	bgView = Box2(bgView.min().cwiseQuotient(bgSize),
-	              bgView.max().cwiseQuotient(bgSize));
-	bgSprite->setView(bgView);
+	bgSprite->setView(backgroundView(viewBox, bgSize));
 
 	// Update GUI
 
-	_gui.placeAt(Vector2(viewBox.min().head<2>()));
+	_world._gui.placeAt(Vector2(viewBox.min().head<2>()));
 
-	if(_state == STATE_FADE_IN || _state == STATE_FADE_OUT || _state == STATE_PAUSE) {
-		SpriteComponent* fadeSprite = _sprites.get(_fadeOverlay);
+	// Rendering
+	Context* glc = renderer()->context();
 
-		_fadeOverlay.setEnabled(true);
-		_fadeOverlay.transform()(0, 0) = screenSize(0) / fadeSprite->texture()->get().width();
-		_fadeOverlay.transform()(1, 1) = screenSize(1) / fadeSprite->texture()->get().height();
+	_world._texts.createTextures();
+	renderer()->uploadPendingTextures();
 
-		Vector4 color = fadeSprite->color();
-		if(_state == STATE_PAUSE) {
-			color(3) = 1;
+	glc->clear(gl::COLOR_BUFFER_BIT | gl::DEPTH_BUFFER_BIT);
+
+	_mainPass->clear();
+	_spriteRenderer->clear();
+
+	EntityRef root = _world._entities.root();
+	_spriteBatcher.render(root, _loop.frameInterp(), _camera);
+	_world._texts.render(root, _loop.frameInterp(), _camera);
+	bool gpuTiles = _gpuTiles && _tileIndices.isReady();
+	if(!gpuTiles)
+		_tileChunks.render(_camera);
+
+	presentFrame(gpuTiles);
+}
+
+
+// Ticks at TICKS_PER_SEC whatever the frames do. After a long stall (e.g. a
+// breakpoint), skips the late ticks instead of running them in a burst.
+void MainState::runSimulation() {
+	const int64 tickDuration = ONE_SEC / TICKS_PER_SEC;
+	int64    nextTick  = int64(sys()->getTimeNs());
+	int64    statsTime = nextTick;
+	int64    maxLate   = 0;
+	unsigned nTicks    = 0;
+
+	while(_running) {
+		int64 now = int64(sys()->getTimeNs());
+		if(now < nextTick) {
+			std::this_thread::sleep_for(std::chrono::nanoseconds(nextTick - now));
+			continue;
 		}
-		else {
-			color(3) = _transitionTime / FADE_DURATION;
-			if(_state == STATE_FADE_IN)
-				color(3) = 1 - color(3);
+		maxLate = std::max(maxLate, now - nextTick);
+
+		{
+			std::lock_guard<std::mutex> lock(_simMutex);
+			updateTick();
+			publishSnapshot();
 		}
 
-		fadeSprite->setColor(color);
+		nextTick += tickDuration;
+		if(now - nextTick > 4 * tickDuration)
+			nextTick = now;
+
+		++nTicks;
+		if(nTicks == TICKS_PER_SEC) {
+			log().info("Ticks: ", nTicks * float(ONE_SEC) / (now - statsTime),
+			           "/s, max late: ", maxLate / 1000, " us");
+			statsTime = now;
+			maxLate   = 0;
+			nTicks    = 0;
+		}
 	}
-	else {
-		_fadeOverlay.setEnabled(false);
+}
+
+
+// Window events belong to this thread, ticks read what it sampled last.
+void MainState::syncInputs() {
+	_inputs.sync();
+	_frameInputs = pressedInputs();
+}
+
+
+// Called by ticks, with _simMutex locked. Textures (the tileset too) are
+// uploaded by the render thread.
+void MainState::publishSnapshot() {
+	RenderSnapshot& snapshot = _snapshots.writeBuffer();
+	snapshot.time = int64(sys()->getTimeNs());
+
+	Level* level = _world._level.get();
+	const CookedLevel& data = level->data();
+	EntityRef baseLayer = level->baseLayer();
+	SpriteComponent* tileSet = baseLayer.isValid()? _world._sprites.get(baseLayer): nullptr;
+
+	if(level != _publishedLevel || level->revision() != _publishedRevision) {
+		_publishedLevel    = level;
+		_publishedRevision = level->revision();
+		_publishedTiles.reset();
+		if(data.nLayers()) {
+			const uint16* tiles = data.layer(data.nLayers() - 1);
+			_publishedTiles = std::make_shared<std::vector<uint16>>(
+			        tiles, tiles + data.width() * data.height());
+		}
 	}
 
-	// Rendering
-	Context* glc = renderer()->context();
+	snapshot.level       = level;
+	snapshot.levelWidth  = data.width();
+	snapshot.levelHeight = data.height();
+	snapshot.tiles       = _publishedTiles;
+	snapshot.tileOffset  = baseLayer.isValid()? Vector3(baseLayer.worldTransform().translation()):
+	                                            Vector3(Vector3::Zero());
+	snapshot.tileLayer   = TileLayerChunks::states(tileSet, baseLayer);
+	if(_gpuTiles)
+		snapshot.tileSet = level->tileSet();
+
+	snapshot.prevCameraTarget = _world._player.interpPosition2(0);
+	snapshot.cameraTarget     = _world._player.interpPosition2(1);
+
+	_spriteBatcher.collect(_world._background, snapshot.sprites);
+	snapshot.backgroundSprite = !snapshot.sprites.empty()
+	                         && _world._sprites.get(_world._background);
+
+	EntityRef child = _world._entities.root().firstChild();
+	while(child.isValid()) {
+		if(child != _world._background && child != _world._gui)
+			_spriteBatcher.collect(child, snapshot.sprites);
+		child = child.nextSibling();
+	}
 
-	_texts.createTextures();
-	_tileLayers.createTextures();
-	renderer()->uploadPendingTextures();
+	snapshot.guiBegin = snapshot.sprites.size();
+	_spriteBatcher.collect(_world._gui, snapshot.sprites);
+	Vector2 guiPos = _world._gui.worldTransform().translation().head<2>();
+	for(unsigned si = snapshot.guiBegin; si < snapshot.sprites.size(); ++si) {
+		snapshot.sprites[si].prevTransform.block<2, 1>(0, 3) -= guiPos;
+		snapshot.sprites[si].transform    .block<2, 1>(0, 3) -= guiPos;
+	}
+
+	_snapshots.publish();
+}
+
+
+void MainState::renderSnapshot() {
+	const RenderSnapshot& snapshot = _snapshots.acquire();
+	if(!snapshot.level)
+		return;
+
+	// As with InterpLoop, frames lag a tick behind: they go from the
+	// previous tick, when the snapshot is published, to its own tick.
+	int64 now = int64(sys()->getTimeNs());
+	float interp = clamp(float(now - snapshot.time) * TICKS_PER_SEC / ONE_SEC, 0.f, 1.f);
+
+	// Also after a hot reload of the level.
+	if(snapshot.level != _renderedLevel || snapshot.tiles != _renderedTiles) {
+		_renderedLevel = snapshot.level;
+		_renderedTiles = snapshot.tiles;
+		const uint16* tiles = _renderedTiles? _renderedTiles->data(): nullptr;
+		_tileChunks.setLayer(tiles, snapshot.levelWidth, snapshot.levelHeight,
+		                     snapshot.tileOffset);
+		if(_gpuTiles && tiles && snapshot.tileSet) {
+			_tileIndices.setTiles(tiles, snapshot.levelWidth, snapshot.levelHeight,
+			                      snapshot.tileOffset);
+			_tileIndices.setTileSet(snapshot.tileSet);
+		}
+	}
+
+	Vector2 target = (1 - interp) * snapshot.prevCameraTarget + interp * snapshot.cameraTarget;
+	Box3 viewBox = cameraView(target, snapshot.levelWidth, snapshot.levelHeight);
+	_camera.setViewBox(viewBox);
+
+	// The background and the GUI follow the camera.
+	Vector2 viewMin = viewBox.min().head<2>();
+	_frameSprites = snapshot.sprites;
+	if(snapshot.backgroundSprite) {
+		SpriteInstance& bg = _frameSprites.front();
+		bg.view = backgroundView(viewBox, bg.textureSize);
+		bg.prevTransform.block<2, 1>(0, 3) = viewMin;
+		bg.transform    .block<2, 1>(0, 3) = viewMin;
+	}
+	for(unsigned si = snapshot.guiBegin; si < _frameSprites.size(); ++si) {
+		_frameSprites[si].prevTransform.block<2, 1>(0, 3) += viewMin;
+		_frameSprites[si].transform    .block<2, 1>(0, 3) += viewMin;
+	}
+
+	// Waits for the tick in progress, if any.
+	{
+		std::lock_guard<std::mutex> lock(_simMutex);
+		game()->textures()->releaseEvicted();
+		renderer()->uploadPendingTextures();
+	}
 
+	Context* glc = renderer()->context();
 	glc->clear(gl::COLOR_BUFFER_BIT | gl::DEPTH_BUFFER_BIT);
 
-	_mainPass.clear();
-	_spriteRenderer.clear();
+	_mainPass->clear();
+	_spriteRenderer->clear();
+
+	_spriteBatcher.render(_frameSprites, interp, _camera);
+	bool gpuTiles = _gpuTiles && _tileIndices.isReady();
+	if(!gpuTiles)
+		_tileChunks.render(_camera, snapshot.tileLayer);
+
+	presentFrame(gpuTiles);
+}
+
+
+// Centered on target, but kept inside the level.
+Box3 MainState::cameraView(const Vector2& target, unsigned levelWidth,
+                           unsigned levelHeight) const {
+	Vector3 h(960, 540, .5);
+	Vector2 min = h.head<2>();
+	Vector2 max(levelWidth  * TILE_SIZE - h(0),
+	            levelHeight * TILE_SIZE - h(1));
+	Vector3 c;
+	c << target, .5;
+	c(0) = clamp(c(0), min(0), max(0));
+	c(1) = clamp(c(1), min(1), max(1));
+	return Box3(c - h, c + h);
+}
+
+
+// The background scrolls at half the speed of the camera.
+Box2 MainState::backgroundView(const Box3& viewBox, const Vector2& bgSize) const {
+	Vector2 screenSize(1920, 1080);
+	Vector2 b = (viewBox.center().head<2>() - screenSize / 2) / 2;
+	b(1) = screenSize(1) / 2 - b(1);
+	Box2 bgView(b, b + screenSize);
+	return Box2(bgView.min().cwiseQuotient(bgSize),
+	            bgView.max().cwiseQuotient(bgSize));
+}
 
-	_sprites.render(_entities.root(), _loop.frameInterp(), _camera);
-	_texts.render(_entities.root(), _loop.frameInterp(), _camera);
-	_tileLayers.render(_entities.root(), _loop.frameInterp(), _camera);
 
-	_mainPass.render();
+// Draws what the frame submitted, then the GPU tiles, over the sprites.
+void MainState::presentFrame(bool gpuTiles) {
+	_nDrawCalls = _spriteBatcher.nDrawCalls()
+	            + ((gpuTiles || _tileChunks.nDrawnTiles())? 1: 0);
+
+	_mainPass->render();
+	if(gpuTiles)
+		_tileIndices.render(_camera);
 
 	window()->swapBuffers();
-	glc->setLogCalls(false);
+	renderer()->context()->setLogCalls(false);
 
 	int64 now = int64(sys()->getTimeNs());
 	++_fpsCount;
 	if(_fpsCount == 60) {
-		log().info("Fps: ", _fpsCount * float(ONE_SEC) / (now - _fpsTime));
+		log().info("Fps: ", _fpsCount * float(ONE_SEC) / (now - _fpsTime),
+		           ", draw calls: ", _nDrawCalls, " (", _spriteBatcher.nSprites(), " sprites)");
 		_fpsTime  = now;
 		_fpsCount = 0;
 	}
@@ -716,24 +823,3 @@ void MainState::resizeEvent() {
 	                     window()->height(), 1));
 	_camera.setViewBox(viewBox);
 }
-
-
-bool MainState::loadEntities(const Path& path, EntityRef parent, const Path& cd) {
-	Path localPath = makeAbsolute(cd, path);
-	log().info("Load entity \"", localPath, "\"");
-
-	Path realPath = game()->dataPath() / localPath;
-	Path::IStream in(realPath.native().c_str());
-	if(!in.good()) {
-		log().error("Unable to read \"", localPath, "\".");
-		return false;
-	}
-	ErrorList errors;
-	LdlParser parser(&in, localPath.utf8String(), &errors, LdlParser::CTX_MAP);
-
-	bool success = _entities.loadEntitiesFromLdl(parser, parent);
-
-	errors.log(log());
-
-	return success;
-}
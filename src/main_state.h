@@ -23,6 +23,11 @@
 #define LD39_MAIN_STATE_H_
 
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
 #include <lair/core/signal.h>
 
 #include <lair/utils/game_state.h>
@@ -34,13 +39,16 @@
 #include <lair/render_gl2/render_pass.h>
 
 #include <lair/ec/entity.h>
-#include <lair/ec/entity_manager.h>
-#include <lair/ec/collision_component.h>
 #include <lair/ec/sprite_component.h>
-#include <lair/ec/bitmap_text_component.h>
-#include <lair/ec/tile_layer_component.h>
 
-#include "components.h"
+#include "file_watcher.h"
+#include "load_graph.h"
+#include "render_snapshot.h"
+#include "sprite_batcher.h"
+#include "tile_index_renderer.h"
+#include "tile_layer_chunks.h"
+#include "world.h"
+#include "replay.h"
 
 
 using namespace lair;
@@ -48,36 +56,6 @@ using namespace lair;
 
 class Game;
 class Level;
-class MainState;
-
-typedef std::shared_ptr<Level> LevelSP;
-typedef std::unordered_map<Path, LevelSP, boost::hash<Path>> LevelMap;
-
-enum {
-	TICKS_PER_SEC  = 60,
-	FRAMES_PER_SEC = 60,
-};
-
-extern const float TICK_LENGTH_IN_SEC;
-extern const float FADE_DURATION;
-
-typedef int (*Command)(MainState* state, EntityRef self, int argc, const char** argv);
-typedef std::unordered_map<std::string, Command> CommandMap;
-
-struct CommandExpr {
-	String    command;
-	EntityRef self;
-};
-typedef std::deque<CommandExpr> CommandList;
-
-
-enum State {
-	STATE_PLAY,
-	STATE_DEATH,
-	STATE_FADE_IN,
-	STATE_FADE_OUT,
-	STATE_PAUSE,
-};
 
 
 class MainState : public GameState {
@@ -91,70 +69,76 @@ public:
 	virtual void run();
 	virtual void quit();
 
-	Game* game();
+	bool runHeadless(unsigned nTicks);
+
+	void useGpuTiles();
+	void useSimThread();
 
-	void exec(const std::string& cmd, EntityRef self = EntityRef());
-	void exec(const CommandList& commands);
-	void execNext();
-	int execSingle(const std::string& cmd, EntityRef self = EntityRef());
-	int exec(int argc, const char** argv, EntityRef self = EntityRef());
+	void recordReplay(const Path& path);
+	bool playReplay(const Path& path);
+	bool finishReplay();
 
-	void setState(State state, State nextState = STATE_PLAY);
+	Game* game();
 
-	LevelSP registerLevel(const Path& level);
-	void loadLevel(const Path& level, const String& spawn = "spawn");
 	void setNextLevel(const Path& level, const String& spawn = "spawn");
-	void changeLevel(const Path& level, const String& spawn = "spawn");
 
-	void loadSound(const Path& sound);
+	void loadSound(LoadGraph& graph, const Path& sound);
 	void playSound(const Path& sound);
-	void loadMusic(const Path& sound);
+	void loadMusic(LoadGraph& graph, const Path& sound);
 	void playMusic(const Path& music);
 
-	EntityRef getEntity(const String& name, const EntityRef& ancestor = EntityRef());
-	EntityRef createTrigger(EntityRef parent, const char* name, const AlignedBox2& box);
-
-	void updateTriggers(bool disableCmds = false);
-
-	void killPlayer();
+	unsigned pressedInputs() const;
+	unsigned readInputs();
+	bool isInputPressed(unsigned input) const;
+	bool isInputJustPressed(unsigned input) const;
 
 	void startGame();
+	void endGame();
+	void updateLevelDisplay();
+	void watchAssets();
+	void reloadAssets();
 	void updateTick();
+	void updateOverlay();
 	void updateFrame();
 
-	void resizeEvent();
+	void runSimulation();
+	void syncInputs();
+	void publishSnapshot();
+	void renderSnapshot();
 
-	bool loadEntities(const Path& path, EntityRef parent = EntityRef(),
-	                  const Path& cd = Path());
+	Box3 cameraView(const Vector2& target, unsigned levelWidth, unsigned levelHeight) const;
+	Box2 backgroundView(const Box3& viewBox, const Vector2& bgSize) const;
+	void presentFrame(bool gpuTiles);
+
+	void resizeEvent();
 
 public:
 	// More or less system stuff
 
-	RenderPass                 _mainPass;
-
-	EntityManager              _entities;
-	SpriteRenderer             _spriteRenderer;
-	SpriteComponentManager     _sprites;
-	CollisionComponentManager  _collisions;
-	TriggerComponentManager    _triggers;
-	CharacterComponentManager  _characters;
-	BitmapTextComponentManager _texts;
-	TileLayerComponentManager  _tileLayers;
-//	AnimationComponentManager  _anims;
+	// Not created when headless: there is no renderer.
+	std::unique_ptr<RenderPass>     _mainPass;
+	std::unique_ptr<SpriteRenderer> _spriteRenderer;
 	InputManager               _inputs;
 
+	TileLayerChunks            _tileChunks;
+	TileIndexRenderer          _tileIndices;
+	bool                       _gpuTiles;
+
+	World                      _world;
+	SpriteBatcher              _spriteBatcher;
+
 	SlotTracker _slotTracker;
 
 	OrthographicCamera _camera;
 
 	bool        _initialized;
-	bool        _running;
+	bool        _headless;
+	std::atomic<bool> _running;
 	InterpLoop  _loop;
 	int64       _fpsTime;
 	unsigned    _fpsCount;
-
-	CommandMap  _commands;
-	CommandList _commandList;
+	// Submitted to _mainPass by the last frame, bitmap texts excepted.
+	unsigned    _nDrawCalls;
 
 	Input*      _quitInput;
 	Input*      _leftInput;
@@ -164,32 +148,35 @@ public:
 	Input*      _jumpInput;
 	Input*      _dashInput;
 
-	State    _state;
-	State    _nextState;
-	float    _transitionTime;
-
-	LevelMap _levelMap;
-	LevelSP  _level;
-	String   _spawnName;
-	Path     _nextLevel;
-	String   _nextLevelSpawn;
-
-	EntityRef   _models;
-
-	EntityRef   _playerModel;
-	float       _baseMaxSpeed;
-	CharPhysicsParamsSP _playerPhysics;
-	EntityRef   _playerDeathModel;
-
-	EntityRef   _tileLayer;
-
-	EntityRef   _background;
-	EntityRef   _scene;
-	EntityRef   _player;
-	EntityRef   _playerDeath;
-
-	EntityRef   _gui;
-	EntityRef   _fadeOverlay;
+	unsigned    _tickInputs;
+	unsigned    _prevTickInputs;
+	Replay      _replay;
+	Path        _replayPath;
+	bool        _recording;
+	bool        _replaying;
+
+	Level*      _displayedLevel;
+	Path        _overlayTexture;
+
+	FileWatcher       _watcher;
+	FileWatcher       _generatedWatcher;
+	std::vector<Path> _changedFiles;
+
+	// --sim-thread: ticks run on _simulation with _simMutex locked, frames
+	// draw the snapshots they publish.
+	bool                  _threaded;
+	std::thread           _simulation;
+	std::mutex            _simMutex;
+	std::atomic<unsigned> _frameInputs;
+	RenderSnapshotBuffer  _snapshots;
+	SpriteInstanceVector  _frameSprites;
+	const Level*          _renderedLevel;
+	SharedTiles           _renderedTiles;   // Drawn by _tileChunks and _tileIndices.
+
+	// Copied again when the level or its revision change.
+	SharedTiles           _publishedTiles;
+	const Level*          _publishedLevel;
+	unsigned              _publishedRevision;
 };
 
 
@@ -0,0 +1,108 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <fstream>
+#include <iterator>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mapped_file.h"
+
+
+MappedFile::MappedFile()
+	: _map(nullptr)
+	, _data(nullptr)
+	, _size(0)
+{
+}
+
+
+MappedFile::MappedFile(MappedFile&& other)
+	: MappedFile()
+{
+	*this = std::move(other);
+}
+
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+
+MappedFile& MappedFile::operator=(MappedFile&& other) {
+	if(this != &other) {
+		close();
+		std::swap(_map,    other._map);
+		std::swap(_buffer, other._buffer);
+		std::swap(_data,   other._data);
+		std::swap(_size,   other._size);
+	}
+	return *this;
+}
+
+
+bool MappedFile::open(const Path& path) {
+	close();
+
+#ifndef _WIN32
+	int fd = ::open(path.utf8CStr(), O_RDONLY);
+	if(fd < 0)
+		return false;
+
+	struct stat st;
+	if(fstat(fd, &st) == 0 && st.st_size > 0) {
+		_map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(_map == MAP_FAILED)
+			_map = nullptr;
+		else
+			_size = st.st_size;
+	}
+	::close(fd);
+
+	_data = static_cast<const uint8*>(_map);
+#else
+	Path::IStream in(path.native().c_str(), std::ios::binary);
+	if(!in.good())
+		return false;
+	_buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	_data = _buffer.empty()? nullptr: _buffer.data();
+	_size = _buffer.size();
+#endif
+
+	return _data;
+}
+
+
+void MappedFile::close() {
+#ifndef _WIN32
+	if(_map)
+		munmap(_map, _size);
+#endif
+	_map  = nullptr;
+	_buffer.clear();
+	_data = nullptr;
+	_size = 0;
+}
@@ -0,0 +1,63 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef LD39_MAPPED_FILE_H_
+#define LD39_MAPPED_FILE_H_
+
+
+#include <vector>
+
+#include <lair/core/lair.h>
+#include <lair/core/path.h>
+
+
+using namespace lair;
+
+
+// A read-only file mapped in memory. On Windows the file is read in a
+// buffer instead.
+class MappedFile {
+public:
+	MappedFile();
+	MappedFile(const MappedFile&)  = delete;
+	MappedFile(      MappedFile&& other);
+	~MappedFile();
+
+	MappedFile& operator=(const MappedFile&)  = delete;
+	MappedFile& operator=(      MappedFile&& other);
+
+	bool open(const Path& path);
+	void close();
+
+	inline bool         isOpen() const { return _data; }
+	inline const uint8* data()   const { return _data; }
+	inline size_t       size()   const { return _size; }
+
+protected:
+	void*               _map;
+	std::vector<uint8>  _buffer;
+
+	const uint8*        _data;
+	size_t              _size;
+};
+
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+// Packs assets into a single file, see asset_pack.h. Used by the
+// asset_pack target. Assets are looked up in each directory of <dirs>
+// (separated by ';') in turn, paths in the pack are relative to it.
+//
+// Usage: pack_assets [--lz4] <pack.ldpk> <dirs> <asset>...
+
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+
+#include "asset_pack.h"
+
+
+int main(int argc, char** argv) {
+	int  ai       = 1;
+	bool compress = false;
+	if(ai < argc && std::strcmp(argv[ai], "--lz4") == 0) {
+		compress = true;
+		ai += 1;
+	}
+	if(argc - ai < 3) {
+		std::cerr << "Usage: " << argv[0] << " [--lz4] <pack.ldpk> <dirs> <asset>...\n";
+		return EXIT_FAILURE;
+	}
+	const char* packPath = argv[ai++];
+
+	std::vector<std::string> dirs;
+	std::stringstream dirList(argv[ai++]);
+	std::string dir;
+	while(std::getline(dirList, dir, ';'))
+		dirs.push_back(dir);
+
+#ifndef LD39_LZ4
+	if(compress)
+		dbgLogger.warning("Built without LZ4, assets are stored uncompressed");
+#endif
+
+	AssetPackWriter writer;
+	for(; ai < argc; ++ai) {
+		std::ifstream in;
+		for(unsigned di = 0; di < dirs.size() && !in.is_open(); ++di)
+			in.open(dirs[di] + "/" + argv[ai], std::ios::binary);
+		if(!in.is_open() || !in.good()) {
+			dbgLogger.error(argv[ai], ": Failed to read asset");
+			return EXIT_FAILURE;
+		}
+		std::vector<uint8> data((std::istreambuf_iterator<char>(in)),
+		                        std::istreambuf_iterator<char>());
+		writer.addAsset(argv[ai], data, compress);
+	}
+
+	std::vector<uint8> buffer;
+	writer.write(buffer);
+
+	std::ofstream out(packPath, std::ios::binary);
+	out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+	if(!out.good()) {
+		dbgLogger.error(packPath, ": Failed to write asset pack");
+		return EXIT_FAILURE;
+	}
+
+	dbgLogger.info(packPath, ": ", buffer.size(), " bytes");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,264 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+// Packs images into an atlas (png) and writes the manifest (json) that
+// maps their paths to regions of the atlas, see texture_atlas.h. Used by
+// the atlases target. Image paths are relative to <dir>. The manifest
+// refers to the atlas as <atlas.png>, or as PATH with --texture (relative
+// to the data directory, which the atlas may be outside of).
+//
+// Usage: pack_atlas [--max-size N] [--texture PATH] <dir> <atlas.png> <manifest.json> <image>...
+//
+// Fails if the atlas does not fit in N x N pixels (2048 by default, the
+// texture size every GL 2 implementation supports).
+
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <png.h>
+
+#include <lair/core/lair.h>
+#include <lair/core/json.h>
+#include <lair/core/log.h>
+
+
+using namespace lair;
+
+
+// Around each image, filled with its border pixels so that bilinear
+// filtering does not pick the neighbours.
+static const unsigned PADDING = 2;
+
+
+struct RgbaImage {
+	std::string        path;
+	unsigned           width  = 0;
+	unsigned           height = 0;
+	std::vector<uint8> pixels;  // RGBA, top row first.
+	unsigned           x = 0;   // In the atlas, padding excluded.
+	unsigned           y = 0;
+};
+
+
+static bool readPng(const std::string& path, RgbaImage& image) {
+	FILE* file = std::fopen(path.c_str(), "rb");
+	if(!file)
+		return false;
+
+	png_structp png  = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+	png_infop   info = png ? png_create_info_struct(png): nullptr;
+	if(!info || setjmp(png_jmpbuf(png))) {
+		png_destroy_read_struct(&png, &info, nullptr);
+		std::fclose(file);
+		return false;
+	}
+
+	png_init_io(png, file);
+	png_read_info(png, info);
+
+	// Whatever the format, read 8-bit RGBA.
+	png_byte colorType = png_get_color_type(png, info);
+	if(png_get_bit_depth(png, info) == 16)
+		png_set_strip_16(png);
+	if(colorType == PNG_COLOR_TYPE_PALETTE)
+		png_set_palette_to_rgb(png);
+	if(colorType == PNG_COLOR_TYPE_GRAY || colorType == PNG_COLOR_TYPE_GRAY_ALPHA)
+		png_set_gray_to_rgb(png);
+	if(png_get_valid(png, info, PNG_INFO_tRNS))
+		png_set_tRNS_to_alpha(png);
+	if(!(colorType & PNG_COLOR_MASK_ALPHA))
+		png_set_filler(png, 0xff, PNG_FILLER_AFTER);
+	png_set_expand_gray_1_2_4_to_8(png);
+	png_read_update_info(png, info);
+
+	image.width  = png_get_image_width(png, info);
+	image.height = png_get_image_height(png, info);
+	image.pixels.resize(size_t(image.width) * image.height * 4);
+
+	std::vector<png_bytep> rows(image.height);
+	for(unsigned y = 0; y < image.height; ++y)
+		rows[y] = &image.pixels[size_t(y) * image.width * 4];
+	png_read_image(png, rows.data());
+
+	png_destroy_read_struct(&png, &info, nullptr);
+	std::fclose(file);
+	return true;
+}
+
+
+static bool writePng(const std::string& path, unsigned width, unsigned height,
+                     const std::vector<uint8>& pixels) {
+	FILE* file = std::fopen(path.c_str(), "wb");
+	if(!file)
+		return false;
+
+	png_structp png  = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+	png_infop   info = png ? png_create_info_struct(png): nullptr;
+	if(!info || setjmp(png_jmpbuf(png))) {
+		png_destroy_write_struct(&png, &info);
+		std::fclose(file);
+		return false;
+	}
+
+	png_init_io(png, file);
+	png_set_IHDR(png, info, width, height, 8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE,
+	             PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(png, info);
+	for(unsigned y = 0; y < height; ++y)
+		png_write_row(png, &pixels[size_t(y) * width * 4]);
+	png_write_end(png, nullptr);
+
+	png_destroy_write_struct(&png, &info);
+	return std::fclose(file) == 0;
+}
+
+
+// Shelf packing, tallest images first. Returns the atlas height.
+static unsigned pack(std::vector<RgbaImage>& images, unsigned width) {
+	std::vector<RgbaImage*> order;
+	for(RgbaImage& image: images)
+		order.push_back(&image);
+	std::stable_sort(order.begin(), order.end(), [](const RgbaImage* i0, const RgbaImage* i1) {
+		return i0->height > i1->height;
+	});
+
+	unsigned x = 0;
+	unsigned y = 0;
+	unsigned shelfHeight = 0;
+	for(RgbaImage* image: order) {
+		unsigned w = image->width  + 2 * PADDING;
+		unsigned h = image->height + 2 * PADDING;
+		if(x + w > width) {
+			x = 0;
+			y += shelfHeight;
+			shelfHeight = 0;
+		}
+		image->x = x + PADDING;
+		image->y = y + PADDING;
+		x += w;
+		shelfHeight = std::max(shelfHeight, h);
+	}
+	return y + shelfHeight;
+}
+
+
+static void blit(const RgbaImage& image, unsigned width, std::vector<uint8>& atlas) {
+	int p = PADDING;
+	for(int y = -p; y < int(image.height) + p; ++y) {
+		int sy = std::min(std::max(y, 0), int(image.height) - 1);
+		for(int x = -p; x < int(image.width) + p; ++x) {
+			int sx = std::min(std::max(x, 0), int(image.width) - 1);
+			const uint8* src = &image.pixels[(size_t(sy) * image.width + sx) * 4];
+			uint8* dst = &atlas[(size_t(image.y + y) * width + image.x + x) * 4];
+			std::copy(src, src + 4, dst);
+		}
+	}
+}
+
+
+int main(int argc, char** argv) {
+	int      ai       = 1;
+	unsigned maxSize = 2048;
+	std::string texture;
+	while(ai + 1 < argc) {
+		if(std::strcmp(argv[ai], "--max-size") == 0)
+			maxSize = std::strtoul(argv[ai + 1], nullptr, 10);
+		else if(std::strcmp(argv[ai], "--texture") == 0)
+			texture = argv[ai + 1];
+		else
+			break;
+		ai += 2;
+	}
+	if(argc - ai < 4) {
+		std::cerr << "Usage: " << argv[0]
+		          << " [--max-size N] [--texture PATH] <dir> <atlas.png> <manifest.json> <image>...\n";
+		return EXIT_FAILURE;
+	}
+	std::string dir          = argv[ai++];
+	std::string atlasPath    = argv[ai++];
+	std::string manifestPath = argv[ai++];
+	if(texture.empty())
+		texture = atlasPath;
+
+	std::vector<RgbaImage> images;
+	unsigned width = 0;
+	for(; ai < argc; ++ai) {
+		RgbaImage image;
+		image.path = argv[ai];
+		if(!readPng(dir + "/" + image.path, image)) {
+			dbgLogger.error(image.path, ": Failed to read image");
+			return EXIT_FAILURE;
+		}
+		width = std::max(width, image.width + 2 * PADDING);
+		images.push_back(std::move(image));
+	}
+
+	// As narrow as the widest image allows, up to maxSize.
+	unsigned total = 0;
+	for(const RgbaImage& image: images)
+		total += (image.width + 2 * PADDING) * (image.height + 2 * PADDING);
+	while(width * width < total && width < maxSize)
+		width = std::min(width * 2, maxSize);
+	unsigned height = pack(images, width);
+	if(width > maxSize || height > maxSize) {
+		dbgLogger.error(atlasPath, ": ", width, "x", height, " atlas larger than ",
+		                maxSize, "x", maxSize);
+		return EXIT_FAILURE;
+	}
+
+	std::vector<uint8> atlas(size_t(width) * height * 4, 0);
+	for(const RgbaImage& image: images)
+		blit(image, width, atlas);
+
+	if(!writePng(atlasPath, width, height, atlas)) {
+		dbgLogger.error(atlasPath, ": Failed to write atlas");
+		return EXIT_FAILURE;
+	}
+
+	Json::Value manifest;
+	manifest["texture"] = texture;
+	manifest["width"]   = width;
+	manifest["height"]  = height;
+	for(const RgbaImage& image: images) {
+		Json::Value& region = manifest["regions"][image.path];
+		region["x"]      = image.x;
+		region["y"]      = image.y;
+		region["width"]  = image.width;
+		region["height"] = image.height;
+	}
+
+	std::ofstream out(manifestPath);
+	out << Json::StyledWriter().write(manifest);
+	if(!out.good()) {
+		dbgLogger.error(manifestPath, ": Failed to write manifest");
+		return EXIT_FAILURE;
+	}
+
+	dbgLogger.info(atlasPath, ": ", images.size(), " images in ", width, "x", height);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,167 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#include <SDL.h>
+#include <SDL_image.h>
+#include <SDL_mixer.h>
+
+#include "packed_loaders.h"
+
+
+static const AssetPack* loaderPack = nullptr;
+static StartupProfile*  loaderProfile = nullptr;
+static Path             loaderDataPath;
+
+
+void setLoaderAssetPack(const AssetPack* pack) {
+	loaderPack = pack;
+}
+
+
+void setLoaderProfile(StartupProfile* profile, const Path& dataPath) {
+	loaderProfile  = profile;
+	loaderDataPath = dataPath;
+}
+
+
+static bool readPacked(const Path& path, AssetBytes& bytes, Logger& log) {
+	return loaderPack && loaderPack->read(path, bytes, log);
+}
+
+
+// Times a load, on the thread that runs it.
+class LoadRecord {
+public:
+	LoadRecord(const Path& path)
+		: _path(path)
+		, _start(loaderProfile? loaderProfile->now(): 0)
+	{
+	}
+
+	void finish() {
+		if(!loaderProfile || !loaderProfile->isRecording())
+			return;
+
+		const AssetPackEntry* entry = loaderPack? loaderPack->find(_path): nullptr;
+		uint64 bytes = entry? entry->storedSize:
+		                      StartupProfile::fileSize(loaderDataPath / _path);
+		loaderProfile->addEvent(_path.utf8String(), StartupProfile::ASSET,
+		                        _start, loaderProfile->now(), bytes);
+	}
+
+private:
+	Path  _path;
+	int64 _start;
+};
+
+
+static SDL_RWops* openBytes(const AssetBytes& bytes) {
+	return SDL_RWFromConstMem(bytes.data, int(bytes.size));
+}
+
+
+PackedImageLoader::PackedImageLoader(LoaderManager* manager, AspectSP aspect)
+	: ImageLoader(manager, aspect)
+{
+}
+
+
+void PackedImageLoader::loadSyncImpl(Logger& log) {
+	LoadRecord record(asset()->logicPath());
+	AssetBytes bytes;
+	if(!readPacked(asset()->logicPath(), bytes, log)) {
+		ImageLoader::loadSyncImpl(log);
+		record.finish();
+		return;
+	}
+
+	SDL_Surface* surface = IMG_Load_RW(openBytes(bytes), 1);
+	SDL_Surface* rgba    = surface?
+	        SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ABGR8888, 0): nullptr;
+	SDL_FreeSurface(surface);
+	if(!rgba) {
+		log.error("Failed to load packed image \"", asset()->logicPath(), "\": ", IMG_GetError());
+		return;
+	}
+
+	// 8-bit RGBA, top row first, like ImageLoader.
+	std::static_pointer_cast<ImageAspect>(_aspect)->_get() =
+	        Image(rgba->w, rgba->h, Image::Format::FormatRGBA8, rgba->pixels);
+	SDL_FreeSurface(rgba);
+	record.finish();
+	_success();
+}
+
+
+PackedSoundLoader::PackedSoundLoader(LoaderManager* manager, AspectSP aspect)
+	: SoundLoader(manager, aspect)
+{
+}
+
+
+void PackedSoundLoader::loadSyncImpl(Logger& log) {
+	LoadRecord record(asset()->logicPath());
+	AssetBytes bytes;
+	if(!readPacked(asset()->logicPath(), bytes, log)) {
+		SoundLoader::loadSyncImpl(log);
+		record.finish();
+		return;
+	}
+
+	// Decoded at once: the bytes are not needed afterwards.
+	Mix_Chunk* chunk = Mix_LoadWAV_RW(openBytes(bytes), 1);
+	if(!chunk) {
+		log.error("Failed to load packed sound \"", asset()->logicPath(), "\": ", Mix_GetError());
+		return;
+	}
+
+	std::static_pointer_cast<SoundAspect>(_aspect)->_get() = Sound(chunk);
+	record.finish();
+	_success();
+}
+
+
+PackedMusicLoader::PackedMusicLoader(LoaderManager* manager, AspectSP aspect)
+	: MusicLoader(manager, aspect)
+{
+}
+
+
+void PackedMusicLoader::loadSyncImpl(Logger& log) {
+	LoadRecord record(asset()->logicPath());
+	AssetBytes bytes;
+	if(!readPacked(asset()->logicPath(), bytes, log) || !bytes.buffer.empty()) {
+		MusicLoader::loadSyncImpl(log);
+		record.finish();
+		return;
+	}
+
+	Mix_Music* music = Mix_LoadMUS_RW(openBytes(bytes), 1);
+	if(!music) {
+		log.error("Failed to load packed music \"", asset()->logicPath(), "\": ", Mix_GetError());
+		return;
+	}
+
+	std::static_pointer_cast<MusicAspect>(_aspect)->_get() = Music(music);
+	record.finish();
+	_success();
+}
@@ -0,0 +1,104 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+
+#ifndef LD39_PACKED_LOADERS_H_
+#define LD39_PACKED_LOADERS_H_
+
+
+#include <lair/core/lair.h>
+#include <lair/core/log.h>
+#include <lair/core/path.h>
+
+#include <lair/asset/loader.h>
+#include <lair/asset/image.h>
+
+#include <lair/sys_sdl2/audio_module.h>
+
+#include "asset_pack.h"
+#include "startup_profile.h"
+
+
+using namespace lair;
+
+
+// The pack the loaders below read from. Set once by the game, before any
+// loading (the pack outlives the loader threads); nullptr to read the
+// loose files only.
+void setLoaderAssetPack(const AssetPack* pack);
+
+// Where the loaders below record each load while the startup is profiled:
+// wall time on the loader thread, and the bytes read (the pack entry, or
+// the loose file in dataPath). nullptr to not record.
+void setLoaderProfile(StartupProfile* profile, const Path& dataPath);
+
+
+// Loaders that decode from the asset pack (see AssetPack) when it holds
+// the asset, and from the loose file like the lair loader they derive from
+// otherwise. Use them for the images and sounds the game requests itself.
+class PackedImageLoader : public ImageLoader {
+public:
+	PackedImageLoader(LoaderManager* manager, AspectSP aspect);
+	PackedImageLoader(const PackedImageLoader&)  = delete;
+	PackedImageLoader(      PackedImageLoader&&) = delete;
+	~PackedImageLoader() = default;
+
+	PackedImageLoader& operator=(const PackedImageLoader&)  = delete;
+	PackedImageLoader& operator=(      PackedImageLoader&&) = delete;
+
+protected:
+	virtual void loadSyncImpl(Logger& log);
+};
+
+
+class PackedSoundLoader : public SoundLoader {
+public:
+	PackedSoundLoader(LoaderManager* manager, AspectSP aspect);
+	PackedSoundLoader(const PackedSoundLoader&)  = delete;
+	PackedSoundLoader(      PackedSoundLoader&&) = delete;
+	~PackedSoundLoader() = default;
+
+	PackedSoundLoader& operator=(const PackedSoundLoader&)  = delete;
+	PackedSoundLoader& operator=(      PackedSoundLoader&&) = delete;
+
+protected:
+	virtual void loadSyncImpl(Logger& log);
+};
+
+
+// Music is streamed while it plays: only stored (uncompressed) entries,
+// which stay mapped, are read from the pack.
+class PackedMusicLoader : public MusicLoader {
+public:
+	PackedMusicLoader(LoaderManager* manager, AspectSP aspect);
+	PackedMusicLoader(const PackedMusicLoader&)  = delete;
+	PackedMusicLoader(      PackedMusicLoader&&) = delete;
+	~PackedMusicLoader() = default;
+
+	PackedMusicLoader& operator=(const PackedMusicLoader&)  = delete;
+	PackedMusicLoader& operator=(      PackedMusicLoader&&) = delete;
+
+protected:
+	virtual void loadSyncImpl(Logger& log);
+};
+
+
+#endif
@@ -0,0 +1,85 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "render_snapshot.h"
+
+
+RenderSnapshotBuffer::RenderSnapshotBuffer()
+	: _write(0)
+	, _read(1)
+	, _ready(2)
+{
+	for(RenderSnapshot& snapshot: _buffers)
+		clearSnapshot(snapshot);
+}
+
+
+RenderSnapshot& RenderSnapshotBuffer::writeBuffer() {
+	return _buffers[_write];
+}
+
+
+void RenderSnapshotBuffer::publish() {
+	_write = _ready.exchange(_write | FRESH);
+
+	// The consumer did not read the snapshot we get back: hand its
+	// references over so that they are released on its thread.
+	if(_write & FRESH) {
+		_write &= ~FRESH;
+		RenderSnapshot& skipped = _buffers[_write];
+		std::lock_guard<std::mutex> lock(_droppedMutex);
+		_dropped.emplace_back(std::move(skipped.sprites));
+		_droppedLayers.push_back(std::move(skipped.tileLayer));
+		clearSnapshot(skipped);
+	}
+}
+
+
+const RenderSnapshot& RenderSnapshotBuffer::acquire() {
+	if(_ready.load() & FRESH) {
+		clearSnapshot(_buffers[_read]);
+		_read = _ready.exchange(_read) & ~FRESH;
+	}
+
+	std::lock_guard<std::mutex> lock(_droppedMutex);
+	_dropped.clear();
+	_droppedLayers.clear();
+
+	return _buffers[_read];
+}
+
+
+// Keeps the capacity of the sprite vector.
+void RenderSnapshotBuffer::clearSnapshot(RenderSnapshot& snapshot) {
+	snapshot.time        = 0;
+	snapshot.level       = nullptr;
+	snapshot.levelWidth  = 0;
+	snapshot.levelHeight = 0;
+	snapshot.tiles.reset();
+	snapshot.tileOffset  = Vector3::Zero();
+	snapshot.tileLayer   = TileLayerStates{ nullptr, BLEND_NONE, false };
+	snapshot.tileSet.reset();
+	snapshot.prevCameraTarget = Vector2::Zero();
+	snapshot.cameraTarget     = Vector2::Zero();
+	snapshot.sprites.clear();
+	snapshot.backgroundSprite = false;
+	snapshot.guiBegin         = 0;
+}
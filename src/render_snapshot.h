@@ -0,0 +1,122 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef LD39_RENDER_SNAPSHOT_H_
+#define LD39_RENDER_SNAPSHOT_H_
+
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <lair/core/lair.h>
+
+#include <lair/asset/image.h>
+
+#include "sprite_batcher.h"
+#include "tile_layer_chunks.h"
+
+
+using namespace lair;
+
+
+class Level;
+
+
+// A copy of the tile layer of a level, shared by the snapshots published
+// while it does not change: hot reload replaces the tiles of the level
+// (Level::patch()) while frames may still draw the previous ones.
+typedef std::shared_ptr<const std::vector<uint16>> SharedTiles;
+
+
+// Everything a frame draws, as of the end of a tick. Transforms are those
+// of the tick and of the previous one, interpolated by the frame.
+struct RenderSnapshot {
+	int64    time;        // When published, in ns (see SysModule::getTimeNs()).
+
+	// Only compared, never dereferenced: the render thread does not touch
+	// levels, which the ticks may change meanwhile.
+	const Level*    level;
+	unsigned        levelWidth;
+	unsigned        levelHeight;
+	SharedTiles     tiles;
+	Vector3         tileOffset;
+	TileLayerStates tileLayer;
+	ImageAspectSP   tileSet;
+
+	Vector2  prevCameraTarget;
+	Vector2  cameraTarget;
+
+	// The background first (if backgroundSprite), then the scene, then the
+	// GUI from guiBegin, relative to its root: both follow the camera.
+	SpriteInstanceVector sprites;
+	bool     backgroundSprite;
+	unsigned guiBegin;
+};
+
+
+// Triple buffer: the producer always has a snapshot to write, the consumer
+// always has the latest complete one to read, and neither waits for the
+// other. Snapshots the consumer skips are dropped unread.
+//
+// The snapshots hold textures, destroyed with their last reference: this
+// only happens in acquire(), on the consumer thread, which owns the GL
+// context.
+class RenderSnapshotBuffer {
+public:
+	RenderSnapshotBuffer();
+	RenderSnapshotBuffer(const RenderSnapshotBuffer&)  = delete;
+	RenderSnapshotBuffer(      RenderSnapshotBuffer&&) = delete;
+	~RenderSnapshotBuffer() = default;
+
+	RenderSnapshotBuffer& operator=(const RenderSnapshotBuffer&)  = delete;
+	RenderSnapshotBuffer& operator=(      RenderSnapshotBuffer&&) = delete;
+
+	// Producer. The snapshot to write is empty.
+	RenderSnapshot& writeBuffer();
+	void publish();
+
+	// Consumer. The latest published snapshot, valid until the next call.
+	// Empty (no level) until the first publish().
+	const RenderSnapshot& acquire();
+
+protected:
+	enum {
+		FRESH = 4,  // The ready buffer was published since the last acquire().
+	};
+
+	static void clearSnapshot(RenderSnapshot& snapshot);
+
+protected:
+	RenderSnapshot        _buffers[3];
+	unsigned              _write;
+	unsigned              _read;
+	std::atomic<unsigned> _ready;  // Buffer index | FRESH.
+
+	// Skipped snapshots, cleared by the consumer.
+	std::mutex                        _droppedMutex;
+	std::vector<SpriteInstanceVector> _dropped;
+	std::vector<TileLayerStates>      _droppedLayers;
+};
+
+
+#endif
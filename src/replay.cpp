@@ -0,0 +1,250 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include "replay.h"
+
+
+// File layout (all integers are unsigned LEB128 varints):
+//   "LDRP" version
+//   level-length level spawn-length spawn
+//   n-ticks n-runs { inputs-byte run-length }*
+//   has-end-position [ end-x end-y ]   (little-endian float32)
+//
+// A minute of play is usually a few dozens of runs, so a few hundred bytes.
+
+static const char     REPLAY_MAGIC[4] = { 'L', 'D', 'R', 'P' };
+static const unsigned REPLAY_VERSION  = 1;
+
+
+static void writeVarint(std::vector<uint8>& out, unsigned value) {
+	while(value >= 0x80) {
+		out.push_back(uint8(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back(uint8(value));
+}
+
+
+static void writeString(std::vector<uint8>& out, const String& str) {
+	writeVarint(out, str.size());
+	out.insert(out.end(), str.begin(), str.end());
+}
+
+
+static void writeFloat(std::vector<uint8>& out, float value) {
+	uint32 bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	for(int i = 0; i < 4; ++i)
+		out.push_back(uint8(bits >> (8 * i)));
+}
+
+
+struct ReplayReader {
+	const uint8* ptr;
+	const uint8* end;
+	bool         ok;
+
+	uint8 readByte() {
+		if(ptr == end) {
+			ok = false;
+			return 0;
+		}
+		return *(ptr++);
+	}
+
+	unsigned readVarint() {
+		unsigned value = 0;
+		for(unsigned shift = 0; shift < 32; shift += 7) {
+			uint8 byte = readByte();
+			value |= unsigned(byte & 0x7f) << shift;
+			if(!(byte & 0x80))
+				return value;
+		}
+		ok = false;
+		return 0;
+	}
+
+	String readString() {
+		unsigned size = readVarint();
+		if(!ok || unsigned(end - ptr) < size) {
+			ok = false;
+			return String();
+		}
+		String str(ptr, ptr + size);
+		ptr += size;
+		return str;
+	}
+
+	float readFloat() {
+		uint32 bits = 0;
+		for(int i = 0; i < 4; ++i)
+			bits |= uint32(readByte()) << (8 * i);
+		float value;
+		std::memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+};
+
+
+Replay::Replay()
+	: _nTicks(0)
+	, _hasEndPosition(false)
+	, _endPosition(Vector2::Zero())
+	, _playRun(0)
+	, _playTick(0)
+{
+}
+
+
+void Replay::reset(const Path& level, const String& spawn) {
+	_level  = level;
+	_spawn  = spawn;
+	_runs.clear();
+	_nTicks = 0;
+	_hasEndPosition = false;
+	rewind();
+}
+
+
+void Replay::record(unsigned inputs) {
+	if(_runs.empty() || _runs.back().inputs != inputs)
+		_runs.push_back(Run{ uint8(inputs), 0 });
+	_runs.back().length += 1;
+	_nTicks += 1;
+}
+
+
+void Replay::rewind() {
+	_playRun  = 0;
+	_playTick = 0;
+}
+
+
+bool Replay::atEnd() const {
+	return _playRun >= _runs.size();
+}
+
+
+unsigned Replay::play() {
+	if(atEnd())
+		return INPUT_NONE;
+
+	unsigned inputs = _runs[_playRun].inputs;
+	_playTick += 1;
+	if(_playTick >= _runs[_playRun].length) {
+		_playRun += 1;
+		_playTick = 0;
+	}
+	return inputs;
+}
+
+
+bool Replay::save(const Path& path, Logger& log) const {
+	std::vector<uint8> data(REPLAY_MAGIC, REPLAY_MAGIC + 4);
+	writeVarint(data, REPLAY_VERSION);
+	writeString(data, _level.utf8String());
+	writeString(data, _spawn);
+	writeVarint(data, _nTicks);
+	writeVarint(data, _runs.size());
+	for(const Run& run: _runs) {
+		data.push_back(run.inputs);
+		writeVarint(data, run.length);
+	}
+	data.push_back(_hasEndPosition);
+	if(_hasEndPosition) {
+		writeFloat(data, _endPosition(0));
+		writeFloat(data, _endPosition(1));
+	}
+
+	std::ofstream out(path.utf8CStr(), std::ios::binary);
+	out.write(reinterpret_cast<const char*>(data.data()), data.size());
+	if(!out.good()) {
+		log.error("Unable to write replay \"", path, "\".");
+		return false;
+	}
+
+	log.info("Saved replay \"", path, "\": ", _nTicks, " ticks, ",
+	         _runs.size(), " runs, ", data.size(), " bytes.");
+	return true;
+}
+
+
+bool Replay::load(const Path& path, Logger& log) {
+	std::ifstream in(path.utf8CStr(), std::ios::binary);
+	if(!in.good()) {
+		log.error("Unable to read replay \"", path, "\".");
+		return false;
+	}
+	std::vector<uint8> data((std::istreambuf_iterator<char>(in)),
+	                        std::istreambuf_iterator<char>());
+
+	ReplayReader reader{ data.data(), data.data() + data.size(), true };
+	if(data.size() < 4 || std::memcmp(data.data(), REPLAY_MAGIC, 4) != 0) {
+		log.error("\"", path, "\" is not a replay file.");
+		return false;
+	}
+	reader.ptr += 4;
+	unsigned version = reader.readVarint();
+	if(version != REPLAY_VERSION) {
+		log.error("\"", path, "\": unsupported replay version ", version, ".");
+		return false;
+	}
+
+	Path   level = reader.readString();
+	String spawn = reader.readString();
+	reset(level, spawn);
+
+	unsigned nTicks = reader.readVarint();
+	unsigned nRuns  = reader.readVarint();
+	for(unsigned ri = 0; reader.ok && ri < nRuns; ++ri) {
+		Run run;
+		run.inputs = reader.readByte();
+		run.length = reader.readVarint();
+		_runs.push_back(run);
+		_nTicks += run.length;
+	}
+
+	_hasEndPosition = reader.readByte();
+	if(_hasEndPosition) {
+		_endPosition(0) = reader.readFloat();
+		_endPosition(1) = reader.readFloat();
+	}
+
+	if(!reader.ok || _nTicks != nTicks) {
+		log.error("\"", path, "\": corrupted replay file.");
+		reset(Path(), String());
+		return false;
+	}
+
+	log.info("Loaded replay \"", path, "\": ", _level, " (", _spawn, "), ",
+	         _nTicks, " ticks.");
+	return true;
+}
+
+
+void Replay::setEndPosition(const Vector2& position) {
+	_hasEndPosition = true;
+	_endPosition    = position;
+}
@@ -0,0 +1,102 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef LD39_REPLAY_H_
+#define LD39_REPLAY_H_
+
+
+#include <vector>
+
+#include <lair/core/lair.h>
+#include <lair/core/log.h>
+#include <lair/core/path.h>
+
+
+using namespace lair;
+
+
+// The inputs read by MainState::updateTick, one bit each.
+enum InputFlags {
+	INPUT_NONE  = 0x00,
+	INPUT_QUIT  = 0x01,
+	INPUT_LEFT  = 0x02,
+	INPUT_RIGHT = 0x04,
+	INPUT_DOWN  = 0x08,
+	INPUT_UP    = 0x10,
+	INPUT_JUMP  = 0x20,
+	INPUT_DASH  = 0x40,
+};
+
+
+// A recorded run: the level / spawn it starts from and the state of the
+// inputs for each tick, run-length encoded. Replaying the inputs from the
+// same starting point reproduces the run exactly.
+class Replay {
+public:
+	struct Run {
+		uint8    inputs;
+		unsigned length;
+	};
+	typedef std::vector<Run> RunVector;
+
+public:
+	Replay();
+	Replay(const Replay&)  = delete;
+	Replay(      Replay&&) = default;
+	~Replay() = default;
+
+	Replay& operator=(const Replay&)  = delete;
+	Replay& operator=(      Replay&&) = default;
+
+	void reset(const Path& level, const String& spawn);
+	void record(unsigned inputs);
+
+	void     rewind();
+	bool     atEnd() const;
+	unsigned play();
+
+	bool save(const Path& path, Logger& log) const;
+	bool load(const Path& path, Logger& log);
+
+	const Path&   level() const { return _level; }
+	const String& spawn() const { return _spawn; }
+	unsigned      nTicks() const { return _nTicks; }
+	unsigned      nRuns() const { return _runs.size(); }
+
+	bool           hasEndPosition() const { return _hasEndPosition; }
+	const Vector2& endPosition() const { return _endPosition; }
+	void           setEndPosition(const Vector2& position);
+
+protected:
+	Path      _level;
+	String    _spawn;
+	RunVector _runs;
+	unsigned  _nTicks;
+
+	bool      _hasEndPosition;
+	Vector2   _endPosition;
+
+	unsigned  _playRun;
+	unsigned  _playTick;
+};
+
+
+#endif
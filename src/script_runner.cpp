@@ -0,0 +1,173 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <algorithm>
+
+#include "script_runner.h"
+
+
+ScriptRunner::ScriptRunner(World* world)
+	: _world(world)
+	, _tick(0)
+	, _running(NO_SCRIPT)
+{
+}
+
+
+void ScriptRunner::start(const CommandProgramSP& program, EntityRef self) {
+	if(!program)
+		return;
+
+	for(unsigned bi = 0; bi < program->nBranches(); ++bi)
+		run(create(program, self, program->branch(bi)));
+}
+
+
+void ScriptRunner::clear() {
+	_scripts.clear();
+	_freeScripts.clear();
+	for(std::vector<unsigned>& slot: _wheel)
+		slot.clear();
+	_stateWaiters.clear();
+}
+
+
+void ScriptRunner::update(uint64 tick) {
+	_tick = tick;
+
+	// Scripts sleeping for more than a turn of the wheel go back in.
+	std::vector<unsigned>& slot = _wheel[tick % WHEEL_SIZE];
+	if(slot.empty())
+		return;
+
+	_wakeUp.swap(slot);
+	for(unsigned index: _wakeUp) {
+		if(_scripts[index].wakeTick > tick)
+			slot.push_back(index);
+	}
+	for(unsigned index: _wakeUp) {
+		if(_scripts[index].wakeTick <= tick)
+			run(index);
+	}
+	_wakeUp.clear();
+}
+
+
+void ScriptRunner::onStateChanged(unsigned state) {
+	if(_stateWaiters.empty())
+		return;
+
+	// Taken from the member to keep its capacity; a script that changes
+	// the state again gets an empty one.
+	std::vector<unsigned> wakeUp;
+	wakeUp.swap(_stateWakeUp);
+
+	auto waiter = _stateWaiters.begin();
+	for(unsigned index: _stateWaiters) {
+		if(_scripts[index].waitState == state)
+			wakeUp.push_back(index);
+		else
+			*(waiter++) = index;
+	}
+	_stateWaiters.erase(waiter, _stateWaiters.end());
+
+	for(unsigned index: wakeUp)
+		run(index);
+
+	wakeUp.clear();
+	if(wakeUp.capacity() > _stateWakeUp.capacity())
+		_stateWakeUp.swap(wakeUp);
+}
+
+
+void ScriptRunner::sleep(unsigned nTicks) {
+	lairAssert(_running != NO_SCRIPT);
+	uint64 wakeTick = _tick + std::max(nTicks, 1u);
+	_scripts[_running].wakeTick = wakeTick;
+	_wheel[wakeTick % WHEEL_SIZE].push_back(_running);
+}
+
+
+void ScriptRunner::waitState(unsigned state) {
+	lairAssert(_running != NO_SCRIPT);
+	_scripts[_running].waitState = state;
+	_stateWaiters.push_back(_running);
+}
+
+
+unsigned ScriptRunner::nScripts() const {
+	return _scripts.size() - _freeScripts.size();
+}
+
+
+unsigned ScriptRunner::create(const CommandProgramSP& program, EntityRef self,
+                              const CommandProgram::Branch& branch) {
+	unsigned index;
+	if(!_freeScripts.empty()) {
+		index = _freeScripts.back();
+		_freeScripts.pop_back();
+	}
+	else {
+		index = _scripts.size();
+		_scripts.emplace_back();
+	}
+
+	Script& script   = _scripts[index];
+	script.program   = program;
+	script.self      = self;
+	script.pc        = branch.begin;
+	script.end       = branch.end;
+	script.wakeTick  = 0;
+	script.waitState = 0;
+
+	return index;
+}
+
+
+// Scripts started by a command run (nested) before the command returns, so
+// _scripts may grow: nothing must keep a reference to a Script across exec.
+void ScriptRunner::run(unsigned index) {
+	unsigned prevRunning = _running;
+	_running = index;
+
+	while(true) {
+		Script& script = _scripts[index];
+		if(script.pc == script.end) {
+			destroy(index);
+			break;
+		}
+
+		const CommandProgram* program = script.program.get();
+		unsigned              pc      = script.pc++;
+		EntityRef             self    = script.self;
+		if(program->exec(_world, pc, self) == COMMAND_YIELD)
+			break;
+	}
+
+	_running = prevRunning;
+}
+
+
+void ScriptRunner::destroy(unsigned index) {
+	_scripts[index].program.reset();
+	_scripts[index].self = EntityRef();
+	_freeScripts.push_back(index);
+}
@@ -0,0 +1,105 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef LD39_SCRIPT_RUNNER_H_
+#define LD39_SCRIPT_RUNNER_H_
+
+
+#include <vector>
+
+#include <lair/core/lair.h>
+
+#include <lair/ec/entity.h>
+
+#include "command_program.h"
+
+
+using namespace lair;
+
+
+class World;
+
+
+// Runs command programs as stackless coroutines. A script runs until its
+// end or until a command yields after calling sleep() or waitState().
+// Sleeping scripts sit in a timer wheel and scripts waiting for a state in
+// a list checked on state changes, so only the scripts that wake up cost
+// anything.
+class ScriptRunner {
+public:
+	ScriptRunner(World* world);
+	ScriptRunner(const ScriptRunner&)  = delete;
+	ScriptRunner(      ScriptRunner&&) = delete;
+	~ScriptRunner() = default;
+
+	ScriptRunner& operator=(const ScriptRunner&)  = delete;
+	ScriptRunner& operator=(      ScriptRunner&&) = delete;
+
+	// Starts one script per branch of program and runs them right away.
+	void start(const CommandProgramSP& program, EntityRef self);
+	void clear();
+
+	// Wakes up the scripts sleeping until tick.
+	void update(uint64 tick);
+	void onStateChanged(unsigned state);
+
+	// To be called by the running command, which must then yield.
+	void sleep(unsigned nTicks);
+	void waitState(unsigned state);
+
+	unsigned nScripts() const;
+
+protected:
+	enum {
+		WHEEL_SIZE = 256,
+		NO_SCRIPT  = 0xffffffff,
+	};
+
+	struct Script {
+		CommandProgramSP program;
+		EntityRef        self;
+		unsigned         pc;
+		unsigned         end;
+		uint64           wakeTick;
+		unsigned         waitState;
+	};
+
+	unsigned create(const CommandProgramSP& program, EntityRef self,
+	                const CommandProgram::Branch& branch);
+	void run(unsigned index);
+	void destroy(unsigned index);
+
+protected:
+	World*                _world;
+	uint64                _tick;
+	unsigned              _running;
+
+	std::vector<Script>   _scripts;
+	std::vector<unsigned> _freeScripts;
+
+	std::vector<unsigned> _wheel[WHEEL_SIZE];
+	std::vector<unsigned> _stateWaiters;
+	std::vector<unsigned> _wakeUp;
+	std::vector<unsigned> _stateWakeUp;
+};
+
+
+#endif
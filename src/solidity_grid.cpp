@@ -0,0 +1,450 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <thread>
+
+#include "components.h"
+#include "level.h"
+
+#include "solidity_grid.h"
+
+
+// Tolerance of sweep(), in pixels. Same as the collision skin.
+static const float SWEEP_EPSILON = .5f;
+
+
+// What the background thread needs to bake the chunks of a grid, and where
+// it puts them. The grid detaches it (level = nullptr) when it is cleared,
+// so late jobs are dropped.
+struct SolidityGrid::Mailbox {
+	std::mutex         mutex;
+	const CookedLevel* level;
+	unsigned           layer;
+	std::vector<std::pair<unsigned, ChunkUP>> done;
+};
+
+
+// Bakes chunk (cx, cy), in padded coordinates, from the cooked tiles.
+static SolidityGrid::ChunkUP bakeChunk(const CookedLevel& level, unsigned layer,
+                                       unsigned cx, unsigned cy) {
+	const int size   = SOLIDITY_CHUNK_SIZE;
+	const int width  = level.width();
+	const int height = level.height();
+	const int x0 = int(cx) * size - 1;
+	const int y0 = int(cy) * size - 1;
+	const int x1 = std::min(x0 + size, width  + 1);
+	const int y1 = std::min(y0 + size, height + 1);
+
+	auto solid = [&](int x, int y) {
+		return x < 0 || x >= width || y < 0 || y >= height
+		    || isSolid(level.tile(x, y, layer));
+	};
+	// A face is exposed if the neighbor on the other side is in the map
+	// and empty. Neighbors may be in another chunk.
+	auto empty = [&](int x, int y) {
+		return x >= 0 && x < width && y >= 0 && y < height && !solid(x, y);
+	};
+
+	SolidityGrid::ChunkUP chunk(new SolidityGrid::Chunk);
+	std::fill(chunk->solid, chunk->solid + size, 0);
+	std::fill(chunk->faces, chunk->faces + size * size / 2, 0);
+	chunk->lastUse = 0;
+
+	for(int y = y0; y < y1; ++y) {
+		for(int x = x0; x < x1; ++x) {
+			unsigned lx = x - x0;
+			unsigned ly = y - y0;
+			if(solid(x, y))
+				chunk->solid[ly] |= uint64(1) << lx;
+
+			unsigned faces = 0;
+			if(empty(x + 1, y)) faces |= DIR_LEFT;
+			if(empty(x - 1, y)) faces |= DIR_RIGHT;
+			if(empty(x, y - 1)) faces |= DIR_DOWN;
+			if(empty(x, y + 1)) faces |= DIR_UP;
+			unsigned i = ly * size + lx;
+			chunk->faces[i >> 1] |= faces << ((i & 1) << 2);
+		}
+	}
+
+	// Greedy meshing, clipped to the chunk.
+	uint64 covered[SOLIDITY_CHUNK_SIZE] = { 0 };
+	auto free = [&](int lx, int ly) {
+		return ((chunk->solid[ly] & ~covered[ly]) >> lx) & 1u;
+	};
+
+	TileRectVector rects;
+	int w = x1 - x0;
+	int h = y1 - y0;
+	for(int ly = 0; ly < h; ++ly) {
+		for(int lx = 0; lx < w; ++lx) {
+			if(!free(lx, ly))
+				continue;
+
+			int lx1 = lx + 1;
+			while(lx1 < w && free(lx1, ly))
+				++lx1;
+
+			int ly1 = ly + 1;
+			for(; ly1 < h; ++ly1) {
+				int xi = lx;
+				while(xi < lx1 && free(xi, ly1))
+					++xi;
+				if(xi != lx1)
+					break;
+			}
+
+			uint64 mask = ((lx1 - lx == 64)? ~uint64(0): (uint64(1) << (lx1 - lx)) - 1) << lx;
+			for(int ry = ly; ry < ly1; ++ry)
+				covered[ry] |= mask;
+
+			rects.push_back(TileRect{ x0 + lx, y0 + ly, x0 + lx1, y0 + ly1 });
+			lx = lx1 - 1;
+		}
+	}
+	chunk->tree.build(std::move(rects));
+
+	return chunk;
+}
+
+
+// One thread bakes chunks ahead of time for all the grids (and all the
+// worlds of a BatchSimulator). Grids never wait on it: a chunk needed now
+// is baked on the spot.
+class ChunkStreamer {
+public:
+	ChunkStreamer()
+	    : _stop(false)
+	    , _thread(&ChunkStreamer::run, this)
+	{
+	}
+
+	~ChunkStreamer() {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stop = true;
+		}
+		_cond.notify_one();
+		_thread.join();
+	}
+
+	static ChunkStreamer& instance() {
+		static ChunkStreamer streamer;
+		return streamer;
+	}
+
+	void request(const SolidityGrid::MailboxSP& mailbox, unsigned index,
+	             unsigned cx, unsigned cy) {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_jobs.push_back(Job{ mailbox, index, cx, cy });
+		}
+		_cond.notify_one();
+	}
+
+protected:
+	struct Job {
+		SolidityGrid::MailboxSP mailbox;
+		unsigned                index;
+		unsigned                cx;
+		unsigned                cy;
+	};
+
+	void run() {
+		while(true) {
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_cond.wait(lock, [this] { return _stop || !_jobs.empty(); });
+				if(_stop)
+					return;
+				job = std::move(_jobs.front());
+				_jobs.pop_front();
+			}
+
+			std::lock_guard<std::mutex> lock(job.mailbox->mutex);
+			if(job.mailbox->level) {
+				job.mailbox->done.emplace_back(job.index,
+				        bakeChunk(*job.mailbox->level, job.mailbox->layer, job.cx, job.cy));
+			}
+		}
+	}
+
+protected:
+	std::mutex              _mutex;
+	std::condition_variable _cond;
+	std::deque<Job>         _jobs;
+	bool                    _stop;
+	std::thread             _thread;
+};
+
+
+SolidityGrid::SolidityGrid()
+	: _level(nullptr)
+	, _layer(0)
+	, _width(0)
+	, _height(0)
+	, _nChunks(0, 0)
+	, _clock(0)
+{
+}
+
+
+SolidityGrid::~SolidityGrid() {
+	clear();
+}
+
+
+void SolidityGrid::build(const CookedLevel& level, unsigned layer) {
+	clear();
+
+	_level  = &level;
+	_layer  = layer;
+	_width  = level.width();
+	_height = level.height();
+	_nChunks = Vector2i((_width  + 2 + SOLIDITY_CHUNK_SIZE - 1) / SOLIDITY_CHUNK_SIZE,
+	                    (_height + 2 + SOLIDITY_CHUNK_SIZE - 1) / SOLIDITY_CHUNK_SIZE);
+
+	unsigned nChunks = _nChunks(0) * _nChunks(1);
+	_chunks.resize(nChunks);
+	_states.assign(nChunks, CHUNK_MISSING);
+
+	_mailbox = std::make_shared<Mailbox>();
+	_mailbox->level = _level;
+	_mailbox->layer = _layer;
+}
+
+
+void SolidityGrid::clear() {
+	if(_mailbox) {
+		std::lock_guard<std::mutex> lock(_mailbox->mutex);
+		_mailbox->level = nullptr;
+		_mailbox->done.clear();
+	}
+	_mailbox.reset();
+
+	_level   = nullptr;
+	_width   = 0;
+	_height  = 0;
+	_nChunks = Vector2i(0, 0);
+	_chunks.clear();
+	_states.clear();
+	_resident.clear();
+}
+
+
+void SolidityGrid::detach() {
+	if(!_mailbox)
+		return;
+
+	std::lock_guard<std::mutex> lock(_mailbox->mutex);
+	_mailbox->level = nullptr;
+	_mailbox->done.clear();
+	for(uint8& state: _states) {
+		if(state == CHUNK_PENDING)
+			state = CHUNK_MISSING;
+	}
+}
+
+
+// Faces depend on the neighbors, so a changed row also changes the rows
+// above and below.
+void SolidityGrid::patch(const CookedLevel& level, const std::vector<unsigned>& rows) {
+	if(!_mailbox)
+		return;
+
+	_level = &level;
+	{
+		std::lock_guard<std::mutex> lock(_mailbox->mutex);
+		_mailbox->level = _level;
+	}
+
+	std::vector<bool> dirty(_nChunks(1), false);
+	for(unsigned y: rows) {
+		for(int dy = -1; dy <= 1; ++dy)
+			dirty[chunkCoord(int(y) + dy, _nChunks(1))] = true;
+	}
+
+	for(unsigned ri = 0; ri < _resident.size(); ) {
+		unsigned ci = _resident[ri];
+		if(dirty[ci / _nChunks(0)]) {
+			_chunks[ci].reset();
+			_states[ci] = CHUNK_MISSING;
+			_resident[ri] = _resident.back();
+			_resident.pop_back();
+		}
+		else {
+			++ri;
+		}
+	}
+}
+
+
+void SolidityGrid::stream(const std::vector<Box2>& areas) {
+	if(!_level)
+		return;
+
+	_clock += 1;
+
+	{
+		std::lock_guard<std::mutex> lock(_mailbox->mutex);
+		for(auto& done: _mailbox->done)
+			install(done.first, std::move(done.second));
+		_mailbox->done.clear();
+	}
+
+	// Areas are converted to chunk ranges in padded tile coordinates.
+	auto range = [this](const Box2& area, int margin, Vector2i& begin, Vector2i& end) {
+		int x0 = int(std::floor(area.min()(0) / TILE_SIZE)) - margin;
+		int x1 = int(std::ceil (area.max()(0) / TILE_SIZE)) + margin;
+		int y0 = _height - int(std::ceil (area.max()(1) / TILE_SIZE)) - margin;
+		int y1 = _height - int(std::floor(area.min()(1) / TILE_SIZE)) + margin;
+		begin = Vector2i(chunkCoord(x0, _nChunks(0)), chunkCoord(y0, _nChunks(1)));
+		end   = Vector2i(chunkCoord(x1, _nChunks(0)), chunkCoord(y1, _nChunks(1)));
+	};
+
+	for(const Box2& area: areas) {
+		Vector2i needBegin;
+		Vector2i needEnd;
+		Vector2i keepBegin;
+		Vector2i keepEnd;
+		range(area, STREAM_NEED_MARGIN, needBegin, needEnd);
+		range(area, STREAM_KEEP_MARGIN, keepBegin, keepEnd);
+
+		for(int cy = keepBegin(1); cy <= keepEnd(1); ++cy) {
+			for(int cx = keepBegin(0); cx <= keepEnd(0); ++cx) {
+				unsigned ci = cy * _nChunks(0) + cx;
+				bool need = cx >= needBegin(0) && cx <= needEnd(0)
+				         && cy >= needBegin(1) && cy <= needEnd(1);
+
+				if(_states[ci] != CHUNK_RESIDENT && need)
+					install(ci, bakeChunk(*_level, _layer, cx, cy));
+				else if(_states[ci] == CHUNK_MISSING) {
+					_states[ci] = CHUNK_PENDING;
+					ChunkStreamer::instance().request(_mailbox, ci, cx, cy);
+				}
+
+				if(_chunks[ci])
+					_chunks[ci]->lastUse = _clock;
+			}
+		}
+	}
+
+	// Whatever is out of every kept range goes away.
+	for(unsigned ri = 0; ri < _resident.size(); ) {
+		unsigned ci = _resident[ri];
+		if(_chunks[ci]->lastUse != _clock) {
+			_chunks[ci].reset();
+			_states[ci] = CHUNK_MISSING;
+			_resident[ri] = _resident.back();
+			_resident.pop_back();
+		}
+		else {
+			++ri;
+		}
+	}
+}
+
+
+SweepHit SolidityGrid::sweep(const Box2& box, const Vector2& motion) const {
+	const float size = TILE_SIZE;
+	const float eps  = SWEEP_EPSILON;
+
+	// For each axis: the next tile line the leading face crosses, when it
+	// crosses it and how long it takes to go to the following one.
+	int   step [2];
+	int   line [2];
+	float time [2];
+	float delta[2];
+	for(int a = 0; a < 2; ++a) {
+		if(motion(a) > 0) {
+			step [a] = 1;
+			line [a] = int(std::ceil((box.max()(a) - eps) / size));
+			time [a] = std::max((line[a] * size - box.max()(a)) / motion(a), 0.f);
+			delta[a] = size / motion(a);
+		}
+		else if(motion(a) < 0) {
+			step [a] = -1;
+			line [a] = int(std::floor((box.min()(a) + eps) / size));
+			time [a] = std::max((line[a] * size - box.min()(a)) / motion(a), 0.f);
+			delta[a] = -size / motion(a);
+		}
+		else {
+			step [a] = 0;
+			line [a] = 0;
+			time [a] = std::numeric_limits<float>::infinity();
+			delta[a] = 0;
+		}
+	}
+
+	while(std::min(time[0], time[1]) <= 1) {
+		int   a = (time[0] <= time[1])? 0: 1;
+		int   o = 1 - a;
+		float t = time[a];
+
+		// Tiles of the row / column entered, overlapped by the box at t.
+		int entered = (step[a] > 0)? line[a]: line[a] - 1;
+		int first   = int(std::floor((box.min()(o) + motion(o) * t + eps) / size));
+		int last    = int(std::ceil ((box.max()(o) + motion(o) * t - eps) / size));
+		for(int i = first; i < last; ++i) {
+			int x   = (a == 0)? entered: i;
+			int row = (a == 0)? i: entered;
+			if(isSolid(x, _height - 1 - row)) {
+				SweepHit hit{ t, Vector2::Zero() };
+				hit.normal(a) = -step[a];
+				return hit;
+			}
+		}
+
+		line[a] += step[a];
+		time[a] += delta[a];
+	}
+
+	return SweepHit{ 1, Vector2::Zero() };
+}
+
+
+size_t SolidityGrid::byteSize() const {
+	size_t size = _chunks.size() * sizeof(ChunkUP) + _states.size();
+	for(unsigned ci: _resident)
+		size += sizeof(Chunk) + _chunks[ci]->tree.byteSize();
+	return size;
+}
+
+
+// Chunks baked in the background may arrive after the same chunk has been
+// baked on the spot or dropped: the first one wins, late ones are
+// discarded, and pending chunks that are not wanted anymore are dropped
+// by the next stream().
+void SolidityGrid::install(unsigned index, ChunkUP chunk) {
+	if(_states[index] == CHUNK_RESIDENT)
+		return;
+
+	chunk->lastUse = _clock;
+	_chunks[index] = std::move(chunk);
+	_states[index] = CHUNK_RESIDENT;
+	_resident.push_back(index);
+}
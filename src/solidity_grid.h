@@ -0,0 +1,195 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef LD39_SOLIDITY_GRID_H_
+#define LD39_SOLIDITY_GRID_H_
+
+
+#include <memory>
+#include <vector>
+
+#include <lair/core/lair.h>
+
+#include "cooked_level.h"
+#include "tile_rect_tree.h"
+
+
+using namespace lair;
+
+
+enum {
+	// Chunks are 64x64 tiles: a row of solidity bits is an uint64.
+	SOLIDITY_CHUNK_SIZE = 64,
+
+	// Around each streamed area, in tiles: chunks closer than the first
+	// margin are baked right away if they are missing, the ones closer than
+	// the second are baked in the background, the others are dropped.
+	STREAM_NEED_MARGIN = 8,
+	STREAM_KEEP_MARGIN = 64,
+};
+
+
+// Result of SolidityGrid::sweep().
+struct SweepHit {
+	float   time;    // Fraction of the motion done before the hit, 1 if none.
+	Vector2 normal;  // Zero if nothing was hit.
+};
+
+
+// Solidity of a tile layer: one bit per tile, plus a 4-bit mask per tile
+// telling which faces touch an empty tile (DirFlags, same convention as
+// CharacterComponentManager::processCollisions), plus the solid tiles
+// merged into few rectangles (greedy meshing: grow right first, then down)
+// for collision queries.
+//
+// Coordinates are tile coordinates (y = 0 is the top row). The grid is
+// padded with a ring of solid tiles and any coordinate outside of it is
+// clamped onto the ring, so everything out of the map is solid.
+//
+// The grid is split in chunks baked from the cooked level on demand, see
+// stream(), so the size of a map is not bounded by memory. Queries must
+// stay in streamed areas: missing chunks are solid and have no face.
+class SolidityGrid {
+public:
+	SolidityGrid();
+	SolidityGrid(const SolidityGrid&)  = delete;
+	SolidityGrid(      SolidityGrid&&) = default;
+	~SolidityGrid();
+
+	SolidityGrid& operator=(const SolidityGrid&)  = delete;
+	SolidityGrid& operator=(      SolidityGrid&&) = default;
+
+	// Does not bake anything, level must outlive the grid (or clear()).
+	void build(const CookedLevel& level, unsigned layer);
+	void clear();
+
+	// Makes the chunks around areas (world coordinates) resident and drops
+	// the others.
+	void stream(const std::vector<Box2>& areas);
+
+	// To replace the level data by a version of the same size: detach()
+	// stops the background thread from reading the current data, patch()
+	// attaches the new data and drops the chunks that see the changed rows.
+	void detach();
+	void patch(const CookedLevel& level, const std::vector<unsigned>& rows);
+
+	inline int width()  const { return _width; }
+	inline int height() const { return _height; }
+
+	inline bool isSolid(int x, int y) const {
+		x = std::min(std::max(x, -1), _width);
+		y = std::min(std::max(y, -1), _height);
+		const Chunk* c = chunk(x, y);
+		if(!c)
+			return true;
+		return (c->solid[(y + 1) & 63] >> ((x + 1) & 63)) & 1u;
+	}
+
+	// Exposed faces of tile (x, y). Tiles beyond the padding have no
+	// neighbor in the map, so they have no exposed face.
+	inline unsigned faces(int x, int y) const {
+		if(x < -1 || x > _width || y < -1 || y > _height)
+			return 0;
+		const Chunk* c = chunk(x, y);
+		if(!c)
+			return 0;
+		unsigned i = ((y + 1) & 63) * SOLIDITY_CHUNK_SIZE + ((x + 1) & 63);
+		return (c->faces[i >> 1] >> ((i & 1) << 2)) & 0x0f;
+	}
+
+	// Calls f(rect) for each solid rectangle intersecting range. Rectangles
+	// do not cross chunk borders.
+	template<typename F>
+	void query(const TileRect& range, F f) const {
+		int cx0 = chunkCoord(range.x0,     _nChunks(0));
+		int cx1 = chunkCoord(range.x1 - 1, _nChunks(0));
+		int cy0 = chunkCoord(range.y0,     _nChunks(1));
+		int cy1 = chunkCoord(range.y1 - 1, _nChunks(1));
+		for(int cy = cy0; cy <= cy1; ++cy) {
+			for(int cx = cx0; cx <= cx1; ++cx) {
+				const Chunk* c = _chunks[cy * _nChunks(0) + cx].get();
+				if(c)
+					c->tree.query(range, f);
+			}
+		}
+	}
+
+	// Moves box (in world coordinates) along motion, tile line by tile line
+	// (DDA), and stops at the first solid tile it would enter. Faces only
+	// touching a tile, up to a small tolerance, do not count.
+	SweepHit sweep(const Box2& box, const Vector2& motion) const;
+
+	inline unsigned nResidentChunks() const { return _resident.size(); }
+
+	// Memory used by the resident chunks, in bytes.
+	size_t byteSize() const;
+
+public:
+	struct Chunk {
+		uint64            solid[SOLIDITY_CHUNK_SIZE];
+		uint8             faces[SOLIDITY_CHUNK_SIZE * SOLIDITY_CHUNK_SIZE / 2];
+		TileRectTree      tree;
+		uint64            lastUse;
+	};
+	typedef std::unique_ptr<Chunk> ChunkUP;
+
+	// Shared with the background thread, see solidity_grid.cpp.
+	struct Mailbox;
+	typedef std::shared_ptr<Mailbox> MailboxSP;
+
+protected:
+	// Chunk coordinate of tile coordinate c (padding included), clamped.
+	static inline int chunkCoord(int c, int nChunks) {
+		return std::min(std::max(c + 1, 0) / int(SOLIDITY_CHUNK_SIZE), nChunks - 1);
+	}
+
+	// x and y must be in the padded grid.
+	inline const Chunk* chunk(int x, int y) const {
+		unsigned ci = unsigned(y + 1) / SOLIDITY_CHUNK_SIZE * _nChunks(0)
+		            + unsigned(x + 1) / SOLIDITY_CHUNK_SIZE;
+		return _chunks[ci].get();
+	}
+
+	void install(unsigned index, ChunkUP chunk);
+
+protected:
+	enum ChunkState {
+		CHUNK_MISSING,
+		CHUNK_PENDING,
+		CHUNK_RESIDENT,
+	};
+
+	const CookedLevel*    _level;
+	unsigned              _layer;
+	int                   _width;
+	int                   _height;
+	Vector2i              _nChunks;
+
+	std::vector<ChunkUP>  _chunks;
+	std::vector<uint8>    _states;
+	std::vector<unsigned> _resident;
+	uint64                _clock;
+
+	MailboxSP             _mailbox;
+};
+
+
+#endif
@@ -25,6 +25,7 @@
 
 #include "game.h"
 #include "main_state.h"
+#include "packed_loaders.h"
 
 #include "splash_state.h"
 
@@ -66,6 +67,8 @@ SplashState::~SplashState() {
 
 
 void SplashState::initialize() {
+	StartupProfile::Scope scope(game()->profile(), "SplashState::initialize");
+
 	_loop.reset();
 	_loop.setTickDuration(    ONE_SEC /  60);
 	_loop.setFrameDuration(   ONE_SEC /  60);
@@ -117,6 +120,7 @@ void SplashState::run() {
 	_fpsCount = 0;
 
 	nextSplash();
+	game()->profile().finish();
 
 	do {
 		switch(_loop.nextEvent()) {
@@ -162,6 +166,12 @@ bool SplashState::nextSplash() {
 	if(!splashSprite)
 		splashSprite = _sprites.addComponent(_splash);
 
+	StartupProfile::Scope scope(game()->profile(), "SplashState::nextSplash");
+	if(game()->profile().isRecording())
+		scope.addBytes(StartupProfile::fileSize(game()->dataPath() / _splashQueue.front()));
+
+	// Loaded first, so that the sprite finds the image read from the pack.
+	loader()->load<PackedImageLoader>(_splashQueue.front());
 	splashSprite->setTexture(_splashQueue.front());
 	splashSprite->setTextureFlags(Texture::BILINEAR_NO_MIPMAP);
 
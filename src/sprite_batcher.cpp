@@ -0,0 +1,187 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <algorithm>
+#include <cmath>
+
+#include "sprite_batcher.h"
+
+
+SpriteBatcher::SpriteBatcher(SpriteComponentManager* sprites, RenderPass* renderPass,
+                             SpriteRenderer* spriteRenderer)
+	: _sprites(sprites)
+	, _renderPass(renderPass)
+	, _spriteRenderer(spriteRenderer)
+	, _nDrawCalls(0)
+{
+}
+
+
+void SpriteBatcher::render(EntityRef root, float interp, const OrthographicCamera& camera) {
+	_instances.clear();
+	collect(root, _instances);
+	render(_instances, interp, camera);
+}
+
+
+void SpriteBatcher::render(const SpriteInstanceVector& sprites, float interp,
+                           const OrthographicCamera& camera) {
+	_items.clear();
+	_nDrawCalls = 0;
+
+	const ProgramObject* shader = _spriteRenderer->shader().shader;
+	for(const SpriteInstance& sprite: sprites) {
+		Item item;
+		item.transform    = (1 - interp) * sprite.prevTransform + interp * sprite.transform;
+		item.depth        = item.transform(2, 3);
+		item.bucket       = int(std::floor(item.depth * SPRITE_DEPTH_BUCKETS));
+		item.shader       = shader;
+		item.textureSet   = sprite.textureSet.get();
+		item.blendingMode = sprite.blendingMode;
+		item.sprite       = &sprite;
+		_items.push_back(item);
+	}
+
+	// Back to front, then grouped by states.
+	_order.resize(_items.size());
+	for(unsigned ii = 0; ii < _items.size(); ++ii)
+		_order[ii] = ii;
+	std::stable_sort(_order.begin(), _order.end(), [this](unsigned i0, unsigned i1) {
+		const Item& item0 = _items[i0];
+		const Item& item1 = _items[i1];
+		if(item0.bucket != item1.bucket)
+			return item0.bucket < item1.bucket;
+		if(item0.shader != item1.shader)
+			return item0.shader < item1.shader;
+		if(item0.textureSet != item1.textureSet)
+			return item0.textureSet < item1.textureSet;
+		return item0.blendingMode < item1.blendingMode;
+	});
+
+	const ShaderParameter* params = nullptr;
+	unsigned oi = 0;
+	while(oi < _order.size()) {
+		const Item& first = _items[_order[oi]];
+		unsigned index = _spriteRenderer->indexCount();
+		for(; oi < _order.size() && sameStates(first, _items[_order[oi]]); ++oi)
+			addQuad(_items[_order[oi]]);
+
+		if(!params) {
+			params = _spriteRenderer->addShaderParameters(
+			             _spriteRenderer->shader(), camera.transform(), 0);
+		}
+
+		RenderPass::DrawStates states;
+		states.vertices     = _spriteRenderer->vertexArray();
+		states.shader       = first.shader;
+		states.textureSet   = first.sprite->textureSet;
+		states.blendingMode = BlendingMode(first.blendingMode);
+
+		_renderPass->addDrawCall(states, params, first.depth, index,
+		                         _spriteRenderer->indexCount() - index);
+		_nDrawCalls += 1;
+	}
+}
+
+
+// Disabled subtrees (cached levels, models) are skipped entirely.
+void SpriteBatcher::collect(EntityRef entity, SpriteInstanceVector& sprites) const {
+	if(!entity.isEnabled())
+		return;
+
+	SpriteComponent* sc = _sprites->get(entity);
+	if(sc && sc->isEnabled() && sc->texture() && sc->texture()->isValid()
+	&& sc->textureSet()) {
+		const Texture& texture = sc->texture()->get();
+
+		SpriteInstance sprite;
+		sprite.prevTransform = entity._get()->prevWorldTransform.matrix();
+		sprite.transform     = entity._get()->worldTransform.matrix();
+		sprite.textureSet    = sc->textureSet();
+		sprite.textureSize   = Vector2(texture.width(), texture.height());
+		sprite.view          = sc->view();
+		sprite.anchor        = sc->anchor();
+		sprite.tileGridSize  = sc->tileGridSize();
+		sprite.tileIndex     = sc->tileIndex();
+		sprite.color         = sc->color();
+		sprite.blendingMode  = sc->blendingMode();
+		sprites.push_back(sprite);
+	}
+
+	EntityRef child = entity.firstChild();
+	while(child.isValid()) {
+		collect(child, sprites);
+		child = child.nextSibling();
+	}
+}
+
+
+// The tile of the grid placed according to the anchor. The grid divides the
+// view of the sprite: the whole texture, a region of an atlas (see
+// TextureAtlas) or a scrolling window (the background, with a 1x1 grid).
+// Tile rows start at the top of the texture, where v = 0, views go up.
+void SpriteBatcher::addQuad(const Item& item) {
+	const SpriteInstance& sprite = *item.sprite;
+
+	Vector2i grid = sprite.tileGridSize;
+	unsigned tile = sprite.tileIndex;
+	Box2     view = sprite.view;
+	Vector2  cellSize = view.sizes().cwiseQuotient(grid.cast<float>());
+
+	float u0 = view.min()(0) + (tile % grid(0)) * cellSize(0);
+	float u1 = u0 + cellSize(0);
+	float v0 = 1 - view.max()(1) + (tile / grid(0)) * cellSize(1);
+	float v1 = v0 + cellSize(1);
+
+	Vector2 size = sprite.textureSize.cwiseProduct(cellSize);
+	Vector2 p0 = -sprite.anchor.cwiseProduct(size);
+	Vector2 p1 = p0 + size;
+
+	const Matrix4& m = item.transform;
+	const Vector4& color = sprite.color;
+	unsigned first = _spriteRenderer->vertexCount();
+	_spriteRenderer->addVertex(m * Vector4(p0(0), p0(1), 0, 1), color, Vector2(u0, v1));
+	_spriteRenderer->addVertex(m * Vector4(p1(0), p0(1), 0, 1), color, Vector2(u1, v1));
+	_spriteRenderer->addVertex(m * Vector4(p0(0), p1(1), 0, 1), color, Vector2(u0, v0));
+	_spriteRenderer->addVertex(m * Vector4(p1(0), p1(1), 0, 1), color, Vector2(u1, v0));
+	_spriteRenderer->addIndex(first + 0);
+	_spriteRenderer->addIndex(first + 1);
+	_spriteRenderer->addIndex(first + 2);
+	_spriteRenderer->addIndex(first + 2);
+	_spriteRenderer->addIndex(first + 1);
+	_spriteRenderer->addIndex(first + 3);
+}
+
+
+Vector2 spriteSize(const SpriteComponent& sprite) {
+	const Texture& texture = sprite.texture()->get();
+	Vector2 textureSize(texture.width(), texture.height());
+	return textureSize.cwiseProduct(sprite.view().sizes())
+	                  .cwiseQuotient(sprite.tileGridSize().cast<float>());
+}
+
+
+bool SpriteBatcher::sameStates(const Item& i0, const Item& i1) {
+	return i0.bucket       == i1.bucket
+	    && i0.shader       == i1.shader
+	    && i0.textureSet   == i1.textureSet
+	    && i0.blendingMode == i1.blendingMode;
+}
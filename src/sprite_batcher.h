@@ -0,0 +1,127 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef LD39_SPRITE_BATCHER_H_
+#define LD39_SPRITE_BATCHER_H_
+
+
+#include <vector>
+
+#include <lair/core/lair.h>
+
+#include <lair/render_gl2/orthographic_camera.h>
+#include <lair/render_gl2/render_pass.h>
+#include <lair/render_gl2/texture_set.h>
+
+#include <lair/ec/entity.h>
+#include <lair/ec/sprite_component.h>
+
+
+using namespace lair;
+
+
+enum {
+	// Sprites closer than 1 / SPRITE_DEPTH_BUCKETS in depth may be drawn in
+	// any order.
+	SPRITE_DEPTH_BUCKETS = 1024,
+};
+
+
+// Size in pixels of a tile of sprite, as drawn by SpriteBatcher. Its texture
+// must be loaded.
+Vector2 spriteSize(const SpriteComponent& sprite);
+
+
+// What SpriteBatcher draws of a sprite, copied from the component, so that
+// it can be drawn after the component changed or was destroyed (see
+// RenderSnapshot).
+struct SpriteInstance {
+	Matrix4       prevTransform;
+	Matrix4       transform;
+	TextureSetCSP textureSet;
+	Vector2       textureSize;
+	Box2          view;
+	Vector2       anchor;
+	Vector2i      tileGridSize;
+	unsigned      tileIndex;
+	Vector4       color;
+	unsigned      blendingMode;
+};
+typedef std::vector<SpriteInstance, Eigen::aligned_allocator<SpriteInstance>> SpriteInstanceVector;
+
+
+// Replaces SpriteComponentManager::render(), which submits one draw call
+// per sprite. The sprites of a tree are sorted by depth bucket, shader,
+// texture and blending mode, and their quads are written in that order in
+// the sprite renderer buffer: each run of sprites sharing these states is
+// a contiguous index range, drawn with a single call.
+class SpriteBatcher {
+public:
+	SpriteBatcher(SpriteComponentManager* sprites, RenderPass* renderPass,
+	              SpriteRenderer* spriteRenderer);
+	SpriteBatcher(const SpriteBatcher&)  = delete;
+	SpriteBatcher(      SpriteBatcher&&) = delete;
+	~SpriteBatcher() = default;
+
+	SpriteBatcher& operator=(const SpriteBatcher&)  = delete;
+	SpriteBatcher& operator=(      SpriteBatcher&&) = delete;
+
+	// Renders the enabled sprites of root and its enabled descendants.
+	void render(EntityRef root, float interp, const OrthographicCamera& camera);
+	void render(const SpriteInstanceVector& sprites, float interp,
+	            const OrthographicCamera& camera);
+
+	// Appends the sprites render(root, ...) would draw.
+	void collect(EntityRef root, SpriteInstanceVector& sprites) const;
+
+	// Stats of the last render().
+	inline unsigned nSprites()   const { return _items.size(); }
+	inline unsigned nDrawCalls() const { return _nDrawCalls; }
+
+protected:
+	struct Item {
+		int                  bucket;
+		const ProgramObject* shader;
+		const TextureSet*    textureSet;
+		unsigned             blendingMode;
+		const SpriteInstance* sprite;
+		float                depth;
+		Matrix4              transform;
+	};
+	typedef std::vector<Item, Eigen::aligned_allocator<Item>> ItemVector;
+
+	void addQuad(const Item& item);
+
+	static bool sameStates(const Item& i0, const Item& i1);
+
+protected:
+	SpriteComponentManager* _sprites;
+	RenderPass*     _renderPass;
+	SpriteRenderer* _spriteRenderer;
+
+	SpriteInstanceVector _instances;  // Of render(root, ...).
+	ItemVector      _items;
+	std::vector<unsigned> _order;
+	unsigned        _nDrawCalls;
+};
+
+
+#endif
@@ -0,0 +1,268 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+
+#include "startup_profile.h"
+
+
+// Bumped when the report layout changes, so that scripts comparing
+// releases can tell.
+static const unsigned REPORT_VERSION = 1;
+
+
+static void writeString(std::ostream& out, const String& str) {
+	out << '"';
+	for(char c: str) {
+		if(c == '"' || c == '\\')
+			out << '\\' << c;
+		else if(c == '\n')
+			out << "\\n";
+		else if(uint8(c) < 0x20)
+			out << ' ';
+		else
+			out << c;
+	}
+	out << '"';
+}
+
+
+StartupProfile::Scope::Scope(StartupProfile& profile, const String& name)
+	: _profile(profile)
+	, _name(name)
+	, _start(profile.now())
+	, _bytes(0)
+{
+}
+
+
+StartupProfile::Scope::~Scope() {
+	_profile.addEvent(_name, PHASE, _start, _profile.now(), _bytes);
+}
+
+
+StartupProfile::StartupProfile()
+	: _startTime(0)
+	, _endTime(-1)
+{
+	_startTime = now();
+	_threads.push_back(std::this_thread::get_id());
+}
+
+
+void StartupProfile::finish() {
+	std::lock_guard<std::mutex> lock(_mutex);
+	if(_endTime < 0)
+		_endTime = now();
+}
+
+
+void StartupProfile::addEvent(const String& name, Kind kind, int64 start, int64 end,
+                              uint64 bytes, std::thread::id thread) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	if(_endTime >= 0)
+		return;
+
+	Event event;
+	event.name   = name;
+	event.kind   = kind;
+	event.thread = threadIndex(thread);
+	event.start  = start - _startTime;
+	event.end    = end   - _startTime;
+	event.bytes  = bytes;
+	_events.push_back(event);
+}
+
+
+bool StartupProfile::findAsset(const String& name, Event& event) const {
+	std::lock_guard<std::mutex> lock(_mutex);
+	for(const Event& e: _events) {
+		if(e.kind == ASSET && e.name == name) {
+			event = e;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+int64 StartupProfile::now() const {
+	using namespace std::chrono;
+	return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+
+// Top level phases of the main thread, in order.
+void StartupProfile::logSummary(Logger& log) const {
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	log.info("Startup: ", duration() / 1000000, " ms, ", _events.size(), " events");
+	int64 end = 0;
+	for(const Event& event: _events) {
+		if(event.kind != PHASE || event.thread != 0 || event.start < end)
+			continue;
+		log.info("  ", event.name, ": ", (event.end - event.start) / 1000000,
+		         " ms (from ", event.start / 1000000, " ms, ", event.bytes / 1024, " KiB)");
+		end = event.end;
+	}
+}
+
+
+bool StartupProfile::writeReport(const Path& path, Logger& log) const {
+	std::ofstream out(path.utf8CStr());
+	if(!out.good()) {
+		log.error("Failed to write startup report \"", path, "\"");
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	std::vector<const Event*> events;
+	for(const Event& event: _events)
+		events.push_back(&event);
+	std::stable_sort(events.begin(), events.end(), [](const Event* e0, const Event* e1) {
+		return e0->start < e1->start;
+	});
+
+	uint64 assetBytes = 0;
+	for(const Event* event: events)
+		assetBytes += (event->kind == ASSET)? event->bytes: 0;
+
+	out << "{\n";
+	out << "  \"version\": " << REPORT_VERSION << ",\n";
+	out << "  \"duration_us\": " << duration() / 1000 << ",\n";
+	out << "  \"threads\": " << _threads.size() << ",\n";
+	out << "  \"asset_bytes\": " << assetBytes << ",\n";
+
+	for(Kind kind: { PHASE, ASSET }) {
+		out << ((kind == PHASE)? "  \"phases\": [": "  \"assets\": [");
+		bool first = true;
+		for(const Event* event: events) {
+			if(event->kind != kind)
+				continue;
+			out << (first? "\n": ",\n") << "    { \"name\": ";
+			writeString(out, event->name);
+			out << ", \"thread\": "      << event->thread
+			    << ", \"start_us\": "    << event->start / 1000
+			    << ", \"duration_us\": " << (event->end - event->start) / 1000
+			    << ", \"bytes\": "       << event->bytes << " }";
+			first = false;
+		}
+		out << ((kind == PHASE)? "\n  ],\n": "\n  ]\n");
+	}
+	out << "}\n";
+
+	return out.good();
+}
+
+
+// Phases are nested per thread, as are the assets timed by the loaders
+// themselves (see packed_loaders.h), one at a time per loader thread.
+// Assets only seen loaded by the main thread (see LoadGraph::record())
+// overlap freely, so they get their own tracks, allocated greedily.
+bool StartupProfile::writeChromeTrace(const Path& path, Logger& log) const {
+	std::ofstream out(path.utf8CStr());
+	if(!out.good()) {
+		log.error("Failed to write startup trace \"", path, "\"");
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	std::vector<const Event*> assets;
+	for(const Event& event: _events) {
+		if(event.kind == ASSET && event.thread == 0)
+			assets.push_back(&event);
+	}
+	std::stable_sort(assets.begin(), assets.end(), [](const Event* e0, const Event* e1) {
+		return e0->start < e1->start;
+	});
+
+	std::vector<int64>    trackEnds;
+	std::vector<unsigned> assetTracks;
+	for(const Event* event: assets) {
+		unsigned track = 0;
+		while(track < trackEnds.size() && trackEnds[track] > event->start)
+			++track;
+		if(track == trackEnds.size())
+			trackEnds.push_back(0);
+		trackEnds[track] = event->end;
+		assetTracks.push_back(track);
+	}
+
+	bool first = true;
+	auto writeEvent = [&out, &first](const Event& event, const char* cat, unsigned tid) {
+		out << (first? "\n": ",\n") << "  { \"name\": ";
+		writeString(out, event.name);
+		out << ", \"cat\": \"" << cat << "\", \"ph\": \"X\""
+		    << ", \"ts\": "  << event.start / 1000
+		    << ", \"dur\": " << std::max((event.end - event.start) / 1000, int64(1))
+		    << ", \"pid\": 1, \"tid\": " << tid
+		    << ", \"args\": { \"bytes\": " << event.bytes << " } }";
+		first = false;
+	};
+	auto writeThreadName = [&out, &first](unsigned tid, const String& name) {
+		out << (first? "\n": ",\n")
+		    << "  { \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << tid
+		    << ", \"args\": { \"name\": ";
+		writeString(out, name);
+		out << " } }";
+		first = false;
+	};
+
+	out << "{ \"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+	for(unsigned ti = 0; ti < _threads.size(); ++ti)
+		writeThreadName(ti, ti? "thread " + std::to_string(ti): String("main"));
+	for(unsigned ti = 0; ti < trackEnds.size(); ++ti)
+		writeThreadName(_threads.size() + ti, "assets " + std::to_string(ti));
+
+	for(const Event& event: _events) {
+		if(event.kind == PHASE)
+			writeEvent(event, "phase", event.thread);
+		else if(event.thread != 0)
+			writeEvent(event, "asset", event.thread);
+	}
+	for(unsigned ai = 0; ai < assets.size(); ++ai)
+		writeEvent(*assets[ai], "asset", _threads.size() + assetTracks[ai]);
+	out << "\n] }\n";
+
+	return out.good();
+}
+
+
+uint64 StartupProfile::fileSize(const Path& path) {
+	std::ifstream in(path.utf8CStr(), std::ios::binary | std::ios::ate);
+	if(!in.good())
+		return 0;
+	std::streamoff size = in.tellg();
+	return (size > 0)? uint64(size): 0;
+}
+
+
+unsigned StartupProfile::threadIndex(std::thread::id thread) {
+	auto it = std::find(_threads.begin(), _threads.end(), thread);
+	if(it != _threads.end())
+		return it - _threads.begin();
+	_threads.push_back(thread);
+	return _threads.size() - 1;
+}
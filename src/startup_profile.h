@@ -0,0 +1,121 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef LD39_STARTUP_PROFILE_H_
+#define LD39_STARTUP_PROFILE_H_
+
+
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <lair/core/lair.h>
+#include <lair/core/log.h>
+#include <lair/core/path.h>
+
+
+using namespace lair;
+
+
+// Timeline of the startup, from the creation of the game to the first
+// frame of the first state: the phases (scopes) and the assets they load,
+// with their wall time, thread and size. Written on exit as a report (json)
+// and a trace viewable in chrome://tracing.
+class StartupProfile {
+public:
+	enum Kind {
+		PHASE,
+		ASSET,
+	};
+
+	struct Event {
+		String   name;
+		Kind     kind;
+		unsigned thread;  // 0 is the main thread.
+		int64    start;   // In ns, since the profile creation.
+		int64    end;
+		uint64   bytes;
+	};
+
+	// Records a phase from its construction to its destruction.
+	class Scope {
+	public:
+		Scope(StartupProfile& profile, const String& name);
+		Scope(const Scope&)  = delete;
+		Scope(      Scope&&) = delete;
+		~Scope();
+
+		Scope& operator=(const Scope&)  = delete;
+		Scope& operator=(      Scope&&) = delete;
+
+		inline void addBytes(uint64 bytes) { _bytes += bytes; }
+
+	private:
+		StartupProfile& _profile;
+		String          _name;
+		int64           _start;
+		uint64          _bytes;
+	};
+
+public:
+	StartupProfile();
+	StartupProfile(const StartupProfile&)  = delete;
+	StartupProfile(      StartupProfile&&) = delete;
+	~StartupProfile() = default;
+
+	StartupProfile& operator=(const StartupProfile&)  = delete;
+	StartupProfile& operator=(      StartupProfile&&) = delete;
+
+	// Events are ignored once the startup is finished.
+	inline bool isRecording() const { return _endTime < 0; }
+	void finish();
+
+	// Times are absolute, as returned by now().
+	void addEvent(const String& name, Kind kind, int64 start, int64 end, uint64 bytes,
+	              std::thread::id thread = std::this_thread::get_id());
+
+	// The first asset event named name, if any.
+	bool findAsset(const String& name, Event& event) const;
+
+	int64 now() const;
+	inline int64 duration() const { return _endTime < 0? 0: _endTime - _startTime; }
+
+	void logSummary(Logger& log) const;
+	bool writeReport(const Path& path, Logger& log) const;
+	bool writeChromeTrace(const Path& path, Logger& log) const;
+
+	// Size of the file, 0 if it does not exist.
+	static uint64 fileSize(const Path& path);
+
+protected:
+	unsigned threadIndex(std::thread::id thread);
+
+protected:
+	mutable std::mutex _mutex;
+
+	int64              _startTime;
+	int64              _endTime;
+	std::vector<Event> _events;
+	std::vector<std::thread::id> _threads;
+};
+
+
+#endif
@@ -0,0 +1,97 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <lair/core/json.h>
+
+#include "texture_atlas.h"
+
+
+bool TextureAtlas::load(const Path& dir, const Path& manifest, Logger& log) {
+	Path realPath = dir / manifest;
+	Path::IStream in(realPath.native().c_str());
+	if(!in.good())
+		return false;
+
+	Json::Value json;
+	Json::Reader reader;
+	if(!reader.parse(in, json)) {
+		log.error("Failed to read atlas manifest \"", manifest, "\": ",
+		          reader.getFormattedErrorMessages());
+		return false;
+	}
+
+	Path    texture = json.get("texture", "").asString();
+	Vector2 atlasSize(json.get("width", 0).asFloat(), json.get("height", 0).asFloat());
+	if(texture.empty() || atlasSize(0) <= 0 || atlasSize(1) <= 0) {
+		log.error("Invalid atlas manifest \"", manifest, "\"");
+		return false;
+	}
+
+	const Json::Value& regions = json["regions"];
+	for(auto it = regions.begin(); it != regions.end(); ++it) {
+		const Json::Value& r = *it;
+		Vector2 pos (r.get("x",     0).asFloat(), r.get("y",      0).asFloat());
+		Vector2 size(r.get("width", 0).asFloat(), r.get("height", 0).asFloat());
+
+		// Regions are given from the top of the atlas, views go up.
+		AtlasRegion region;
+		region.texture = texture;
+		region.view    = Box2(Vector2(pos(0) / atlasSize(0), 1 - (pos(1) + size(1)) / atlasSize(1)),
+		                      Vector2((pos(0) + size(0)) / atlasSize(0), 1 - pos(1) / atlasSize(1)));
+		region.size    = size;
+		_regions[Path(it.key().asString())] = region;
+	}
+
+	log.info("Atlas \"", texture, "\": ", regions.size(), " images");
+	return true;
+}
+
+
+const AtlasRegion* TextureAtlas::find(const Path& image) const {
+	auto it = _regions.find(image);
+	return (it != _regions.end())? &it->second: nullptr;
+}
+
+
+void TextureAtlas::setTexture(SpriteComponent* sprite, const Path& image) const {
+	const AtlasRegion* region = find(image);
+	if(region) {
+		sprite->setTexture(region->texture);
+		sprite->setView(region->view);
+	}
+	else {
+		sprite->setTexture(image);
+		sprite->setView(Box2(Vector2(0, 0), Vector2(1, 1)));
+	}
+}
+
+
+void TextureAtlas::remapSprites(SpriteComponentManager& sprites, EntityRef entity) const {
+	SpriteComponent* sprite = sprites.get(entity);
+	if(sprite && find(sprite->texturePath()))
+		setTexture(sprite, sprite->texturePath());
+
+	EntityRef child = entity.firstChild();
+	while(child.isValid()) {
+		remapSprites(sprites, child);
+		child = child.nextSibling();
+	}
+}
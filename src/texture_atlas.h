@@ -0,0 +1,83 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef LD39_TEXTURE_ATLAS_H_
+#define LD39_TEXTURE_ATLAS_H_
+
+
+#include <unordered_map>
+
+#include <lair/core/lair.h>
+#include <lair/core/log.h>
+#include <lair/core/path.h>
+
+#include <lair/ec/entity.h>
+#include <lair/ec/sprite_component.h>
+
+
+using namespace lair;
+
+
+struct AtlasRegion {
+	Path    texture;  // The atlas.
+	Box2    view;     // Sprite view of the region, y up (see SpriteBatcher).
+	Vector2 size;     // Of the original image, in pixels.
+};
+
+
+// Maps images to the regions of the atlases built by pack_atlas (the
+// atlases target). Sprites that use a packed image are given the atlas as
+// texture and the region as view; their tile grid divides the region. The
+// packed images are never loaded, so sprites of different images share a
+// texture and a batch.
+class TextureAtlas {
+public:
+	TextureAtlas() = default;
+	TextureAtlas(const TextureAtlas&)  = delete;
+	TextureAtlas(      TextureAtlas&&) = delete;
+	~TextureAtlas() = default;
+
+	TextureAtlas& operator=(const TextureAtlas&)  = delete;
+	TextureAtlas& operator=(      TextureAtlas&&) = delete;
+
+	// Adds the regions of the manifest in dir. Returns false, silently, if
+	// it does not exist: atlases are optional.
+	bool load(const Path& dir, const Path& manifest, Logger& log);
+
+	inline unsigned nRegions() const { return _regions.size(); }
+
+	// Null if image is not in an atlas.
+	const AtlasRegion* find(const Path& image) const;
+
+	// Replaces SpriteComponent::setTexture().
+	void setTexture(SpriteComponent* sprite, const Path& image) const;
+	// Moves the sprites of entity and its descendants that use a packed
+	// image to its atlas (e.g. the ones loaded from entities.ldl).
+	void remapSprites(SpriteComponentManager& sprites, EntityRef entity) const;
+
+protected:
+	typedef std::unordered_map<Path, AtlasRegion, boost::hash<Path>> RegionMap;
+
+	RegionMap _regions;
+};
+
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <algorithm>
+
+#include "packed_loaders.h"
+
+#include "texture_residency.h"
+
+
+TextureResidency::TextureResidency(AssetManager* assets, LoaderManager* loader,
+                                   Logger& log, size_t budget)
+	: _assets(assets)
+	, _loader(loader)
+	, _log(log)
+	, _budget(budget)
+	, _clock(0)
+	, _deferRelease(false)
+{
+}
+
+
+void TextureResidency::require(const PathVector& images, bool wait) {
+	_clock += 1;
+
+	bool loading = false;
+	for(const Path& path: images) {
+		auto inserted = _entries.emplace(path, Entry{ 0, 0, false });
+		inserted.first->second.lastUse = _clock;
+
+		// Evicted but not released yet: keep it.
+		_evicted.erase(std::remove(_evicted.begin(), _evicted.end(), path), _evicted.end());
+
+		if(!isResident(path)) {
+			_log.info("Stream in \"", path, "\"");
+			inserted.first->second.bytes = 0;
+			_loader->load<PackedImageLoader>(path);
+			loading = true;
+		}
+	}
+
+	if(wait && loading)
+		_loader->waitAll();
+}
+
+
+void TextureResidency::pin(const PathVector& images) {
+	for(auto& pathEntry: _entries)
+		pathEntry.second.pinned = false;
+	for(const Path& path: images) {
+		auto it = _entries.find(path);
+		if(it != _entries.end())
+			it->second.pinned = true;
+	}
+
+	trim();
+}
+
+
+void TextureResidency::trim() {
+	size_t size = residentBytes();
+	while(size > _budget) {
+		auto lru = _entries.end();
+		for(auto it = _entries.begin(); it != _entries.end(); ++it) {
+			if(!it->second.pinned && it->second.bytes
+			&& (lru == _entries.end() || it->second.lastUse < lru->second.lastUse))
+				lru = it;
+		}
+		if(lru == _entries.end())
+			break;
+
+		_log.info("Evict \"", lru->first, "\" (", lru->second.bytes / 1024, " KiB)");
+		AssetSP asset = _assets->getAsset(lru->first);
+		if(_deferRelease)
+			_evicted.push_back(lru->first);
+		else if(asset)
+			_assets->releaseAsset(asset);
+		size -= lru->second.bytes;
+		lru->second.bytes = 0;
+	}
+}
+
+
+void TextureResidency::releaseEvicted() {
+	for(const Path& path: _evicted) {
+		AssetSP asset = _assets->getAsset(path);
+		if(asset)
+			_assets->releaseAsset(asset);
+	}
+	_evicted.clear();
+}
+
+
+// Images that are still loading count as 0.
+size_t TextureResidency::residentBytes() {
+	size_t size = 0;
+	for(auto& pathEntry: _entries) {
+		updateBytes(pathEntry.first, pathEntry.second);
+		size += pathEntry.second.bytes;
+	}
+	return size;
+}
+
+
+bool TextureResidency::isResident(const Path& path) const {
+	AssetSP asset = _assets->getAsset(path);
+	return asset && asset->aspect<ImageAspect>();
+}
+
+
+// Counts the image and the texture made from it, both RGBA.
+void TextureResidency::updateBytes(const Path& path, Entry& entry) {
+	if(entry.bytes)
+		return;
+
+	AssetSP asset = _assets->getAsset(path);
+	ImageAspectSP image = asset? asset->aspect<ImageAspect>(): nullptr;
+	if(image && image->isValid())
+		entry.bytes = size_t(image->get().width()) * image->get().height() * 4 * 2;
+}
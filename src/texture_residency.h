@@ -0,0 +1,101 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef LD39_TEXTURE_RESIDENCY_H_
+#define LD39_TEXTURE_RESIDENCY_H_
+
+
+#include <unordered_map>
+#include <vector>
+
+#include <lair/core/lair.h>
+#include <lair/core/log.h>
+#include <lair/core/path.h>
+
+#include <lair/asset/asset_manager.h>
+
+
+using namespace lair;
+
+
+typedef std::vector<Path> PathVector;
+
+
+// Keeps the level images (backgrounds, tilesets, end screens) loaded on
+// demand, within a memory budget. Images in use are pinned; the others
+// stay loaded until the budget is exceeded, then are released least
+// recently required first, and loaded again if required later.
+class TextureResidency {
+public:
+	TextureResidency(AssetManager* assets, LoaderManager* loader, Logger& log,
+	                 size_t budget);
+	TextureResidency(const TextureResidency&)  = delete;
+	TextureResidency(      TextureResidency&&) = delete;
+	~TextureResidency() = default;
+
+	TextureResidency& operator=(const TextureResidency&)  = delete;
+	TextureResidency& operator=(      TextureResidency&&) = delete;
+
+	inline size_t budget() const { return _budget; }
+	inline void   setBudget(size_t budget) { _budget = budget; }
+
+	// Loads the images that are not resident. If wait, returns once they
+	// are loaded.
+	void require(const PathVector& images, bool wait);
+
+	// Pins images and unpins all the others, then evicts unpinned images
+	// until the resident ones fit in the budget.
+	void pin(const PathVector& images);
+	void trim();
+
+	// With a simulation thread (--sim-thread), evicted images are only
+	// released by releaseEvicted(), called by the thread that owns the GL
+	// context, as their textures go with them. Callers synchronize.
+	inline void setDeferRelease(bool defer) { _deferRelease = defer; }
+	void releaseEvicted();
+
+	size_t residentBytes();
+
+protected:
+	struct Entry {
+		size_t bytes;    // 0 until loaded.
+		uint64 lastUse;
+		bool   pinned;
+	};
+	typedef std::unordered_map<Path, Entry, boost::hash<Path>> EntryMap;
+
+	bool isResident(const Path& path) const;
+	void updateBytes(const Path& path, Entry& entry);
+
+protected:
+	AssetManager*  _assets;
+	LoaderManager* _loader;
+	Logger&        _log;
+
+	size_t         _budget;
+	EntryMap       _entries;
+	uint64         _clock;
+	bool           _deferRelease;
+	PathVector     _evicted;
+};
+
+
+#endif
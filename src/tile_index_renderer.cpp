@@ -0,0 +1,326 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "level.h"
+
+#include "tile_index_renderer.h"
+
+
+#define TILE_SHADER_HEADER \
+	"#ifdef GL_ES\n" \
+	"precision mediump float;\n" \
+	"#endif\n" \
+	"const float TILE_SIZE = 24.0;\n" \
+	"const vec2 TILE_SET_SIZE = vec2(16.0, 16.0);\n"
+
+static const char* VERTEX_SHADER =
+	TILE_SHADER_HEADER
+	"uniform mat4 viewMatrix;\n"
+	"uniform vec3 offset;\n"
+	"uniform vec2 mapSize;\n"
+	"attribute vec2 vx_position;\n"
+	"varying vec2 mapCoord;\n"
+	"void main() {\n"
+	"	gl_Position = viewMatrix * vec4(vx_position, offset.z, 1.0);\n"
+	"	vec2 p = (vx_position - offset.xy) / TILE_SIZE;\n"
+	"	mapCoord = vec2(p.x, mapSize.y - p.y);\n"
+	"}\n";
+
+// Texture coordinates stay half a texel inside the tile, bilinear
+// filtering would bleed the neighbour tiles in otherwise.
+static const char* FRAGMENT_SHADER =
+	TILE_SHADER_HEADER
+	"uniform vec2 mapSize;\n"
+	"uniform sampler2D tileIndices;\n"
+	"uniform sampler2D tileSet;\n"
+	"varying vec2 mapCoord;\n"
+	"void main() {\n"
+	"	vec2 cell = floor(mapCoord);\n"
+	"	vec4 index = texture2D(tileIndices, (cell + 0.5) / mapSize);\n"
+	"	if(index.a < 0.5)\n"
+	"		discard;\n"
+	"	vec2 inTile = clamp(mapCoord - cell, 0.5 / TILE_SIZE, 1.0 - 0.5 / TILE_SIZE);\n"
+	"	vec4 color = texture2D(tileSet, (floor(index.rg * 255.0 + 0.5) + inTile) / TILE_SET_SIZE);\n"
+	"	if(color.a < 0.5)\n"
+	"		discard;\n"
+	"	gl_FragColor = color;\n"
+	"}\n";
+
+
+TileIndexRenderer::TileIndexRenderer(Renderer* renderer, Logger& log)
+	: _renderer(renderer)
+	, _log(log)
+	, _program(0)
+	, _vertexBuffer(0)
+	, _viewMatrixLoc(-1)
+	, _offsetLoc(-1)
+	, _mapSizeLoc(-1)
+	, _tileIndicesLoc(-1)
+	, _tileSetLoc(-1)
+	, _indexTexture(0)
+	, _tileSetTexture(0)
+	, _size(0, 0)
+	, _offset(Vector3::Zero())
+{
+}
+
+
+TileIndexRenderer::~TileIndexRenderer() {
+	shutdown();
+}
+
+
+bool TileIndexRenderer::initialize() {
+	Context* glc = _renderer->context();
+
+	GLuint vertexShader   = compileShader(gl::VERTEX_SHADER,   VERTEX_SHADER);
+	GLuint fragmentShader = compileShader(gl::FRAGMENT_SHADER, FRAGMENT_SHADER);
+	if(!vertexShader || !fragmentShader) {
+		glc->deleteShader(vertexShader);
+		glc->deleteShader(fragmentShader);
+		return false;
+	}
+
+	_program = glc->createProgram();
+	glc->attachShader(_program, vertexShader);
+	glc->attachShader(_program, fragmentShader);
+	glc->bindAttribLocation(_program, 0, "vx_position");
+	glc->linkProgram(_program);
+	glc->deleteShader(vertexShader);
+	glc->deleteShader(fragmentShader);
+
+	GLint linked = 0;
+	glc->getProgramiv(_program, gl::LINK_STATUS, &linked);
+	if(!linked) {
+		char info[1024];
+		glc->getProgramInfoLog(_program, sizeof(info), nullptr, info);
+		_log.error("Failed to link the tile index shader: ", info);
+		glc->deleteProgram(_program);
+		_program = 0;
+		return false;
+	}
+
+	_viewMatrixLoc  = glc->getUniformLocation(_program, "viewMatrix");
+	_offsetLoc      = glc->getUniformLocation(_program, "offset");
+	_mapSizeLoc     = glc->getUniformLocation(_program, "mapSize");
+	_tileIndicesLoc = glc->getUniformLocation(_program, "tileIndices");
+	_tileSetLoc     = glc->getUniformLocation(_program, "tileSet");
+
+	glc->genBuffers(1, &_vertexBuffer);
+
+	return true;
+}
+
+
+void TileIndexRenderer::shutdown() {
+	clear();
+
+	Context* glc = _renderer->context();
+	if(_vertexBuffer)
+		glc->deleteBuffers(1, &_vertexBuffer);
+	if(_program)
+		glc->deleteProgram(_program);
+	_vertexBuffer = 0;
+	_program      = 0;
+}
+
+
+bool TileIndexRenderer::setTiles(const uint16* tiles, unsigned width, unsigned height,
+                                 const Vector3& offset) {
+	Context* glc = _renderer->context();
+
+	GLint maxSize = 0;
+	glc->getIntegerv(gl::MAX_TEXTURE_SIZE, &maxSize);
+	if(width > unsigned(maxSize) || height > unsigned(maxSize)) {
+		_log.error("Tile map too large for a texture: ", width, "x", height,
+		           " tiles (max ", maxSize, ")");
+		if(_indexTexture)
+			glc->deleteTextures(1, &_indexTexture);
+		_indexTexture = 0;
+		return false;
+	}
+
+	std::vector<uint8> texels(size_t(width) * height * 4);
+	for(size_t ti = 0; ti < size_t(width) * height; ++ti)
+		encode(tiles[ti], &texels[ti * 4]);
+
+	if(!_indexTexture)
+		glc->genTextures(1, &_indexTexture);
+	glc->bindTexture(gl::TEXTURE_2D, _indexTexture);
+	glc->texParameteri(gl::TEXTURE_2D, gl::TEXTURE_MIN_FILTER, gl::NEAREST);
+	glc->texParameteri(gl::TEXTURE_2D, gl::TEXTURE_MAG_FILTER, gl::NEAREST);
+	glc->texParameteri(gl::TEXTURE_2D, gl::TEXTURE_WRAP_S, gl::CLAMP_TO_EDGE);
+	glc->texParameteri(gl::TEXTURE_2D, gl::TEXTURE_WRAP_T, gl::CLAMP_TO_EDGE);
+	glc->pixelStorei(gl::UNPACK_ALIGNMENT, 1);
+	glc->texImage2D(gl::TEXTURE_2D, 0, gl::RGBA, width, height, 0,
+	                gl::RGBA, gl::UNSIGNED_BYTE, texels.data());
+	glc->bindTexture(gl::TEXTURE_2D, 0);
+
+	_size   = Vector2i(width, height);
+	_offset = offset;
+	return true;
+}
+
+
+void TileIndexRenderer::setTile(unsigned x, unsigned y, unsigned tile) {
+	if(!_indexTexture || x >= unsigned(_size(0)) || y >= unsigned(_size(1)))
+		return;
+
+	uint8 texel[4];
+	encode(tile, texel);
+
+	Context* glc = _renderer->context();
+	glc->bindTexture(gl::TEXTURE_2D, _indexTexture);
+	glc->pixelStorei(gl::UNPACK_ALIGNMENT, 1);
+	glc->texSubImage2D(gl::TEXTURE_2D, 0, x, y, 1, 1, gl::RGBA, gl::UNSIGNED_BYTE, texel);
+	glc->bindTexture(gl::TEXTURE_2D, 0);
+}
+
+
+// The tileset is uploaded again, without mipmaps, rather than shared with
+// the sprite texture: mipmaps would blur the tile borders.
+void TileIndexRenderer::setTileSet(const ImageAspectSP& tileSet) {
+	if(tileSet == _tileSet)
+		return;
+	_tileSet = tileSet;
+
+	Context* glc = _renderer->context();
+	if(!tileSet || !tileSet->isValid()) {
+		if(_tileSetTexture)
+			glc->deleteTextures(1, &_tileSetTexture);
+		_tileSetTexture = 0;
+		return;
+	}
+
+	const Image& image = tileSet->get();
+	if(!_tileSetTexture)
+		glc->genTextures(1, &_tileSetTexture);
+	glc->bindTexture(gl::TEXTURE_2D, _tileSetTexture);
+	glc->texParameteri(gl::TEXTURE_2D, gl::TEXTURE_MIN_FILTER, gl::LINEAR);
+	glc->texParameteri(gl::TEXTURE_2D, gl::TEXTURE_MAG_FILTER, gl::LINEAR);
+	glc->texParameteri(gl::TEXTURE_2D, gl::TEXTURE_WRAP_S, gl::CLAMP_TO_EDGE);
+	glc->texParameteri(gl::TEXTURE_2D, gl::TEXTURE_WRAP_T, gl::CLAMP_TO_EDGE);
+	glc->pixelStorei(gl::UNPACK_ALIGNMENT, 1);
+	glc->texImage2D(gl::TEXTURE_2D, 0, gl::RGBA, image.width(), image.height(), 0,
+	                gl::RGBA, gl::UNSIGNED_BYTE, image.data());
+	glc->bindTexture(gl::TEXTURE_2D, 0);
+}
+
+
+void TileIndexRenderer::clear() {
+	Context* glc = _renderer->context();
+	if(_indexTexture)
+		glc->deleteTextures(1, &_indexTexture);
+	if(_tileSetTexture)
+		glc->deleteTextures(1, &_tileSetTexture);
+	_indexTexture   = 0;
+	_tileSetTexture = 0;
+	_tileSet.reset();
+	_size = Vector2i(0, 0);
+}
+
+
+void TileIndexRenderer::render(const OrthographicCamera& camera) {
+	if(!isReady())
+		return;
+
+	// The quad covers the part of the map in view.
+	Box3 view = camera.viewBox();
+	Vector2 mapMin = _offset.head<2>();
+	Vector2 mapMax = mapMin + Vector2(_size(0) * TILE_SIZE, _size(1) * TILE_SIZE);
+	Vector2 min = view.min().head<2>().cwiseMax(mapMin);
+	Vector2 max = view.max().head<2>().cwiseMin(mapMax);
+	if(min(0) >= max(0) || min(1) >= max(1))
+		return;
+
+	float quad[8] = {
+	    min(0), min(1),
+	    max(0), min(1),
+	    min(0), max(1),
+	    max(0), max(1),
+	};
+
+	Context* glc = _renderer->context();
+
+	glc->useProgram(_program);
+	glc->uniformMatrix4fv(_viewMatrixLoc, 1, gl::FALSE, camera.transform().data());
+	glc->uniform3f(_offsetLoc, _offset(0), _offset(1), _offset(2));
+	glc->uniform2f(_mapSizeLoc, _size(0), _size(1));
+	glc->uniform1i(_tileIndicesLoc, 0);
+	glc->uniform1i(_tileSetLoc, 1);
+
+	glc->activeTexture(gl::TEXTURE0);
+	glc->bindTexture(gl::TEXTURE_2D, _indexTexture);
+	glc->activeTexture(gl::TEXTURE1);
+	glc->bindTexture(gl::TEXTURE_2D, _tileSetTexture);
+
+	glc->disable(gl::BLEND);
+	glc->enable(gl::DEPTH_TEST);
+
+	glc->bindBuffer(gl::ARRAY_BUFFER, _vertexBuffer);
+	glc->bufferData(gl::ARRAY_BUFFER, sizeof(quad), quad, gl::STREAM_DRAW);
+	glc->enableVertexAttribArray(0);
+	glc->vertexAttribPointer(0, 2, gl::FLOAT, gl::FALSE, 0, nullptr);
+
+	glc->drawArrays(gl::TRIANGLE_STRIP, 0, 4);
+
+	// RenderPass binds what it needs, but expects unit 0 to be active.
+	glc->disableVertexAttribArray(0);
+	glc->bindBuffer(gl::ARRAY_BUFFER, 0);
+	glc->bindTexture(gl::TEXTURE_2D, 0);
+	glc->activeTexture(gl::TEXTURE0);
+	glc->bindTexture(gl::TEXTURE_2D, 0);
+	glc->useProgram(0);
+}
+
+
+void TileIndexRenderer::encode(unsigned tile, uint8* texel) {
+	if(tile == 0) {
+		texel[0] = texel[1] = texel[2] = texel[3] = 0;
+		return;
+	}
+
+	tile -= 1;
+	texel[0] = tile % TILE_SET_WIDTH;
+	texel[1] = tile / TILE_SET_WIDTH;
+	texel[2] = 0;
+	texel[3] = 255;
+}
+
+
+GLuint TileIndexRenderer::compileShader(GLenum type, const char* source) {
+	Context* glc = _renderer->context();
+
+	GLuint shader = glc->createShader(type);
+	glc->shaderSource(shader, 1, &source, nullptr);
+	glc->compileShader(shader);
+
+	GLint compiled = 0;
+	glc->getShaderiv(shader, gl::COMPILE_STATUS, &compiled);
+	if(!compiled) {
+		char info[1024];
+		glc->getShaderInfoLog(shader, sizeof(info), nullptr, info);
+		_log.error("Failed to compile the tile index shader: ", info);
+		glc->deleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
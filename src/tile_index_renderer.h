@@ -0,0 +1,103 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef LD39_TILE_INDEX_RENDERER_H_
+#define LD39_TILE_INDEX_RENDERER_H_
+
+
+#include <vector>
+
+#include <lair/core/lair.h>
+#include <lair/core/log.h>
+
+#include <lair/asset/image.h>
+
+#include <lair/render_gl2/renderer.h>
+#include <lair/render_gl2/orthographic_camera.h>
+
+
+using namespace lair;
+
+
+// Draws a tile layer with a single quad covering the visible part of the
+// map. The tile indices are uploaded once in a texture, one texel per tile,
+// and the fragment shader looks the tileset up from it: the CPU cost of a
+// frame is the same whatever the map size, and changing a tile is a single
+// texel update.
+//
+// GL 2 has no integer textures, so indices are stored in RGBA8 texels:
+// tileset column in red, row in green, alpha 0 for empty tiles. Tiles are
+// opaque or fully transparent, there is no blending.
+class TileIndexRenderer {
+public:
+	TileIndexRenderer(Renderer* renderer, Logger& log);
+	TileIndexRenderer(const TileIndexRenderer&)  = delete;
+	TileIndexRenderer(      TileIndexRenderer&&) = delete;
+	~TileIndexRenderer();
+
+	TileIndexRenderer& operator=(const TileIndexRenderer&)  = delete;
+	TileIndexRenderer& operator=(      TileIndexRenderer&&) = delete;
+
+	// Compiles the shader. Requires a GL context.
+	bool initialize();
+	void shutdown();
+	inline bool isInitialized() const { return _program; }
+
+	// Uploads the tiles (e.g. a CookedLevel layer, row 0 at the top, 0 is
+	// empty) of a layer placed at offset. Fails if the map is larger than
+	// the maximum texture size.
+	bool setTiles(const uint16* tiles, unsigned width, unsigned height,
+	              const Vector3& offset);
+	void setTile(unsigned x, unsigned y, unsigned tile);
+	void setTileSet(const ImageAspectSP& tileSet);
+	void clear();
+
+	inline bool isReady() const { return _program && _indexTexture && _tileSetTexture; }
+
+	void render(const OrthographicCamera& camera);
+
+protected:
+	static void encode(unsigned tile, uint8* texel);
+
+	GLuint compileShader(GLenum type, const char* source);
+
+protected:
+	Renderer* _renderer;
+	Logger&   _log;
+
+	GLuint    _program;
+	GLuint    _vertexBuffer;
+	GLint     _viewMatrixLoc;
+	GLint     _offsetLoc;
+	GLint     _mapSizeLoc;
+	GLint     _tileIndicesLoc;
+	GLint     _tileSetLoc;
+
+	GLuint    _indexTexture;
+	GLuint    _tileSetTexture;
+	ImageAspectSP _tileSet;
+
+	Vector2i  _size;
+	Vector3   _offset;
+};
+
+
+#endif
@@ -0,0 +1,236 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <algorithm>
+#include <cmath>
+
+#include "level.h"
+
+#include "tile_layer_chunks.h"
+
+
+TileLayerChunks::TileLayerChunks(RenderPass* renderPass, SpriteRenderer* spriteRenderer)
+	: _renderPass(renderPass)
+	, _spriteRenderer(spriteRenderer)
+	, _sprites(nullptr)
+	, _tiles(nullptr)
+	, _size(0, 0)
+	, _offset(Vector3::Zero())
+	, _nChunks(0, 0)
+	, _clock(0)
+	, _nDrawnTiles(0)
+{
+}
+
+
+void TileLayerChunks::setLayer(SpriteComponentManager* sprites, EntityRef layer,
+                               const uint16* tiles, unsigned width, unsigned height) {
+	clear();
+
+	_sprites = sprites;
+	_layer   = layer;
+	if(!tileSet() || !tiles)
+		return;
+
+	setTiles(tiles, width, height, _layer.worldTransform().translation());
+}
+
+
+void TileLayerChunks::setLayer(const uint16* tiles, unsigned width, unsigned height,
+                               const Vector3& offset) {
+	clear();
+	if(tiles)
+		setTiles(tiles, width, height, offset);
+}
+
+
+void TileLayerChunks::setTiles(const uint16* tiles, unsigned width, unsigned height,
+                               const Vector3& offset) {
+	_tiles  = tiles;
+	_size   = Vector2i(width, height);
+	_offset = offset;
+
+	_nChunks = Vector2i((width  + TILE_CHUNK_SIZE - 1) / TILE_CHUNK_SIZE,
+	                    (height + TILE_CHUNK_SIZE - 1) / TILE_CHUNK_SIZE);
+	_chunks.resize(_nChunks(0) * _nChunks(1), Chunk{ {}, 0, false });
+}
+
+
+void TileLayerChunks::clear() {
+	_sprites = nullptr;
+	_layer   = EntityRef();
+	_tiles   = nullptr;
+	_size    = Vector2i(0, 0);
+	_nChunks = Vector2i(0, 0);
+	_chunks.clear();
+	_resident.clear();
+	_nDrawnTiles = 0;
+}
+
+
+bool TileLayerChunks::isReady() {
+	SpriteComponent* sc = tileSet();
+	return !sc || states(sc, _layer).textureSet;
+}
+
+
+// The sprite component is disabled on purpose, only the entity tells if
+// the layer is visible.
+TileLayerStates TileLayerChunks::states(SpriteComponent* tileSet, EntityRef layer) {
+	if(!tileSet || !tileSet->texture() || !tileSet->texture()->isValid())
+		return TileLayerStates{ nullptr, BLEND_NONE, false };
+	return TileLayerStates{ tileSet->textureSet(), tileSet->blendingMode(),
+	                        layer.isEnabledRec() };
+}
+
+
+void TileLayerChunks::render(const OrthographicCamera& camera) {
+	render(camera, states(tileSet(), _layer));
+}
+
+
+void TileLayerChunks::render(const OrthographicCamera& camera, const TileLayerStates& layerStates) {
+	_nDrawnTiles = 0;
+
+	if(!_tiles || !layerStates.visible || !layerStates.textureSet)
+		return;
+
+	// Chunks are numbered from the top row of the map, world y goes up.
+	float height = _size(1) * TILE_SIZE;
+	Box3 view = camera.viewBox();
+	Vector2 min = view.min().head<2>() - _offset.head<2>();
+	Vector2 max = view.max().head<2>() - _offset.head<2>();
+	float chunkSize = TILE_CHUNK_SIZE * TILE_SIZE;
+	int cx0 = std::max(int(std::floor(min(0) / chunkSize)), 0);
+	int cx1 = std::min(int(std::ceil( max(0) / chunkSize)), _nChunks(0));
+	int cy0 = std::max(int(std::floor((height - max(1)) / chunkSize)), 0);
+	int cy1 = std::min(int(std::ceil( (height - min(1)) / chunkSize)), _nChunks(1));
+
+	_clock += 1;
+	unsigned index = _spriteRenderer->indexCount();
+	Vector4 color(1, 1, 1, 1);
+	for(int cy = cy0; cy < cy1; ++cy) {
+		for(int cx = cx0; cx < cx1; ++cx) {
+			Chunk& chunk = _chunks[cy * _nChunks(0) + cx];
+			if(!chunk.built)
+				build(cx, cy);
+			chunk.lastUse = _clock;
+
+			unsigned first = _spriteRenderer->vertexCount();
+			for(const Vertex& v: chunk.vertices) {
+				_spriteRenderer->addVertex(Vector4(v.position(0), v.position(1), v.position(2), 1),
+				                           color, v.texCoord);
+			}
+			for(unsigned vi = first; vi < first + chunk.vertices.size(); vi += 4) {
+				_spriteRenderer->addIndex(vi + 0);
+				_spriteRenderer->addIndex(vi + 1);
+				_spriteRenderer->addIndex(vi + 2);
+				_spriteRenderer->addIndex(vi + 2);
+				_spriteRenderer->addIndex(vi + 1);
+				_spriteRenderer->addIndex(vi + 3);
+			}
+			_nDrawnTiles += chunk.vertices.size() / 4;
+		}
+	}
+
+	unsigned count = _spriteRenderer->indexCount() - index;
+	if(count) {
+		const ShaderParameter* params = _spriteRenderer->addShaderParameters(
+		            _spriteRenderer->shader(), camera.transform(), 0);
+
+		RenderPass::DrawStates states;
+		states.vertices     = _spriteRenderer->vertexArray();
+		states.shader       = _spriteRenderer->shader().shader;
+		states.textureSet   = layerStates.textureSet;
+		states.blendingMode = layerStates.blendingMode;
+
+		_renderPass->addDrawCall(states, params, _offset(2), index, count);
+	}
+
+	evict();
+}
+
+
+// The component may have moved in the manager since the last frame.
+SpriteComponent* TileLayerChunks::tileSet() {
+	if(!_sprites || !_layer.isValid())
+		return nullptr;
+	return _sprites->get(_layer);
+}
+
+
+void TileLayerChunks::build(unsigned cx, unsigned cy) {
+	Chunk& chunk = _chunks[cy * _nChunks(0) + cx];
+	chunk.vertices.clear();
+
+	unsigned width  = _size(0);
+	unsigned height = _size(1);
+	unsigned x0 = cx * TILE_CHUNK_SIZE;
+	unsigned y0 = cy * TILE_CHUNK_SIZE;
+	unsigned x1 = std::min(x0 + TILE_CHUNK_SIZE, width);
+	unsigned y1 = std::min(y0 + TILE_CHUNK_SIZE, height);
+	for(unsigned y = y0; y < y1; ++y) {
+		for(unsigned x = x0; x < x1; ++x) {
+			unsigned tile = _tiles[size_t(y) * width + x];
+			if(tile == 0)
+				continue;
+			tile -= 1;
+
+			Vector2 p0(x * TILE_SIZE, (height - y - 1) * TILE_SIZE);
+			Vector2 p1 = p0 + Vector2(TILE_SIZE, TILE_SIZE);
+			p0 += _offset.head<2>();
+			p1 += _offset.head<2>();
+
+			// The first row of the tileset is at v = 0.
+			float tw = 1.f / TILE_SET_WIDTH;
+			float th = 1.f / TILE_SET_HEIGHT;
+			Vector2 t0(tile % TILE_SET_WIDTH * tw, (tile / TILE_SET_WIDTH + 1) * th);
+			Vector2 t1(t0(0) + tw, t0(1) - th);
+
+			float z = _offset(2);
+			chunk.vertices.push_back(Vertex{ Vector3(p0(0), p0(1), z), Vector2(t0(0), t0(1)) });
+			chunk.vertices.push_back(Vertex{ Vector3(p1(0), p0(1), z), Vector2(t1(0), t0(1)) });
+			chunk.vertices.push_back(Vertex{ Vector3(p0(0), p1(1), z), Vector2(t0(0), t1(1)) });
+			chunk.vertices.push_back(Vertex{ Vector3(p1(0), p1(1), z), Vector2(t1(0), t1(1)) });
+		}
+	}
+
+	chunk.built = true;
+	_resident.push_back(cy * _nChunks(0) + cx);
+}
+
+
+// Drops the geometry of the least recently drawn chunks.
+void TileLayerChunks::evict() {
+	if(_resident.size() <= MAX_RESIDENT_TILE_CHUNKS)
+		return;
+
+	std::sort(_resident.begin(), _resident.end(), [this](unsigned c0, unsigned c1) {
+		return _chunks[c0].lastUse > _chunks[c1].lastUse;
+	});
+	for(unsigned ri = MAX_RESIDENT_TILE_CHUNKS; ri < _resident.size(); ++ri) {
+		Chunk& chunk = _chunks[_resident[ri]];
+		chunk.vertices.clear();
+		chunk.vertices.shrink_to_fit();
+		chunk.built = false;
+	}
+	_resident.resize(MAX_RESIDENT_TILE_CHUNKS);
+}
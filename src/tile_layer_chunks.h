@@ -0,0 +1,137 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef LD39_TILE_LAYER_CHUNKS_H_
+#define LD39_TILE_LAYER_CHUNKS_H_
+
+
+#include <vector>
+
+#include <lair/core/lair.h>
+
+#include <lair/render_gl2/orthographic_camera.h>
+#include <lair/render_gl2/render_pass.h>
+#include <lair/render_gl2/texture_set.h>
+
+#include <lair/ec/entity.h>
+#include <lair/ec/sprite_component.h>
+
+
+using namespace lair;
+
+
+enum {
+	// Tiles per side of a render chunk. A 1920x1080 view sees at most 4x3
+	// chunks.
+	TILE_CHUNK_SIZE = 32,
+
+	// Chunks whose geometry is kept when they leave the view.
+	MAX_RESIDENT_TILE_CHUNKS = 64,
+};
+
+
+// What TileLayerChunks reads from the layer each frame.
+struct TileLayerStates {
+	TextureSetCSP textureSet;
+	BlendingMode  blendingMode;
+	bool          visible;
+};
+
+
+// Renders a tile layer by square chunks. The geometry of a chunk is built
+// the first time it is in view and kept while it stays in the
+// MAX_RESIDENT_TILE_CHUNKS most recently drawn ones; each frame only the
+// chunks in the camera view are submitted, in a single draw call. The cost
+// of a frame depends on the view size, not on the map size.
+//
+// The layer entity holds the tileset in a disabled sprite component (see
+// Level::createLayer()), so that the sprites do not draw it. Layers are
+// only translated, and must not move: vertices are built in world
+// coordinates.
+class TileLayerChunks {
+public:
+	TileLayerChunks(RenderPass* renderPass, SpriteRenderer* spriteRenderer);
+	TileLayerChunks(const TileLayerChunks&)  = delete;
+	TileLayerChunks(      TileLayerChunks&&) = delete;
+	~TileLayerChunks() = default;
+
+	TileLayerChunks& operator=(const TileLayerChunks&)  = delete;
+	TileLayerChunks& operator=(      TileLayerChunks&&) = delete;
+
+	// Drops the chunks of the previous layer. layer may be invalid. The
+	// tiles (e.g. a CookedLevel layer, row 0 at the top, 0 is empty) are
+	// read when chunks are built and must outlive the layer.
+	void setLayer(SpriteComponentManager* sprites, EntityRef layer,
+	              const uint16* tiles, unsigned width, unsigned height);
+	// Without component: the states are given to render() (see
+	// RenderSnapshot).
+	void setLayer(const uint16* tiles, unsigned width, unsigned height,
+	              const Vector3& offset);
+	void clear();
+
+	static TileLayerStates states(SpriteComponent* tileSet, EntityRef layer);
+
+	// False until the tileset texture is uploaded.
+	bool isReady();
+
+	void render(const OrthographicCamera& camera);
+	void render(const OrthographicCamera& camera, const TileLayerStates& states);
+
+	inline unsigned nResidentChunks() const { return _resident.size(); }
+	inline unsigned nDrawnTiles() const { return _nDrawnTiles; }
+
+protected:
+	struct Vertex {
+		Vector3 position;
+		Vector2 texCoord;
+	};
+
+	struct Chunk {
+		std::vector<Vertex> vertices;  // 4 per non-empty tile.
+		uint64 lastUse;
+		bool   built;
+	};
+
+	SpriteComponent* tileSet();
+	void setTiles(const uint16* tiles, unsigned width, unsigned height,
+	              const Vector3& offset);
+	void build(unsigned cx, unsigned cy);
+	void evict();
+
+protected:
+	RenderPass*     _renderPass;
+	SpriteRenderer* _spriteRenderer;
+
+	SpriteComponentManager* _sprites;
+	EntityRef          _layer;
+	const uint16*      _tiles;
+	Vector2i           _size;
+	Vector3            _offset;
+
+	Vector2i           _nChunks;
+	std::vector<Chunk> _chunks;
+	std::vector<unsigned> _resident;
+	uint64             _clock;
+	unsigned           _nDrawnTiles;
+};
+
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <algorithm>
+
+#include "tile_rect_tree.h"
+
+
+enum {
+	MAX_LEAF_SIZE = 4,
+};
+
+
+void TileRectTree::build(TileRectVector rects) {
+	_rects = std::move(rects);
+	_nodes.clear();
+	_nodes.reserve(2 * (_rects.size() / MAX_LEAF_SIZE + 1));
+	if(!_rects.empty())
+		buildNode(0, _rects.size());
+}
+
+
+void TileRectTree::clear() {
+	_rects.clear();
+	_nodes.clear();
+}
+
+
+size_t TileRectTree::byteSize() const {
+	return _rects.size() * sizeof(TileRect) + _nodes.size() * sizeof(Node);
+}
+
+
+unsigned TileRectTree::buildNode(unsigned first, unsigned count) {
+	unsigned index = _nodes.size();
+	_nodes.emplace_back();
+
+	TileRect bounds = _rects[first];
+	for(unsigned ri = first + 1; ri < first + count; ++ri) {
+		const TileRect& r = _rects[ri];
+		bounds.x0 = std::min(bounds.x0, r.x0);
+		bounds.y0 = std::min(bounds.y0, r.y0);
+		bounds.x1 = std::max(bounds.x1, r.x1);
+		bounds.y1 = std::max(bounds.y1, r.y1);
+	}
+	_nodes[index].bounds = bounds;
+
+	if(count <= MAX_LEAF_SIZE) {
+		_nodes[index].first = first;
+		_nodes[index].count = count;
+		_nodes[index].right = 0;
+		return index;
+	}
+
+	// Split at the median of the longest axis. Centers are compared
+	// doubled to stay in integers.
+	bool splitX = bounds.x1 - bounds.x0 >= bounds.y1 - bounds.y0;
+	auto begin  = _rects.begin() + first;
+	unsigned half = count / 2;
+	std::nth_element(begin, begin + half, begin + count,
+	                 [splitX](const TileRect& r0, const TileRect& r1) {
+		return splitX? r0.x0 + r0.x1 < r1.x0 + r1.x1:
+		               r0.y0 + r0.y1 < r1.y0 + r1.y1;
+	});
+
+	buildNode(first, half);
+	unsigned right = buildNode(first + half, count - half);
+
+	_nodes[index].first = first;
+	_nodes[index].count = 0;
+	_nodes[index].right = right;
+	return index;
+}
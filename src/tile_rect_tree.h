@@ -0,0 +1,116 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef LD39_TILE_RECT_TREE_H_
+#define LD39_TILE_RECT_TREE_H_
+
+
+#include <vector>
+
+#include <lair/core/lair.h>
+
+
+using namespace lair;
+
+
+// A rectangle of tiles, in tile coordinates, max excluded.
+struct TileRect {
+	inline bool intersects(const TileRect& other) const {
+		return x0 < other.x1 && other.x0 < x1
+		    && y0 < other.y1 && other.y0 < y1;
+	}
+
+	int x0;
+	int y0;
+	int x1;
+	int y1;
+};
+
+typedef std::vector<TileRect> TileRectVector;
+
+
+// Static bounding box tree over tile rectangles. Built once, then only
+// queried, so nodes are stored depth-first in a single array: the left
+// child of a node is the next one.
+class TileRectTree {
+public:
+	TileRectTree() = default;
+	TileRectTree(const TileRectTree&)  = default;
+	TileRectTree(      TileRectTree&&) = default;
+	~TileRectTree() = default;
+
+	TileRectTree& operator=(const TileRectTree&)  = default;
+	TileRectTree& operator=(      TileRectTree&&) = default;
+
+	void build(TileRectVector rects);
+	void clear();
+
+	inline unsigned nRects() const { return _rects.size(); }
+	inline unsigned nNodes() const { return _nodes.size(); }
+	inline const TileRectVector& rects() const { return _rects; }
+
+	// Memory used by the tree, in bytes.
+	size_t byteSize() const;
+
+	// Calls f(rect) for each rectangle intersecting range.
+	template<typename F>
+	void query(const TileRect& range, F f) const {
+		if(_nodes.empty())
+			return;
+
+		unsigned stack[64];
+		unsigned size = 0;
+		stack[size++] = 0;
+		while(size) {
+			const Node& node = _nodes[stack[--size]];
+			if(!node.bounds.intersects(range))
+				continue;
+
+			if(node.count) {
+				for(unsigned ri = node.first; ri < node.first + node.count; ++ri) {
+					if(_rects[ri].intersects(range))
+						f(_rects[ri]);
+				}
+			}
+			else {
+				stack[size++] = node.right;
+				stack[size++] = &node - _nodes.data() + 1;
+			}
+		}
+	}
+
+protected:
+	struct Node {
+		TileRect bounds;
+		unsigned first;
+		unsigned count;  // 0 for inner nodes.
+		unsigned right;
+	};
+
+	unsigned buildNode(unsigned first, unsigned count);
+
+protected:
+	TileRectVector    _rects;
+	std::vector<Node> _nodes;
+};
+
+
+#endif
@@ -0,0 +1,210 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <algorithm>
+#include <cmath>
+
+#include "trigger_grid.h"
+
+
+TriggerGrid::TriggerGrid()
+	: _origin(0, 0)
+	, _cellSize(1)
+	, _size(0, 0)
+	, _nChunks(0, 0)
+	, _clock(0)
+{
+}
+
+
+unsigned TriggerGrid::addTrigger(EntityRef entity, const Box2& box) {
+	_triggers.push_back(Trigger{ entity, box });
+	return _triggers.size() - 1;
+}
+
+
+void TriggerGrid::build(const Box2& bounds, float cellSize) {
+	_origin   = bounds.min();
+	_cellSize = cellSize;
+	_size     = Vector2i(std::max(int(std::ceil(bounds.sizes()(0) / cellSize)), 1),
+	                     std::max(int(std::ceil(bounds.sizes()(1) / cellSize)), 1));
+	_nChunks  = Vector2i((_size(0) + TRIGGER_CHUNK_CELLS - 1) / TRIGGER_CHUNK_CELLS,
+	                     (_size(1) + TRIGGER_CHUNK_CELLS - 1) / TRIGGER_CHUNK_CELLS);
+
+	_chunks.clear();
+	_chunks.resize(_nChunks.prod());
+	_resident.clear();
+}
+
+
+void TriggerGrid::clear() {
+	_triggers.clear();
+	_size    = Vector2i(0, 0);
+	_nChunks = Vector2i(0, 0);
+	_chunks.clear();
+	_resident.clear();
+}
+
+
+// Bucketing a chunk only reads the trigger boxes, it is cheap enough to be
+// done on the spot.
+void TriggerGrid::stream(const std::vector<Box2>& areas, float needMargin, float keepMargin) {
+	if(_chunks.empty())
+		return;
+
+	_clock += 1;
+
+	Vector2i chunkCells = Vector2i::Constant(TRIGGER_CHUNK_CELLS);
+	auto range = [this, &chunkCells](const Box2& area, float margin, Vector2i& begin, Vector2i& end) {
+		Vector2 m = Vector2::Constant(margin);
+		begin = cell(Vector2(area.min() - m)).cwiseQuotient(chunkCells);
+		end   = cell(Vector2(area.max() + m)).cwiseQuotient(chunkCells);
+	};
+
+	for(const Box2& area: areas) {
+		Vector2i needBegin;
+		Vector2i needEnd;
+		Vector2i keepBegin;
+		Vector2i keepEnd;
+		range(area, needMargin, needBegin, needEnd);
+		range(area, keepMargin, keepBegin, keepEnd);
+
+		for(int cy = keepBegin(1); cy <= keepEnd(1); ++cy) {
+			for(int cx = keepBegin(0); cx <= keepEnd(0); ++cx) {
+				unsigned ci = cy * _nChunks(0) + cx;
+				bool need = cx >= needBegin(0) && cx <= needEnd(0)
+				         && cy >= needBegin(1) && cy <= needEnd(1);
+
+				if(!_chunks[ci] && need)
+					bucket(cx, cy);
+				if(_chunks[ci])
+					_chunks[ci]->lastUse = _clock;
+			}
+		}
+	}
+
+	// Whatever is out of every kept range goes away.
+	for(unsigned ri = 0; ri < _resident.size(); ) {
+		unsigned ci = _resident[ri];
+		if(_chunks[ci]->lastUse != _clock) {
+			_chunks[ci].reset();
+			_resident[ri] = _resident.back();
+			_resident.pop_back();
+		}
+		else {
+			++ri;
+		}
+	}
+}
+
+
+void TriggerGrid::query(const Box2& box, std::vector<unsigned>& result) const {
+	if(_chunks.empty())
+		return;
+
+	unsigned first = result.size();
+	Vector2i begin = cell(box.min());
+	Vector2i end   = cell(box.max());
+	for(int y = begin(1); y <= end(1); ++y) {
+		for(int x = begin(0); x <= end(0); ++x) {
+			const Chunk* chunk = _chunks[y / TRIGGER_CHUNK_CELLS * _nChunks(0)
+			                           + x / TRIGGER_CHUNK_CELLS].get();
+			if(!chunk)
+				continue;
+
+			unsigned ci = (y % TRIGGER_CHUNK_CELLS) * TRIGGER_CHUNK_CELLS
+			            +  x % TRIGGER_CHUNK_CELLS;
+			for(unsigned i = chunk->cellStart[ci]; i < chunk->cellStart[ci + 1]; ++i) {
+				unsigned ti = chunk->cellTriggers[i];
+				if(_triggers[ti].box.intersects(box))
+					result.push_back(ti);
+			}
+		}
+	}
+
+	// Triggers spanning several cells are found several times.
+	std::sort(result.begin() + first, result.end());
+	result.erase(std::unique(result.begin() + first, result.end()), result.end());
+}
+
+
+size_t TriggerGrid::byteSize() const {
+	size_t size = _triggers.size() * sizeof(Trigger) + _chunks.size() * sizeof(ChunkUP);
+	for(unsigned ci: _resident) {
+		size += sizeof(Chunk) + (_chunks[ci]->cellStart.size()
+		                       + _chunks[ci]->cellTriggers.size()) * sizeof(unsigned);
+	}
+	return size;
+}
+
+
+// Positions out of the grid are clamped on its border cells.
+Vector2i TriggerGrid::cell(const Vector2& pos) const {
+	Vector2 p = (pos - _origin) / _cellSize;
+	return Vector2i(std::min(std::max(int(std::floor(p(0))), 0), _size(0) - 1),
+	                std::min(std::max(int(std::floor(p(1))), 0), _size(1) - 1));
+}
+
+
+// Count, then fill (compressed rows), for the cells of chunk (cx, cy).
+void TriggerGrid::bucket(unsigned cx, unsigned cy) {
+	ChunkUP chunk(new Chunk);
+	chunk->lastUse = _clock;
+
+	Vector2i origin(cx * TRIGGER_CHUNK_CELLS, cy * TRIGGER_CHUNK_CELLS);
+	Vector2i last = (origin + Vector2i::Constant(TRIGGER_CHUNK_CELLS - 1))
+	                .cwiseMin(Vector2i(_size - Vector2i::Ones()));
+
+	// Cell range of trigger ti in the chunk, false if it does not overlap.
+	auto cells = [&](unsigned ti, Vector2i& begin, Vector2i& end) {
+		begin = cell(_triggers[ti].box.min()).cwiseMax(origin);
+		end   = cell(_triggers[ti].box.max()).cwiseMin(last);
+		return begin(0) <= end(0) && begin(1) <= end(1);
+	};
+
+	const unsigned nCells = TRIGGER_CHUNK_CELLS * TRIGGER_CHUNK_CELLS;
+	chunk->cellStart.assign(nCells + 1, 0);
+	Vector2i begin;
+	Vector2i end;
+	for(unsigned ti = 0; ti < _triggers.size(); ++ti) {
+		if(!cells(ti, begin, end))
+			continue;
+		for(int y = begin(1); y <= end(1); ++y)
+			for(int x = begin(0); x <= end(0); ++x)
+				chunk->cellStart[(y - origin(1)) * TRIGGER_CHUNK_CELLS + x - origin(0) + 1] += 1;
+	}
+	for(unsigned ci = 0; ci < nCells; ++ci)
+		chunk->cellStart[ci + 1] += chunk->cellStart[ci];
+
+	chunk->cellTriggers.resize(chunk->cellStart.back());
+	std::vector<unsigned> fill(chunk->cellStart.begin(), chunk->cellStart.end() - 1);
+	for(unsigned ti = 0; ti < _triggers.size(); ++ti) {
+		if(!cells(ti, begin, end))
+			continue;
+		for(int y = begin(1); y <= end(1); ++y)
+			for(int x = begin(0); x <= end(0); ++x)
+				chunk->cellTriggers[fill[(y - origin(1)) * TRIGGER_CHUNK_CELLS + x - origin(0)]++] = ti;
+	}
+
+	unsigned index = cy * _nChunks(0) + cx;
+	_chunks[index] = std::move(chunk);
+	_resident.push_back(index);
+}
@@ -0,0 +1,113 @@
+/*
+ *  Copyright (C) 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef LD39_TRIGGER_GRID_H_
+#define LD39_TRIGGER_GRID_H_
+
+
+#include <memory>
+#include <vector>
+
+#include <lair/core/lair.h>
+
+#include <lair/ec/entity.h>
+
+
+using namespace lair;
+
+
+enum {
+	// Cells per side of a chunk of the grid.
+	TRIGGER_CHUNK_CELLS = 16,
+};
+
+
+// Static index of the triggers of a level. Triggers are added while the
+// level is loaded, then build() sets up a uniform grid over the level,
+// split in chunks of TRIGGER_CHUNK_CELLS cells. Chunks are bucketed on
+// demand by stream(), like the collision data, so the grid costs the same
+// whatever the size of the level. Triggers are identified by their index,
+// in the order they were added.
+class TriggerGrid {
+public:
+	TriggerGrid();
+	TriggerGrid(const TriggerGrid&)  = delete;
+	TriggerGrid(      TriggerGrid&&) = default;
+	~TriggerGrid() = default;
+
+	TriggerGrid& operator=(const TriggerGrid&)  = delete;
+	TriggerGrid& operator=(      TriggerGrid&&) = default;
+
+	unsigned addTrigger(EntityRef entity, const Box2& box);
+	// Does not bucket anything.
+	void build(const Box2& bounds, float cellSize);
+	void clear();
+
+	// Buckets the chunks closer than needMargin to areas, keeps the ones
+	// closer than keepMargin and drops the others.
+	void stream(const std::vector<Box2>& areas, float needMargin, float keepMargin);
+
+	inline unsigned  nTriggers() const { return _triggers.size(); }
+	inline EntityRef trigger(unsigned index) const { return _triggers[index].entity; }
+	inline const Box2& box(unsigned index) const { return _triggers[index].box; }
+
+	// Appends the sorted indices of the triggers overlapping box to result.
+	// Queries must stay in streamed areas: missing chunks have no trigger.
+	void query(const Box2& box, std::vector<unsigned>& result) const;
+
+	inline unsigned nResidentChunks() const { return _resident.size(); }
+
+	// Memory used by the grid, in bytes.
+	size_t byteSize() const;
+
+protected:
+	struct Trigger {
+		EntityRef entity;
+		Box2      box;
+	};
+
+	struct Chunk {
+		// Triggers of cell i of the chunk are
+		// cellTriggers[cellStart[i], cellStart[i+1]).
+		std::vector<unsigned> cellStart;
+		std::vector<unsigned> cellTriggers;
+		uint64                lastUse;
+	};
+	typedef std::unique_ptr<Chunk> ChunkUP;
+
+	Vector2i cell(const Vector2& pos) const;
+	void bucket(unsigned cx, unsigned cy);
+
+protected:
+	std::vector<Trigger>  _triggers;
+
+	Vector2  _origin;
+	float    _cellSize;
+	Vector2i _size;
+	Vector2i _nChunks;
+
+	std::vector<ChunkUP>  _chunks;
+	std::vector<unsigned> _resident;
+	uint64                _clock;
+};
+
+
+#endif
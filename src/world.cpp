@@ -0,0 +1,783 @@
+/*
+ *  Copyright (C) 2015, 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <algorithm>
+
+#include <lair/core/json.h>
+
+#include "game.h"
+#include "level.h"
+#include "commands.h"
+#include "main_state.h"
+#include "replay.h"
+
+#include "world.h"
+
+
+const float TICK_LENGTH_IN_SEC = 1.f / float(TICKS_PER_SEC);
+const float FADE_DURATION = .5;
+
+std::mutex World::_loadMutex;
+
+
+World::World(Game* game, Logger& logger, MainState* mainState,
+             RenderPass* renderPass, SpriteRenderer* spriteRenderer)
+    : _game(game),
+      _log(logger),
+      _mainState(mainState),
+
+      _entities(logger, game->serializer()),
+      _sprites(game->assets(), game->loader(), renderPass, spriteRenderer),
+      _collisions(),
+      _triggers(),
+      _characters(this),
+      _texts(game->loader(), renderPass, spriteRenderer),
+
+      _scripts(this),
+
+      _inputs(INPUT_NONE),
+      _prevInputs(INPUT_NONE),
+      _tickCount(0),
+      _deathCount(0),
+      _gameOver(false),
+
+      _state(STATE_PLAY),
+      _nextState(STATE_PLAY),
+      _transitionTime(0),
+
+      _overlayTexture("white.png"),
+      _overlayColor(0, 0, 0, 1),
+
+      _baseMaxSpeed(0)
+{
+	_entities.registerComponentManager(&_sprites);
+	_entities.registerComponentManager(&_collisions);
+	_entities.registerComponentManager(&_triggers);
+	_entities.registerComponentManager(&_characters);
+	_entities.registerComponentManager(&_texts);
+
+	_commands.emplace("echo",       CommandInfo{ echoCommand,      0      });
+	_commands.emplace("set_spawn",  CommandInfo{ setSpawnCommand,  1 << 1 });
+	_commands.emplace("kill",       CommandInfo{ killCommand,      0      });
+	_commands.emplace("next_level", CommandInfo{ nextLevelCommand, 0      });
+	_commands.emplace("disable",    CommandInfo{ disableCommand,   1 << 1 });
+	_commands.emplace("no_jump",    CommandInfo{ noJumpCommand,    0      });
+	_commands.emplace("slow",       CommandInfo{ slowCommand,      0      });
+	_commands.emplace("credits",    CommandInfo{ creditsCommand,   0      });
+	_commands.emplace("wait",       CommandInfo{ waitCommand,      0      });
+	_commands.emplace("wait_state", CommandInfo{ waitStateCommand, 0      });
+}
+
+
+World::~World() {
+}
+
+
+void World::initialize(LoadGraph& graph) {
+	StartupProfile::Scope scope(_game->profile(), "World::initialize");
+
+	loadEntities("entities.ldl", _entities.root());
+	_game->atlas().remapSprites(_sprites, _entities.root());
+
+	_models      = _entities.findByName("__models__");
+	_playerModel = _entities.findByName("player_model", _models);
+	_playerDeathModel = _entities.findByName("player_death_model", _models);
+
+	_background  = _entities.findByName("background");
+	_scene       = _entities.findByName("scene");
+	_gui         = _entities.findByName("gui");
+	_fadeOverlay = _entities.findByName("fade_overlay");
+
+	registerLevel("test_map.json", graph);
+	registerLevel("lvl1.json", graph);
+	registerLevel("lvl2.json", graph);
+	registerLevel("lvl3.json", graph);
+	registerLevel("lvl4.json", graph);
+	setNextLevel("lvl1.json");
+
+	// Physics !
+	_playerPhysics.reset(new CharPhysicsParams);
+
+	float tileSize = TILE_SIZE * 2;
+
+	_playerPhysics->accelTime    =  0.1 * TICKS_PER_SEC;
+	_baseMaxSpeed                =  8   * tileSize * TICK_LENGTH_IN_SEC;
+	_playerPhysics->maxSpeed     = _baseMaxSpeed;
+	_playerPhysics->playerAccel  = _playerPhysics->maxSpeed / _playerPhysics->accelTime;
+	_playerPhysics->airControl   =  0.5 * _playerPhysics->playerAccel;
+
+	_playerPhysics->jump         = true;
+	_playerPhysics->numJumps     = 1;
+	_playerPhysics->jumpTicks    = 10;
+//	_playerPhysics->gravity      = 32 * tileSize * TICK_LENGTH_IN_SEC * TICK_LENGTH_IN_SEC;
+//	_playerPhysics->jumpSpeed    = 19 * tileSize * TICK_LENGTH_IN_SEC;
+	_playerPhysics->gravity      = 48 * tileSize * TICK_LENGTH_IN_SEC * TICK_LENGTH_IN_SEC;
+	_playerPhysics->jumpSpeed    = 24.2 * tileSize * TICK_LENGTH_IN_SEC;
+	_playerPhysics->jumpAccel    = _playerPhysics->jumpSpeed / _playerPhysics->jumpTicks;
+	_playerPhysics->maxFallSpeed = _playerPhysics->jumpSpeed;
+
+	_playerPhysics->wallJump         = true;
+	_playerPhysics->wallJumpAccel    = 0.4 * _playerPhysics->jumpAccel;
+	_playerPhysics->maxWallFallSpeed = 0.35 * _playerPhysics->maxFallSpeed;
+
+	_playerPhysics->numDashes = 1;
+	_playerPhysics->dashTicks = 8;
+	_playerPhysics->dashSpeed = 32   * tileSize * TICK_LENGTH_IN_SEC;
+
+	_basePhysics = *_playerPhysics;
+}
+
+
+AssetManager* World::assets() {
+	return _game->assets();
+}
+
+
+LoaderManager* World::loader() {
+	return _game->loader();
+}
+
+
+CommandProgramSP World::compile(const std::string& source, bool bind) {
+	CommandProgramSP program = std::make_shared<CommandProgram>();
+	program->compile(source, _commands, log());
+	if(bind)
+		program->bindEntities([this](const String& name) { return findEntity(name); }, log());
+	return program;
+}
+
+
+void World::exec(const std::string& cmds, EntityRef self) {
+	exec(compile(cmds), self);
+}
+
+
+void World::exec(const CommandProgramSP& program, EntityRef self) {
+	_scripts.start(program, self);
+}
+
+
+void World::setState(State state, State nextState) {
+	log().info("Change state: ", state, " -> ", nextState);
+	_state = state;
+	_nextState = nextState;
+	_transitionTime = 0;
+
+	_scripts.onStateChanged(state);
+}
+
+
+LevelSP World::registerLevel(const Path& path, LoadGraph& graph) {
+	LevelSP level(new Level(this, path, _levelMap.size()));
+	_levelMap.emplace(path, level);
+	level->preload(graph);
+
+	return level;
+}
+
+
+void World::loadLevel(const Path& level, const String& spawn) {
+	std::lock_guard<std::mutex> lock(_loadMutex);
+
+	if(_level)
+		_level->stop();
+
+	// Built levels stay in the cache: a level that has been played only
+	// needs a reset, a preloaded one can be used as is.
+	_level = _levelMap.at(level);
+	if(_level->isBuilt())
+		_level->reset();
+	else
+		_level->build();
+	cacheLevel(_level, true);
+	_preloadLevels.clear();
+
+	// Anything else in the scene that is not a level nor the player (e.g.
+	// benchmark characters) goes away.
+	auto isLevelRoot = [this](EntityRef entity) {
+		for(const LevelSP& level: _levelCache) {
+			if(level->root() == entity)
+				return true;
+		}
+		return false;
+	};
+	EntityRef child = _scene.firstChild();
+	while(child.isValid()) {
+		EntityRef sibling = child.nextSibling();
+		if(child != _player && child != _playerDeath && !isLevelRoot(child))
+			child.destroy();
+		child = sibling;
+	}
+
+	if(!_game->isHeadless()) {
+		// Only if they were evicted since the level was last played.
+		PathVector images;
+		_level->images(images);
+		_game->textures()->require(images, true);
+	}
+
+	applyLevelProperties();
+
+	// The player is cloned once, then reset to the state of a fresh clone.
+	if(!_player.isValid()) {
+		_player = _entities.cloneEntity(_playerModel, _scene, "player");
+		CharacterComponent* pChar = _characters.addComponent(_player);
+		pChar->physics = _playerPhysics;
+
+		_playerDeath = _entities.cloneEntity(_playerDeathModel, _scene, "player_death");
+	}
+
+	_player.setEnabled(true);
+	_player.transform() = _playerModel.transform();
+	_sprites.get(_player)->setTileIndex(0);
+	CharacterComponent* pChar = _characters.get(_player);
+	pChar->reset();
+	pChar->lookDir   = DIR_RIGHT;
+	pChar->animation = nullptr;
+	pChar->triggers.clear();
+
+	_playerDeath.setEnabled(false);
+
+	_spawnName = spawn;
+	_spawn     = _level->entity(_spawnName);
+	_level->start(_spawn);
+
+	for(const Path& path: _level->nextLevels()) {
+		auto it = _levelMap.find(path);
+		if(it != _levelMap.end()) {
+			cacheLevel(it->second, false);
+			_preloadLevels.push_back(it->second);
+		}
+		else
+			log().warning(_level->path(), ": next_level to unknown level \"", path, "\"");
+	}
+
+	if(!_game->isHeadless()) {
+		// Next levels images stream in while this one is played, the others
+		// may be evicted.
+		PathVector nextImages;
+		for(const LevelSP& level: _preloadLevels)
+			level->images(nextImages);
+		_game->textures()->require(nextImages, false);
+
+		PathVector images;
+		_level->images(images);
+		images.insert(images.end(), nextImages.begin(), nextImages.end());
+		_game->textures()->pin(images);
+	}
+
+	setState(_nextState);
+}
+
+
+// Level properties that set up the world: tileset and player physics.
+void World::applyLevelProperties() {
+	CookedProperties props = _level->data().properties();
+
+	if(_level->baseLayer().isValid()) {
+		Path tileset = props.getString("tileset", "tileset.png");
+		_sprites.get(_level->baseLayer())->setTexture(tileset);
+	}
+
+	_playerPhysics->numJumps  = props.getBool("double_jump", true)? 1: 0;
+	_playerPhysics->numDashes = props.getBool("dash", true)? 1: 0;
+	_playerPhysics->wallJump  = props.getBool("wall_jump", true);
+}
+
+
+// Hot reload: applies a new version of a level, its json or its cooked
+// file, to the world. The current level is patched under the player.
+bool World::reloadLevel(const Path& file) {
+	const String& name = file.utf8String();
+	bool cooked = name.size() > 5 && name.compare(name.size() - 5, 5, ".ldlv") == 0;
+	Path levelPath = cooked? Path(name.substr(0, name.size() - 5) + ".json"): file;
+
+	auto it = _levelMap.find(levelPath);
+	if(it == _levelMap.end())
+		return false;
+	LevelSP level = it->second;
+
+	Json::Value map;
+	if(!cooked) {
+		Path realPath = _game->dataPath() / levelPath;
+		Path::IStream in(realPath.native().c_str());
+		Json::Reader reader;
+		if(!in.good() || !reader.parse(in, map)) {
+			log().error("Failed to reload \"", levelPath, "\": ",
+			            reader.getFormattedErrorMessages());
+			return false;
+		}
+	}
+
+	CookedLevel data;
+	if(!(cooked? data.open(_game->generatedPath() / file, log()): data.cook(map, log()))) {
+		log().error("Failed to reload \"", file, "\"");
+		return false;
+	}
+
+	// Trigger indices change, so the ones the player is in are remembered
+	// by entity.
+	CharacterComponent* pChar = _characters.get(_player);
+	std::vector<EntityRef> triggers;
+	if(level == _level && pChar) {
+		for(unsigned ti: pChar->triggers)
+			triggers.push_back(_level->triggerGrid().trigger(ti));
+	}
+
+	bool patched;
+	{
+		std::lock_guard<std::mutex> lock(_loadMutex);
+		patched = level->patch(std::move(data));
+	}
+
+	if(level != _level)
+		return true;
+
+	if(!patched) {
+		Vector2 position = _player.position2();
+		Vector2 velocity = pChar? pChar->velocity: Vector2(Vector2::Zero());
+		loadLevel(levelPath, _spawnName);
+		_player.placeAt(position);
+		_characters.get(_player)->velocity = velocity;
+		return true;
+	}
+
+	applyLevelProperties();
+
+	if(pChar) {
+		const TriggerGrid& grid = _level->triggerGrid();
+		pChar->triggers.clear();
+		for(unsigned ti = 0; ti < grid.nTriggers(); ++ti) {
+			if(std::find(triggers.begin(), triggers.end(), grid.trigger(ti)) != triggers.end())
+				pChar->triggers.push_back(ti);
+		}
+	}
+
+	return true;
+}
+
+
+// Hot reload of entities.ldl. Only the models matter once the world is
+// initialized: the player is cloned again from its new model, and keeps
+// its place and its state.
+bool World::reloadModels() {
+	EntityRef holder = _entities.createEntity(_entities.root(), "__reload__");
+	holder.setEnabled(false);
+	if(!loadEntities("entities.ldl", holder)) {
+		holder.destroy();
+		return false;
+	}
+	_game->atlas().remapSprites(_sprites, holder);
+
+	EntityRef models      = _entities.findByName("__models__", holder);
+	EntityRef playerModel = _entities.findByName("player_model", models);
+	EntityRef deathModel  = _entities.findByName("player_death_model", models);
+	if(!models.isValid() || !playerModel.isValid() || !deathModel.isValid()) {
+		log().error("Failed to reload \"entities.ldl\": player models not found");
+		holder.destroy();
+		return false;
+	}
+
+	// The other entities of the file already exist.
+	EntityRef child = holder.firstChild();
+	while(child.isValid()) {
+		EntityRef sibling = child.nextSibling();
+		if(child != models)
+			child.destroy();
+		child = sibling;
+	}
+
+	EntityRef oldHolder = _models.parent();
+	_models.destroy();
+	if(oldHolder.isValid() && oldHolder != _entities.root())
+		oldHolder.destroy();
+	_models           = models;
+	_playerModel      = playerModel;
+	_playerDeathModel = deathModel;
+
+	if(_player.isValid()) {
+		EntityRef player = _entities.cloneEntity(_playerModel, _scene, "player");
+		player.transform() = _player.transform();
+		player.setEnabled(_player.isEnabled());
+		_sprites.get(player)->setTileIndex(_sprites.get(_player)->tileIndex());
+		_characters.addComponent(player)->copyState(*_characters.get(_player));
+		_player.destroy();
+		_player = player;
+
+		EntityRef death = _entities.cloneEntity(_playerDeathModel, _scene, "player_death");
+		death.transform() = _playerDeath.transform();
+		death.setEnabled(_playerDeath.isEnabled());
+		_playerDeath.destroy();
+		_playerDeath = death;
+	}
+
+	// Trigger commands may name the player.
+	for(const LevelSP& level: _levelCache) {
+		if(level->isBuilt())
+			level->bindCommands();
+	}
+
+	return true;
+}
+
+
+// Moves level to the front (most recently used) or the back of the cache,
+// then destroys the least recently used levels until the cache fits in
+// LEVEL_CACHE_BYTES. The current level and the preloaded ones are kept.
+void World::cacheLevel(const LevelSP& level, bool used) {
+	auto it = std::find(_levelCache.begin(), _levelCache.end(), level);
+	if(it != _levelCache.end())
+		_levelCache.erase(it);
+	if(used)
+		_levelCache.insert(_levelCache.begin(), level);
+	else
+		_levelCache.push_back(level);
+
+	size_t size = 0;
+	for(const LevelSP& cached: _levelCache)
+		size += cached->byteSize();
+
+	for(unsigned li = _levelCache.size(); size > LEVEL_CACHE_BYTES && li-- > 0; ) {
+		LevelSP cached = _levelCache[li];
+		if(cached == _level || cached == level
+		|| std::find(_preloadLevels.begin(), _preloadLevels.end(), cached) != _preloadLevels.end())
+			continue;
+
+		log().info("Evict level ", cached->path(), " from the cache");
+		size -= cached->byteSize();
+		cached->destroy();
+		_levelCache.erase(_levelCache.begin() + li);
+	}
+}
+
+
+// Builds the levels the current one leads to a few objects at a time, so
+// that next_level does not stall the game.
+void World::preloadLevels() {
+	for(const LevelSP& level: _preloadLevels) {
+		if(!level->isBuilt()) {
+			std::lock_guard<std::mutex> lock(_loadMutex);
+			level->build(PRELOAD_OBJECTS_PER_TICK);
+			return;
+		}
+	}
+}
+
+
+void World::setNextLevel(const Path& level, const String& spawn) {
+	_nextLevel = level;
+	_nextLevelSpawn = spawn;
+}
+
+
+void World::changeLevel(const Path& level, const String& spawn) {
+	Path storyScreen = _level->data().properties().getString("end_screen", "");
+	if(storyScreen.empty()) {
+		setOverlay("white.png", Vector4(0, 0, 0, 0));
+		setState(STATE_FADE_OUT, STATE_PLAY);
+	}
+	else{
+		setOverlay(storyScreen, Vector4(1, 1, 1, 0));
+		setState(STATE_FADE_OUT, STATE_PAUSE);
+	}
+
+	setNextLevel(level, spawn);
+	playSound("departure.wav");
+}
+
+
+void World::playSound(const Path& sound) {
+	if(_mainState)
+		_mainState->playSound(sound);
+}
+
+
+void World::playMusic(const Path& music) {
+	if(_mainState)
+		_mainState->playMusic(music);
+}
+
+
+// The overlay is only displayed by MainState; worlds just keep track of it.
+void World::setOverlay(const Path& texture, const Vector4& color) {
+	_overlayTexture = texture;
+	_overlayColor   = color;
+}
+
+
+void World::endGame() {
+	_gameOver = true;
+}
+
+
+EntityRef World::getEntity(const String& name, const EntityRef& ancestor) {
+	EntityRef entity = _entities.findByName(name, ancestor);
+	if(!entity.isValid()) {
+		log().error("Entity \"", name, "\" not found.");
+	}
+	return entity;
+}
+
+
+// Entities of the current level, then the global ones. Not the whole
+// tree: other levels stay built in it. Quiet, unlike getEntity().
+EntityRef World::findEntity(const String& name) {
+	if(_level) {
+		Level::EntityRange range = _level->entities(name);
+		if(range.begin() != range.end())
+			return range.begin()->second;
+	}
+	return globalEntity(name);
+}
+
+
+// The entities commands may name besides those of their level.
+EntityRef World::globalEntity(const String& name) const {
+	for(EntityRef entity: { _player, _playerDeath, _background, _scene, _gui, _fadeOverlay }) {
+		if(entity.isValid() && name == entity.name())
+			return entity;
+	}
+	return EntityRef();
+}
+
+
+EntityRef World::createTrigger(EntityRef parent, const char* name, const AlignedBox2& box) {
+	EntityRef entity = _entities.createEntity(parent, name);
+
+	CollisionComponent* cc = _collisions.addComponent(entity);
+	cc->addShape(Shape2D(box));
+	cc->setHitMask(HIT_PLAYER | HIT_TRIGGER);
+	cc->setIgnoreMask(HIT_TRIGGER);
+
+	_triggers.addComponent(entity);
+
+	return entity;
+}
+
+
+// Only the player fires triggers. The triggers it is in are looked up in
+// the level grid and compared with the previous tick: both lists are
+// sorted, so enter / exit commands run in trigger order, as they are
+// found in the level.
+void World::updateTriggers(bool disableCmds) {
+	CharacterComponent* pChar = _characters.get(_player);
+	CollisionComponent* coll  = _collisions.get(_player);
+	if(!_level || !pChar || !coll || coll->shapes().empty())
+		return;
+
+	const TriggerGrid& grid = _level->triggerGrid();
+	Box2 box = coll->shapes()[0].transformed(_player.worldTransform()).boundingBox();
+
+	_triggersInside.clear();
+	grid.query(box, _triggersInside);
+	_triggersInside.erase(std::remove_if(_triggersInside.begin(), _triggersInside.end(),
+	                                     [this, &grid](unsigned ti) {
+		return !isTriggerEnabled(grid.trigger(ti));
+	}), _triggersInside.end());
+
+	if(!disableCmds) {
+		auto prev    = pChar->triggers.begin();
+		auto prevEnd = pChar->triggers.end();
+		auto next    = _triggersInside.begin();
+		auto nextEnd = _triggersInside.end();
+		while(prev != prevEnd || next != nextEnd) {
+			if(next == nextEnd || (prev != prevEnd && *prev < *next)) {
+				// Disabled triggers leave silently.
+				EntityRef entity = grid.trigger(*prev++);
+				TriggerComponent* tc = _triggers.get(entity);
+				if(isTriggerEnabled(entity))
+					exec(tc->exitProgram, entity);
+			}
+			else if(prev == prevEnd || *next < *prev) {
+				EntityRef entity = grid.trigger(*next++);
+				TriggerComponent* tc = _triggers.get(entity);
+				exec(tc->enterProgram, entity);
+			}
+			else {
+				++prev;
+				++next;
+			}
+		}
+	}
+
+	pChar->triggers.swap(_triggersInside);
+}
+
+
+bool World::isTriggerEnabled(EntityRef trigger) {
+	TriggerComponent* tc = _triggers.get(trigger);
+	return tc && tc->isEnabled() && trigger.isEnabledRec();
+}
+
+
+void World::killPlayer() {
+	// TODO: animation + sound
+	setState(STATE_DEATH);
+
+	playSound("death.wav");
+	_deathCount += 1;
+
+	_player.setEnabled(false);
+	_characters.get(_player)->reset();
+	_playerDeath.setEnabled(true);
+	_playerDeath.transform() = _player.transform();
+	_sprites.get(_playerDeath)->setTileIndex(0);
+}
+
+
+void World::start() {
+	setState(STATE_PLAY, STATE_FADE_IN);
+
+	_inputs     = INPUT_NONE;
+	_prevInputs = INPUT_NONE;
+	_tickCount  = 0;
+	_gameOver   = false;
+
+	// Nothing of the previous run carries over: deaths, and the handicaps
+	// of the commands (slow, no_jump).
+	*_playerPhysics = _basePhysics;
+	_deathCount     = 0;
+
+	_scripts.clear();
+
+	loadLevel(_nextLevel, _nextLevelSpawn);
+	_nextLevel = Path();
+	_nextLevelSpawn.clear();
+}
+
+
+void World::updateTick(unsigned inputs) {
+	_prevInputs = _inputs;
+	_inputs     = inputs;
+	_tickCount += 1;
+
+	_scripts.update(_tickCount);
+
+	if(_state == STATE_PLAY && !_nextLevel.empty()) {
+		loadLevel(_nextLevel, _nextLevelSpawn);
+		_nextLevel = Path();
+		_nextLevelSpawn.clear();
+	}
+
+	_entities.setPrevWorldTransforms();
+
+	if(_state == STATE_PLAY) {
+		// Player input
+		CharacterComponent* pChar = _characters.get(_player);
+		if(isInputPressed(INPUT_LEFT))
+			pChar->pressMove(DIR_LEFT);
+		if(isInputPressed(INPUT_RIGHT))
+			pChar->pressMove(DIR_RIGHT);
+		if(isInputPressed(INPUT_DOWN))
+			pChar->pressMove(DIR_DOWN);
+		if(isInputPressed(INPUT_UP))
+			pChar->pressMove(DIR_UP);
+		pChar->pressJump(isInputPressed(INPUT_JUMP));
+		pChar->pressDash(isInputJustPressed(INPUT_DASH));
+
+		// Update components
+		_characters.updatePhysics();
+
+		_entities.updateWorldTransforms();
+		_characters.processCollisions();
+		updateTriggers();
+	}
+	else if(_state == STATE_DEATH) {
+		_transitionTime += TICK_LENGTH_IN_SEC;
+		int index = _transitionTime * 6;
+
+		SpriteComponent* sprite = _sprites.get(_playerDeath);
+		if(index < sprite->tileGridSize().prod()) {
+			sprite->setTileIndex(index);
+		}
+		else {
+			setState(STATE_PLAY);
+			_player.setEnabled(true);
+			_playerDeath.setEnabled(false);
+			_level->spawnPlayer(_spawn);
+		}
+	}
+	else if(_state == STATE_FADE_IN || _state == STATE_FADE_OUT) {
+		_transitionTime += TICK_LENGTH_IN_SEC;
+		if(_transitionTime > FADE_DURATION) {
+			if(!_nextLevel.empty()) {
+				loadLevel(_nextLevel, _nextLevelSpawn);
+				_nextLevel = Path();
+				_nextLevelSpawn.clear();
+			}
+			else {
+				setState(_nextState);
+			}
+		}
+	}
+	else if(_state == STATE_PAUSE) {
+		if(isInputPressed(INPUT_JUMP)) {
+			setState(STATE_FADE_IN);
+			playSound("arrival.wav");
+		}
+	}
+
+	preloadLevels();
+
+	_entities.updateWorldTransforms();
+}
+
+
+bool World::isInputPressed(unsigned input) const {
+	return _inputs & input;
+}
+
+
+bool World::isInputJustPressed(unsigned input) const {
+	return _inputs & ~_prevInputs & input;
+}
+
+
+bool World::loadEntities(const Path& path, EntityRef parent, const Path& cd) {
+	Path localPath = makeAbsolute(cd, path);
+	log().info("Load entity \"", localPath, "\"");
+
+	auto parse = [&](std::istream& in) {
+		ErrorList errors;
+		LdlParser parser(&in, localPath.utf8String(), &errors, LdlParser::CTX_MAP);
+
+		bool success = _entities.loadEntitiesFromLdl(parser, parent);
+
+		errors.log(log());
+
+		return success;
+	};
+
+	AssetBytes bytes;
+	if(_game->assetPack().read(localPath, bytes, log())) {
+		AssetStreamBuf buffer(bytes);
+		std::istream in(&buffer);
+		return parse(in);
+	}
+
+	Path realPath = _game->dataPath() / localPath;
+	Path::IStream in(realPath.native().c_str());
+	if(!in.good()) {
+		log().error("Unable to read \"", localPath, "\".");
+		return false;
+	}
+	return parse(in);
+}
@@ -0,0 +1,209 @@
+/*
+ *  Copyright (C) 2015, 2017 the authors (see AUTHORS)
+ *
+ *  This file is part of Draklia's ld39.
+ *
+ *  lair is free software: you can redistribute it and/or modify it
+ *  under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  lair is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef LD39_WORLD_H_
+#define LD39_WORLD_H_
+
+
+#include <mutex>
+
+#include <lair/core/lair.h>
+#include <lair/core/log.h>
+#include <lair/core/path.h>
+
+#include <lair/render_gl2/render_pass.h>
+
+#include <lair/ec/entity.h>
+#include <lair/ec/entity_manager.h>
+#include <lair/ec/collision_component.h>
+#include <lair/ec/sprite_component.h>
+#include <lair/ec/bitmap_text_component.h>
+
+#include "command_program.h"
+#include "components.h"
+#include "script_runner.h"
+
+
+using namespace lair;
+
+
+class Game;
+class Level;
+class LoadGraph;
+class MainState;
+class World;
+
+typedef std::shared_ptr<Level> LevelSP;
+typedef std::unordered_map<Path, LevelSP, boost::hash<Path>> LevelMap;
+
+enum {
+	TICKS_PER_SEC  = 60,
+	FRAMES_PER_SEC = 60,
+
+	// Objects of the next level created per tick while it is preloaded.
+	PRELOAD_OBJECTS_PER_TICK = 8,
+
+	// Memory budget of the built levels kept for reuse (see
+	// World::cacheLevel()), in bytes.
+	LEVEL_CACHE_BYTES = 1 << 20,
+};
+
+extern const float TICK_LENGTH_IN_SEC;
+extern const float FADE_DURATION;
+
+
+
+enum State {
+	STATE_PLAY,
+	STATE_DEATH,
+	STATE_FADE_IN,
+	STATE_FADE_OUT,
+	STATE_PAUSE,
+};
+
+
+// Everything that is simulated: entities, level, player and trigger
+// commands. A World does not render nor play sounds by itself, so several
+// of them can run side by side (see BatchSimulator). MainState owns the
+// one that is displayed and forwards sounds and the end of the game.
+class World {
+public:
+	World(Game* game, Logger& logger, MainState* mainState = nullptr,
+	      RenderPass* renderPass = nullptr, SpriteRenderer* spriteRenderer = nullptr);
+	World(const World&)  = delete;
+	World(      World&&) = delete;
+	~World();
+
+	World& operator=(const World&)  = delete;
+	World& operator=(      World&&) = delete;
+
+	void initialize(LoadGraph& graph);
+
+	Game*          game() { return _game; }
+	Logger&        log() { return _log; }
+	AssetManager*  assets();
+	LoaderManager* loader();
+
+	CommandProgramSP compile(const std::string& source, bool bind = true);
+
+	void exec(const std::string& cmd, EntityRef self = EntityRef());
+	void exec(const CommandProgramSP& program, EntityRef self = EntityRef());
+
+	void setState(State state, State nextState = STATE_PLAY);
+
+	LevelSP registerLevel(const Path& level, LoadGraph& graph);
+	void loadLevel(const Path& level, const String& spawn = "spawn");
+	void setNextLevel(const Path& level, const String& spawn = "spawn");
+	void cacheLevel(const LevelSP& level, bool used);
+	void changeLevel(const Path& level, const String& spawn = "spawn");
+	void applyLevelProperties();
+
+	bool reloadLevel(const Path& file);
+	bool reloadModels();
+
+	void playSound(const Path& sound);
+	void playMusic(const Path& music);
+	void setOverlay(const Path& texture, const Vector4& color);
+	void endGame();
+
+	EntityRef getEntity(const String& name, const EntityRef& ancestor = EntityRef());
+	EntityRef findEntity(const String& name);
+	EntityRef globalEntity(const String& name) const;
+	EntityRef createTrigger(EntityRef parent, const char* name, const AlignedBox2& box);
+
+	void updateTriggers(bool disableCmds = false);
+	bool isTriggerEnabled(EntityRef trigger);
+
+	void killPlayer();
+
+	void start();
+	void updateTick(unsigned inputs);
+	void preloadLevels();
+
+	bool isInputPressed(unsigned input) const;
+	bool isInputJustPressed(unsigned input) const;
+
+	bool loadEntities(const Path& path, EntityRef parent = EntityRef(),
+	                  const Path& cd = Path());
+
+public:
+	Game*      _game;
+	Logger&    _log;
+	MainState* _mainState;
+
+	EntityManager              _entities;
+	SpriteComponentManager     _sprites;
+	CollisionComponentManager  _collisions;
+	TriggerComponentManager    _triggers;
+	CharacterComponentManager  _characters;
+	BitmapTextComponentManager _texts;
+
+	CommandMap   _commands;
+	ScriptRunner _scripts;
+
+	std::vector<unsigned> _triggersInside;
+
+	unsigned    _inputs;
+	unsigned    _prevInputs;
+	uint64      _tickCount;
+	unsigned    _deathCount;
+	bool        _gameOver;
+
+	State    _state;
+	State    _nextState;
+	float    _transitionTime;
+
+	LevelMap _levelMap;
+	LevelSP  _level;
+	std::vector<LevelSP> _preloadLevels;
+	// Built levels, most recently used first.
+	std::vector<LevelSP> _levelCache;
+	String   _spawnName;
+	EntityRef _spawn;
+	Path     _nextLevel;
+	String   _nextLevelSpawn;
+
+	Path     _overlayTexture;
+	Vector4  _overlayColor;
+
+	EntityRef   _models;
+
+	EntityRef   _playerModel;
+	float       _baseMaxSpeed;
+	CharPhysicsParamsSP _playerPhysics;
+	CharPhysicsParams   _basePhysics;  // As set by initialize(), restored by start().
+	EntityRef   _playerDeathModel;
+
+	EntityRef   _background;
+	EntityRef   _scene;
+	EntityRef   _player;
+	EntityRef   _playerDeath;
+
+	EntityRef   _gui;
+	EntityRef   _fadeOverlay;
+
+	// Levels and their assets are shared by all the worlds. Level loading
+	// goes through the asset manager, so worlds do it one at a time.
+	static std::mutex _loadMutex;
+};
+
+
+#endif